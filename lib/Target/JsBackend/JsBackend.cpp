@@ -12,6 +12,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "js-backend"
 #include "JsTargetMachine.h"
 #include "llvm/CallingConv.h"
 #include "llvm/Constants.h"
@@ -22,19 +23,36 @@
 #include "llvm/PassManager.h"
 #include "llvm/TypeSymbolTable.h"
 #include "llvm/Intrinsics.h"
+#include "llvm/Metadata.h"
 #include "llvm/IntrinsicInst.h"
 #include "llvm/InlineAsm.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Assembly/AsmAnnotationWriter.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/ConstantsScanner.h"
+#include "llvm/Analysis/DebugInfo.h"
+#include "llvm/Analysis/Dominators.h"
 #include "llvm/Analysis/FindUsedTypes.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/ProfileInfo.h"
+#include "llvm/Analysis/ProfileInfoTypes.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/CodeGen/IntrinsicLowering.h"
+#include "llvm/CodeGen/TargetLoweringObjectFileImpl.h"
 #include "llvm/Target/Mangler.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCSymbol.h"
@@ -46,13 +64,174 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/GetElementPtrTypeIterator.h"
+#include "llvm/Support/InstIterator.h"
 #include "llvm/Support/InstVisitor.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/MathExtras.h"
+#include "llvm/System/Atomic.h"
 #include "llvm/System/Host.h"
+#include "llvm/System/Path.h"
+#include "llvm/System/Threading.h"
 #include "llvm/Config/config.h"
 #include <algorithm>
+#include <cmath>
+#if defined(LLVM_MULTITHREADED) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 using namespace llvm;
 
+STATISTIC(NumLocalsBefore, "Number of JS locals needed without coalescing");
+STATISTIC(NumLocalsAfter, "Number of JS locals declared after coalescing");
+STATISTIC(NumAggregatePHIsSplit, "Number of aggregate PHIs split by element");
+STATISTIC(NumExtractsFolded, "Number of extractvalues folded away");
+STATISTIC(NumLoadsFolded, "Number of loads folded into their statement");
+STATISTIC(NumPooledBytes, "Number of bytes of aggregate constants in the "
+                          "constant pool");
+STATISTIC(NumPooledReuses, "Number of uses of pooled constants after the "
+                           "first");
+STATISTIC(NumChunkedFunctions, "Number of functions left out of the eager code "
+                               "for lazily loaded chunks");
+STATISTIC(NumPrunedFunctions, "Number of functions removed as unreachable from "
+                              "the exports");
+STATISTIC(NumPrunedBytes, "Number of bytes of globals removed as unreachable "
+                          "from the exports");
+STATISTIC(NumCacheHits, "Number of functions reused from the JS cache");
+STATISTIC(NumCacheMisses, "Number of functions printed and added to the JS "
+                          "cache");
+
+static cl::opt<bool>
+HeapMemory("js-heap",
+           cl::desc("Model memory as a single typed array heap, with pointers "
+                    "as integer byte offsets"));
+
+static cl::opt<unsigned>
+HeapSize("js-heap-size", cl::init(16*1024*1024),
+         cl::desc("Size in bytes of the typed array heap (default 16M)"));
+
+static cl::opt<unsigned>
+DataSegmentThreshold("js-data-segment-threshold", cl::init(256),
+                     cl::desc("With -js-heap, initializers of at least this "
+                              "many bytes go into one base64 data segment "
+                              "(default 256)"));
+
+static cl::opt<bool>
+Coercions("js-coercions",
+          cl::desc("Annotate arithmetic, parameters and returns with asm.js "
+                   "style coercions that follow LLVM integer semantics, and "
+                   "split i64 values into 32-bit words.  Without it, i64 "
+                   "values are doubles, which are only exact up to 2^53.  "
+                   "Implies -js-heap"));
+
+static cl::opt<bool>
+Float32("js-float32",
+        cl::desc("Give float values single precision semantics by rounding "
+                 "them with Math.fround wherever they are computed"));
+
+static cl::opt<unsigned>
+EmitThreads("js-threads", cl::init(0),
+            cl::desc("Print function bodies on this many worker threads, "
+                     "keeping the output identical to a serial run"));
+
+static cl::opt<bool>
+Minify("js-minify",
+       cl::desc("Give locals and labels short names ranked by use count, and "
+                "drop indentation and comments"));
+
+static cl::opt<bool>
+LocalBindings("js-local-bindings",
+              cl::desc("Bind module members to closure locals, so that calls "
+                       "and global accesses are direct, and only publish the "
+                       "externally visible ones on the module object"));
+
+static cl::opt<bool>
+ProfileLayout("js-profile-layout",
+              cl::desc("Print hot blocks, branch arms and switch cases first, "
+                       "as counted by the profile in -profile-info-file"));
+
+static cl::opt<std::string>
+CacheDir("js-cache-dir", cl::value_desc("directory"),
+         cl::desc("Reuse the JS of functions that did not change from the "
+                  "cache in this directory, and add the others to it.  Not "
+                  "used with -js-source-map"));
+
+static cl::opt<std::string>
+SourceMapFile("js-source-map", cl::value_desc("filename"),
+              cl::desc("Write a version 3 source map of the output to this "
+                       "file"));
+
+static cl::opt<bool>
+ExternalRuntime("js-external-runtime",
+                cl::desc("Use the runtime support library that an earlier "
+                         "script on the page defines instead of printing it"));
+
+static cl::opt<bool>
+CheckedDivision("js-checked-div",
+                cl::desc("Divide 32-bit integers in the runtime, which "
+                         "truncates toward zero and throws a RangeError on "
+                         "a zero divisor"));
+
+static cl::opt<std::string>
+ChunkPrefix("js-split-chunks", cl::value_desc("prefix"),
+            cl::desc("Print the functions that startup does not need to "
+                     "<prefix>.<n>.js files, which are loaded the first time "
+                     "one of their functions is called.  Not used with "
+                     "-js-source-map"));
+
+static cl::opt<unsigned>
+ChunkSize("js-chunk-size", cl::init(20000),
+          cl::desc("Start a new lazily loaded chunk once one holds this many "
+                   "instructions"));
+
+static cl::opt<std::string>
+ExportsFile("js-exports", cl::value_desc("file"),
+            cl::desc("Publish only the symbols listed in <file>, separated by "
+                     "white space, and main.  Everything they do not reach is "
+                     "removed"));
+
+static cl::opt<std::string>
+ExportsReport("js-exports-report", cl::value_desc("file"),
+              cl::desc("List what -js-exports removed in <file>"));
+
+/// Memory layout of the typed array heap.  Address 0 stays unused so that null
+/// is never a valid object, the next 8 bytes are scratch space for unaligned
+/// floating point accesses, and static data starts right after.  The stack
+/// grows upwards from the end of the static data.
+static const unsigned HeapScratchAddr = 8;
+static const unsigned HeapStaticBase = 16;
+static const unsigned HeapStackAlign = 16;
+
+/// Switches with fewer case values than this, not counting those that go to
+/// the default destination, are printed as they are.  Successor tables have at
+/// most MaxSwitchTableSize entries.
+static const unsigned MinSwitchCaseValues = 4;
+static const uint64_t MaxSwitchTableSize = 4096;
+
+/// Aggregate PHIs that are updated with insertvalue are only split by element
+/// if they have at most this many scalar elements.
+static const unsigned MaxSplitAggregateElements = 16;
+
+/// The window property that the runtime support library is shared under by
+/// all the modules of a page.  The version changes with its interface.
+static const char *const JsRuntimeName = "$llvmjs_1";
+
+/// The metadata kind that JsAnnotateProfile records execution counts under.
+static const char *const ProfileMDName = "js.prof";
+
+/// The named metadata that JsSplitChunks records the functions of each lazily
+/// loaded chunk in.
+static const char *const ChunksMDName = "js.chunks";
+
+/// splitChunks - Return true if functions are split off into lazily loaded
+/// chunks.  Source map positions only cover the main output.
+static bool splitChunks() {
+  return !ChunkPrefix.empty() && SourceMapFile.empty();
+}
+
+/// memcpy and memset of at most this many bytes are unrolled into typed array
+/// element accesses.
+static const unsigned MaxUnrolledMemOpBytes = 64;
+
 extern "C" void LLVMInitializeJsBackendTarget() { 
   // Register the target.
   RegisterTargetMachine<JsTargetMachine> X(TheJsBackendTarget);
@@ -66,6 +245,60 @@ namespace {
       PrivateGlobalPrefix = "";
     }
   };
+
+  /// JsPositionStream - Forward the output to another stream, keeping track of
+  /// the line and column it has reached.  Source map positions are read from
+  /// here.
+  class JsPositionStream : public raw_ostream {
+    raw_ostream &OS;
+    unsigned Line, Column;
+
+    virtual void write_impl(const char *Ptr, size_t Size) {
+      advance(Ptr, Size);
+      OS.write(Ptr, Size);
+    }
+    virtual uint64_t current_pos() const { return OS.tell(); }
+  public:
+    explicit JsPositionStream(raw_ostream &O)
+      : raw_ostream(true), OS(O), Line(0), Column(0) {}
+
+    raw_ostream &getStream() const { return OS; }
+    unsigned getLine() const { return Line; }
+    unsigned getColumn() const { return Column; }
+
+    /// reset - Count from the first column of the first line again.
+    void reset() { Line = Column = 0; }
+
+    /// advance - Move the position past Size characters at Ptr, without
+    /// printing them.
+    void advance(const char *Ptr, size_t Size) {
+      for (const char *End = Ptr + Size; Ptr != End; ++Ptr) {
+        if (*Ptr == '\n') {
+          ++Line;
+          Column = 0;
+        } else {
+          ++Column;
+        }
+      }
+    }
+  };
+
+  /// JsIRLineAnnotator - Record the line each instruction lands on while the
+  /// module is printed as IR.
+  class JsIRLineAnnotator : public AssemblyAnnotationWriter {
+    JsPositionStream &Positions;
+    DenseMap<const Instruction*, unsigned> &Lines;
+  public:
+    JsIRLineAnnotator(JsPositionStream &P,
+                      DenseMap<const Instruction*, unsigned> &L)
+      : Positions(P), Lines(L) {}
+
+    virtual void emitInstructionAnnot(const Instruction *I, raw_ostream &OS) {
+      OS.flush();
+      Lines[I] = Positions.getLine();
+    }
+  };
+
   /// JsBackendNameAllUsedStructsAndMergeFunctions - This pass inserts names for
   /// any unnamed structure types that are used by the program, and merges
   /// external functions with the same name.
@@ -88,17 +321,208 @@ namespace {
 
   char JsBackendNameAllUsedStructsAndMergeFunctions::ID = 0;
 
+  /// JsLegalizeI64 - This pass splits every i64 value, including PHI nodes,
+  /// arguments and return values, into a pair of i32 values.  Javascript
+  /// numbers cannot hold 64-bit integers exactly, while 32-bit integer
+  /// arithmetic maps directly to the engine's integer operations.  The high
+  /// word of an i64 return value is passed back through a global.
+  ///
+  class JsLegalizeI64 : public ModulePass {
+    typedef std::pair<Value*, Value*> ValuePair;
+    DenseMap<Value*, ValuePair> Halves;
+    std::vector<Instruction*> Dead;
+    std::vector<PHINode*> SplitPHIs;
+    Module *TheModule;
+    const IntegerType *Int32Ty;
+    GlobalVariable *HighWord;
+    AllocaInst *Scratch;
+    bool Modified;
+    const TargetData &TD;
+  public:
+    static char ID;
+    explicit JsLegalizeI64(const TargetData &Layout)
+      : ModulePass(&ID), TD(Layout) {}
+
+    virtual const char *getPassName() const {
+      return "Javascript backend i64 legalization";
+    }
+
+    virtual bool runOnModule(Module &M);
+
+  private:
+    static bool isLegalType(const Type *Ty);
+    static bool isLegalFunctionType(const FunctionType *FTy);
+    const FunctionType *getLegalFunctionType(const FunctionType *FTy);
+    static AttrListPtr getLegalAttributes(const AttrListPtr &PAL,
+                                          const Type *RetTy,
+                                          const std::vector<const Type*> &Tys);
+    Function *legalizeSignature(Function *F);
+    bool legalizeFunction(Function &F);
+    void legalizeInstruction(Instruction *I);
+    void expandConstantExprs(Instruction *I);
+    bool holdsHighWord(Value *V, Instruction *I) const;
+    void legalizeCall(CallSite CS);
+    ValuePair getHalves(Value *V);
+    GlobalVariable *getHighWord();
+    Value *getScratch(Function *F);
+    Function *getDivMod(bool Signed);
+  };
+
+  char JsLegalizeI64::ID = 0;
+
+  /// JsScalarizeAggregates - This pass takes struct and array SSA values
+  /// apart, so that the writer can keep their elements in plain locals
+  /// instead of building a JS array per insertvalue.  Extractvalues are folded
+  /// into the values inserted, aggregate PHIs that are only taken apart are
+  /// split into one PHI per element, and the elements of an aggregate returned
+  /// by a call are read right after it, since the callee hands them back in a
+  /// return slot that its next call overwrites.
+  ///
+  class JsScalarizeAggregates : public FunctionPass {
+  public:
+    static char ID;
+    JsScalarizeAggregates() : FunctionPass(&ID) {}
+
+    virtual const char *getPassName() const {
+      return "Javascript backend aggregate scalarization";
+    }
+
+    virtual bool runOnFunction(Function &F);
+
+  private:
+    static bool isAggregateType(const Type *Ty) {
+      return Ty->isStructTy() || Ty->isArrayTy();
+    }
+    static unsigned getNumScalarElements(const Type *Ty);
+    bool splitPHI(PHINode *PN);
+    bool foldExtracts(Function &F);
+    bool eraseDeadAggregates(Function &F);
+    void readCallResult(Instruction *Call);
+    Value *rebuildAggregate(Value *Agg, const Type *Ty,
+                            SmallVectorImpl<unsigned> &Path,
+                            Value *Result, Instruction *InsertBefore,
+                            const InsertValueInst *Skip = 0);
+  };
+
+  char JsScalarizeAggregates::ID = 0;
+
+  /// JsAnnotateProfile - This pass records the execution counts of
+  /// ProfileInfo as metadata on the terminators.  The profile is only valid for
+  /// the CFG it was collected on, so this runs before any pass changes it, and
+  /// the writer reads the counts of the blocks that survive.  Each terminator
+  /// gets the count of its block followed by the count of each of its edges.
+  ///
+  class JsAnnotateProfile : public ModulePass {
+  public:
+    static char ID;
+    JsAnnotateProfile() : ModulePass(&ID) {}
+
+    virtual const char *getPassName() const {
+      return "Javascript backend profile annotation";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<ProfileInfo>();
+      AU.setPreservesAll();
+    }
+
+    virtual bool runOnModule(Module &M);
+  };
+
+  char JsAnnotateProfile::ID = 0;
+
+  /// JsSplitChunks - This pass picks the functions that -js-split-chunks
+  /// leaves out of the eager code.  Startup keeps the functions that the
+  /// profile of -js-profile-layout saw run or, without a profile, those that
+  /// the call graph reaches from main and the static constructors.  The
+  /// others are grouped along the call graph into chunks of about ChunkSize
+  /// instructions, so that a chunk holds what its first function calls.  The
+  /// functions of chunk n are operand n-1 of the ChunksMDName metadata.
+  ///
+  class JsSplitChunks : public ModulePass {
+  public:
+    static char ID;
+    JsSplitChunks() : ModulePass(&ID) {}
+
+    virtual const char *getPassName() const {
+      return "Javascript backend code splitting";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<CallGraph>();
+    }
+
+    virtual bool runOnModule(Module &M);
+  };
+
+  char JsSplitChunks::ID = 0;
+
+  /// JsPruneExports - This pass internalizes every global and function that
+  /// the -js-exports list does not name, and removes those that the exports,
+  /// main and the static constructors and destructors do not reach, along
+  /// with the constants only they used.  Each removal is listed in the
+  /// -js-exports-report file with the bytes of static data of a global or
+  /// the instructions of a function, as the JS is not printed yet.
+  ///
+  class JsPruneExports : public ModulePass {
+  public:
+    static char ID;
+    explicit JsPruneExports(const TargetData &Layout)
+      : ModulePass(&ID), TD(Layout) {}
+
+    virtual const char *getPassName() const {
+      return "Javascript backend export pruning";
+    }
+
+    virtual bool runOnModule(Module &M);
+
+  private:
+    const TargetData &TD;
+    SmallPtrSet<GlobalValue*, 64> Live;
+    SmallPtrSet<Constant*, 64> VisitedConstants;
+    SmallVector<GlobalValue*, 64> Worklist;
+
+    void markLive(GlobalValue *GV) {
+      if (Live.insert(GV))
+        Worklist.push_back(GV);
+    }
+    void markOperand(Value *V);
+  };
+
+  char JsPruneExports::ID = 0;
+
+  /// RPOOrder - Orders basic blocks by their reverse post-order number.
+  struct RPOOrder {
+    const DenseMap<BasicBlock*, unsigned> &Number;
+    explicit RPOOrder(const DenseMap<BasicBlock*, unsigned> &N) : Number(N) {}
+    bool operator()(BasicBlock *A, BasicBlock *B) const {
+      return Number.lookup(A) < Number.lookup(B);
+    }
+  };
+
+  /// SwitchCluster - A range of case values that go to the same successor.
+  struct SwitchCluster {
+    int64_t Low, High;
+    unsigned Succ;
+  };
+
   /// JsWriter - This class is the main chunk of code that converts an LLVM
   /// module to a javascript translation unit.
   class JsWriter : public FunctionPass, public InstVisitor<JsWriter> {
+    /// With -js-source-map, Out prints through Positions so that the line and
+    /// column of every statement are known.
+    JsPositionStream Positions;
+    formatted_raw_ostream PositionedOut;
     formatted_raw_ostream &Out;
     IntrinsicLowering *IL;
     Mangler *Mang;
-    LoopInfo *LI;
+    LoopInfoBase<BasicBlock, Loop> *LI;
+    DominatorTreeBase<BasicBlock> *DT;
     const Module *TheModule;
     const MCAsmInfo* TAsm;
     MCContext *TCtx;
     const TargetData* TD;
+    const TargetData &TargetLayout;
     std::map<const Type *, std::string> TypeNames;
     std::map<const ConstantFP *, unsigned> FPConstantMap;
     std::set<Function*> intrinsicPrototypesAlreadyGenerated;
@@ -108,19 +532,192 @@ namespace {
     DenseMap<const Value*, unsigned> AnonValueNumbers;
     unsigned NextAnonValueNumber;
 
+    /// Structured control flow state for the function being printed.  Blocks
+    /// are emitted as nested JS statements (Ramsey, "Beyond Relooper"), using
+    /// labeled blocks for forward jumps to merge points and labeled loops for
+    /// back edges.  Irreducible functions fall back to the label dispatcher.
+    enum ControlKind { BlockFollowedBy, LoopHeadedBy, IfThenElse, SwitchCase };
+    struct ControlContext {
+      ControlKind Kind;
+      BasicBlock *BB;
+      ControlContext(ControlKind K, BasicBlock *B) : Kind(K), BB(B) {}
+    };
+    bool UseDispatcher;
+    DenseMap<BasicBlock*, unsigned> RPONumber;
+    SmallPtrSet<BasicBlock*, 16> MergeBlocks;
+    std::vector<ControlContext> Context;
+    unsigned Indent;
+
+    /// Exception state.  An invoke is a try/catch around the call that notes
+    /// in '$threw' whether the call threw and keeps what it threw in '$exn',
+    /// followed by a branch on '$threw' to the landing pad or the normal
+    /// destination.  Only functions with an invoke declare them.  In the heap
+    /// the catch also frees the frames of the callees the exception unwound,
+    /// by resetting '$STACKTOP' to the top of this frame, or to what '$top'
+    /// saved before the call when dynamic allocas move the top.
+    bool HasInvoke;
+
+    /// Typed array heap state.  Every defined global has a fixed address, and
+    /// fixed size allocas in the entry block live at a fixed offset from the
+    /// stack pointer '$sp' of the current function, as do the copies of its
+    /// byval arguments.  The variadic arguments of calls are passed in 8 byte
+    /// slots at VarArgsOffset in the frame.
+    DenseMap<const GlobalVariable*, uint64_t> GlobalAddresses;
+    DenseMap<const Value*, uint64_t> FrameOffsets;
+    uint64_t FrameSize;
+    bool HasStackFrame;
+    bool HasDynamicAllocas;
+    uint64_t VarArgsOffset;
+
+    /// Function tables.  In the typed array heap a function pointer is an
+    /// index into the table of the functions with its JS signature, and an
+    /// indirect call looks its target up in that table.  Entry 0 of every
+    /// table is the null pointer, and tables are padded to a power of two so
+    /// that the index can be masked.
+    std::map<std::string, std::vector<const Function*> > FunctionTables;
+    DenseMap<const Function*, unsigned> FunctionTableIndices;
+
+    /// Out-of-SSA state for the function being printed.  SSA values whose live
+    /// ranges do not interfere share a JS local, named after the first value
+    /// of the class.  PHIs coalesced with their incoming values need no copy,
+    /// the remaining PHI copies are ordered so that no copy clobbers a local
+    /// that a later copy reads, and only PHIs that take part in a copy cycle
+    /// keep the 'X_' shadow variable.
+    bool CoalesceLocals;
+    DenseMap<const Value*, const Value*> LocalVariable;
+    SmallPtrSet<const PHINode*, 8> ShadowedPHIs;
+    unsigned LocalsBefore, LocalsAfter;
+
+    /// Expression folding state.  Above -O0, a load is folded into the
+    /// statement that uses it when nothing printed in between may write the
+    /// memory it reads, and casts that print as their operand are printed
+    /// again at every use instead of being copied to a local.
+    SmallPtrSet<const LoadInst*, 16> FoldedLoads;
+
+    /// Switch lowering state.  Above -O0, a switch with enough case values
+    /// computes the number of its successor, from a table when the values are
+    /// dense and with a balanced tree of range checks otherwise.  The
+    /// successors are then printed once each in a JS switch on that number.
+    /// Tables are typed arrays printed ahead of the function.
+    enum SwitchLowering { PlainSwitch, TableSwitch, TreeSwitch };
+    CodeGenOpt::Level OptLevel;
+    DenseMap<const SwitchInst*, std::string> SwitchTables;
+
+    /// Constant pool state.  Aggregates in the heap are never updated in
+    /// place, so the uses of an aggregate constant share one array, built
+    /// once at module level and named '$C' followed by its number, instead
+    /// of a new array literal every time the use is executed.
+    DenseMap<const Constant*, unsigned> PooledConstants;
+
+    /// Code splitting state.  With -js-split-chunks the functions JsSplitChunks
+    /// put in a chunk are deferred and printed to the file of their chunk.
+    /// The main output keeps a stub for each of them that loads the chunk and
+    /// calls on.  In the heap the functions of the chunk then take the place
+    /// of their stubs.  Otherwise a function pointer is the function itself,
+    /// so the stub stays the function and calls the body the chunk put in its
+    /// '$body'.
+    DenseMap<const Function*, unsigned> FunctionChunks;
+    unsigned NumChunks;
+
+    /// Parallel printing state.  With -js-threads the IR is prepared serially
+    /// in runOnFunction, and the function bodies are printed on worker threads
+    /// into per-function buffers at the end of the module.  Each worker has its
+    /// own JsWriter with a copy of the module level state, which is frozen by
+    /// then.
+    std::vector<std::pair<Function*, std::string> > DeferredFunctions;
+    volatile sys::cas_flag NextDeferredFunction;
+
+    /// Emission cache state.  With -js-cache-dir every function is deferred,
+    /// and the text printFunction prints for it is looked up under a key that
+    /// covers everything the text depends on.  A hit completes the text of the
+    /// function, a miss is printed and stored under its key at the end.
+    struct CachedFunction {
+      std::string Key;
+      size_t BodyStart;
+      bool Hit;
+    };
+    std::vector<CachedFunction> DeferredCache;
+
+    /// Minified names.  Locals and labels of the function being printed get
+    /// the shortest names first, in order of their number of references.
+    /// Names of globals and of the builtins the output uses are never handed
+    /// out, so a local can not shadow them.
+    DenseMap<const Value*, std::string> MinifiedNames;
+    std::set<std::string> GlobalNames;
+
+    /// Source map state.  Each statement printed for an instruction records
+    /// where it starts in the output.  The original positions are looked up
+    /// once the whole module has been printed.  Deferred functions collect
+    /// their mappings relative to the start of their text.
+    struct SourceMapping {
+      unsigned Line, Column;
+      const Instruction *I;
+    };
+    std::vector<SourceMapping> SourceMappings;
+    std::vector<std::vector<SourceMapping> > DeferredSourceMappings;
+
+    /// Profile state.  With -js-profile-layout the counts JsAnnotateProfile
+    /// recorded under ProfileKind put the hot blocks, branch arms and switch
+    /// cases first.  The counter arrays of edge profiled code are registered
+    /// with a runtime that dumps them in the llvmprof.out format.  Without the
+    /// heap they are typed arrays indexed by counter.
+    unsigned ProfileKind;
+    SmallPtrSet<const GlobalVariable*, 2> ProfileCounters;
+
   public:
     static char ID;
-    explicit JsWriter(formatted_raw_ostream &o)
-      : FunctionPass(&ID), Out(o), IL(0), Mang(0), LI(0), 
-        TheModule(0), TAsm(0), TCtx(0), TD(0), OpaqueCounter(0),
-        NextAnonValueNumber(0) {
+    JsWriter(formatted_raw_ostream &o, CodeGenOpt::Level OL,
+             const TargetData &Layout)
+      : FunctionPass(&ID), Positions(o), PositionedOut(Positions),
+        Out(SourceMapFile.empty() ? o : PositionedOut), IL(0), Mang(0),
+        LI(0), DT(0),
+        TheModule(0), TAsm(0), TCtx(0), TD(0), TargetLayout(Layout),
+        OpaqueCounter(0),
+        NextAnonValueNumber(0), UseDispatcher(false), Indent(0),
+        HasInvoke(false), FrameSize(0), HasStackFrame(false),
+        HasDynamicAllocas(false), VarArgsOffset(0),
+        CoalesceLocals(OL != CodeGenOpt::None), LocalsBefore(0),
+        LocalsAfter(0), OptLevel(OL), NumChunks(0), NextDeferredFunction(0),
+        ProfileKind(0) {
       FPCounter = 0;
     }
 
+    /// JsWriter - Create a worker that prints the deferred functions of
+    /// Parent to o.
+    JsWriter(formatted_raw_ostream &o, const JsWriter &Parent)
+      : FunctionPass(&ID), Positions(o), PositionedOut(Positions),
+        Out(SourceMapFile.empty() ? o : PositionedOut), IL(0),
+        Mang(Parent.Mang), LI(0), DT(0),
+        TheModule(Parent.TheModule), TAsm(Parent.TAsm), TCtx(Parent.TCtx),
+        TD(Parent.TD), TargetLayout(Parent.TargetLayout),
+        TypeNames(Parent.TypeNames),
+        FPConstantMap(Parent.FPConstantMap), FPCounter(Parent.FPCounter),
+        OpaqueCounter(Parent.OpaqueCounter),
+        AnonValueNumbers(Parent.AnonValueNumbers),
+        NextAnonValueNumber(Parent.NextAnonValueNumber),
+        UseDispatcher(false), Indent(0), HasInvoke(false),
+        GlobalAddresses(Parent.GlobalAddresses), FrameSize(0),
+        HasStackFrame(false), HasDynamicAllocas(false), VarArgsOffset(0),
+        FunctionTables(Parent.FunctionTables),
+        FunctionTableIndices(Parent.FunctionTableIndices),
+        CoalesceLocals(Parent.CoalesceLocals),
+        LocalsBefore(0), LocalsAfter(0), OptLevel(Parent.OptLevel),
+        PooledConstants(Parent.PooledConstants),
+        FunctionChunks(Parent.FunctionChunks), NumChunks(Parent.NumChunks),
+        NextDeferredFunction(0), GlobalNames(Parent.GlobalNames),
+        ProfileKind(Parent.ProfileKind),
+        ProfileCounters(Parent.ProfileCounters) {
+    }
+
     virtual const char *getPassName() const { return "javascript backend"; }
 
     void getAnalysisUsage(AnalysisUsage &AU) const {
-      AU.addRequired<LoopInfo>();
+      // Deferred functions compute their own loop and dominator info on the
+      // worker threads.
+      if (!deferFunctionBodies()) {
+        AU.addRequired<LoopInfo>();
+        AU.addRequired<DominatorTree>();
+      }
       AU.setPreservesAll();
     }
 
@@ -132,24 +729,54 @@ namespace {
      if (F.hasAvailableExternallyLinkage())
        return false;
 
-      LI = &getAnalysis<LoopInfo>();
-
       // Get rid of intrinsics we can't handle.
       lowerIntrinsics(F);
 
+      numberAnonymousValues(F);
+
+      if (deferFunctionBodies()) {
+        computeStructLayouts(F);
+        DeferredFunctions.push_back(std::make_pair(&F, std::string()));
+        raw_string_ostream FOut(DeferredFunctions.back().second);
+        printFloatingPointConstants(FOut, F);
+        if (useCache()) {
+          FOut.flush();
+          lookUpCachedFunction(F);
+        }
+        return false;
+      }
+
+      LI = &getAnalysis<LoopInfo>().getBase();
+      DT = &getAnalysis<DominatorTree>().getBase();
+
       // Output all floating point constants that cannot be printed accurately.
-      printFloatingPointConstants(F);
+      printFloatingPointConstants(Out, F);
 
       printFunction(F);
       return false;
     }
 
     virtual bool doFinalization(Module &M) {
+      if (!DeferredFunctions.empty())
+        printDeferredFunctions();
+      if (LocalsBefore) {
+        NumLocalsBefore += LocalsBefore;
+        NumLocalsAfter += LocalsAfter;
+      }
+
+      if (!FunctionTables.empty())
+        printFunctionTables();
+
       Function *Main = M.getFunction("main");
       if(Main) {
 	Out << "_.main();\n";
       }
       Out << "})(window);\n";
+      if (!SourceMapFile.empty()) {
+        Out << "//# sourceMappingURL=" << sys::Path(SourceMapFile).getLast()
+            << "\n";
+        printSourceMap(M);
+      }
       if(Main) {
 	Out << "</script>\n";
 	Out << "</body>\n";
@@ -164,6 +791,9 @@ namespace {
       FPConstantMap.clear();
       TypeNames.clear();
       ByValParams.clear();
+      GlobalAddresses.clear();
+      FunctionTables.clear();
+      FunctionTableIndices.clear();
       intrinsicPrototypesAlreadyGenerated.clear();
       return false;
     }
@@ -201,9 +831,21 @@ namespace {
     void writeOperandWithCast(Value* Operand, unsigned Opcode);
     void writeOperandWithCast(Value* Operand, const ICmpInst &I);
     bool writeInstructionCast(const Instruction &I);
+    void writeSignExtended(Value *Operand);
+    void printCoercedValue(Value *V, const Type *Ty);
+    bool printCoercedBinaryOperator(Instruction &I);
+    void printCheckedDivision(Instruction &I);
+    bool printCoercedCast(CastInst &I);
 
     void writeMemoryAccess(Value *Operand, const Type *OperandType,
                            bool IsVolatile, unsigned Alignment);
+    void printHeapElement(Value *Ptr, const Type *Ty, unsigned Offset);
+    void printHeapLoad(Value *Ptr, const Type *Ty, unsigned Offset,
+                       unsigned Alignment);
+    void printHeapStore(Value *Ptr, Value *Val, unsigned Alignment);
+    bool isAlignedHeapAccess(const Type *Ty, unsigned Alignment) const;
+    bool isSplitHeapStore(const StoreInst &SI) const;
+    void printHeapMemOp(CallInst &I, Intrinsic::ID ID);
 
   private :
     std::string InterpretASMConstraint(InlineAsm::ConstraintInfo& c);
@@ -212,20 +854,113 @@ namespace {
 
     void printModule(Module *M);
     void printModuleTypes(const TypeSymbolTable &ST);
+    void printHeapGlobals(Module &M);
+    void assignFunctionTableIndices(Module &M);
+    void printFunctionTables();
+    void printFunctionTableCall(Value *Callee, const FunctionType *FTy);
+    bool tableHasExternalVarArgs(const FunctionType *FTy) const;
+    void printVarArgForwarders(Module &M);
+    void printI64Runtime(Module &M);
+    bool needsRuntime(Module &M);
+    void printRuntime();
+    void printConstantPool(Module &M);
+    void printChunkLoader();
+    void printChunkStub(const Function *F);
+    void printDataSegment(const std::vector<unsigned char> &Data,
+                          uint64_t Addr);
+    bool evaluateAddress(Constant *C, uint64_t &Addr);
+    void getConstantBytes(Constant *C, uint64_t Offset,
+                          std::vector<unsigned char> &Bytes,
+                          std::vector<std::pair<uint64_t, Constant*> > &Fixups);
+    void computeStackFrame(Function &F);
     std::string getOperand(Value *Operand, bool Static = false);
     void printContainedStructs(const Type *Ty, std::set<const Type *> &);
-    void printFloatingPointConstants(Function &F);
-    void printFloatingPointConstants(const Constant *C);
+    void printFloatingPointConstants(raw_ostream &Out, Function &F);
+    void printFloatingPointConstants(raw_ostream &Out, const Constant *C);
+    void numberAnonymousValues(Function &F);
+    void computeStructLayouts(Function &F);
+    void computeStructLayouts(const Type *Ty,
+                              SmallPtrSet<const Type*, 16> &Visited);
+    void printDeferredFunctions();
+
+    /// useCache - Return true if function bodies go through the emission
+    /// cache.  Source map positions can not be recovered from cached text.
+    static bool useCache() {
+      return !CacheDir.empty() && SourceMapFile.empty();
+    }
+
+    /// deferFunctionBodies - Return true if function bodies are printed at the
+    /// end of the module rather than as the functions are visited.
+    static bool deferFunctionBodies() {
+      return EmitThreads > 1 || useCache() || splitChunks();
+    }
+
+    std::string getCacheKey(Function &F);
+    std::string getCacheFileName(const std::string &Key);
+    void lookUpCachedFunction(Function &F);
+    void storeCachedFunctions();
+    void printSourceMap(Module &M);
+    void assignMinifiedNames(Function &F);
+    std::string getMinifiedName(unsigned &Next);
+
+    /// indent - Start a new line of code at the current indentation level.
+    raw_ostream &indent() {
+      if (Minify)
+        return Out;
+      return Out.indent(Indent);
+    }
+
+    /// printSectionHeader - Print the comment that starts a section of module
+    /// level code.
+    void printSectionHeader(const char *Name) {
+      if (!Minify)
+        Out << "\n/* " << Name << " */\n";
+    }
+
+    /// addSourceMapping - Map the current output position to I.  A statement
+    /// that printed nothing gives its position to the next one.
+    void addSourceMapping(const Instruction &I) {
+      if (SourceMapFile.empty())
+        return;
+      unsigned Line = Positions.getLine(), Column = Positions.getColumn();
+      if (!SourceMappings.empty() && SourceMappings.back().Line == Line &&
+          SourceMappings.back().Column == Column) {
+        SourceMappings.back().I = &I;
+        return;
+      }
+      SourceMapping M = { Line, Column, &I };
+      SourceMappings.push_back(M);
+    }
+    void printDeferredFunctionQueue(JsWriter &Parent, std::string &Buffer);
+    static void *runDeferredFunctionQueue(void *Worker);
     void printFunctionSignature(const Function *F, bool Prototype);
+    void printFunctionEnd(const Function *F);
+    void printGlobalExport(const GlobalVariable *GV);
+    void printGlobalInitializer(GlobalVariable *GV);
+    void printProfilingRuntime(Module &M);
+
+    /// getProfileCount - Return the execution count of BB, or of its edge to
+    /// successor SuccNo, that the profile recorded, or -1 if it has none.
+    int64_t getProfileCount(const BasicBlock *BB, int SuccNo = -1) const {
+      const TerminatorInst *TI = BB->getTerminator();
+      MDNode *Counts = ProfileKind ? TI->getMetadata(ProfileKind) : 0;
+      if (!Counts || Counts->getNumOperands() != TI->getNumSuccessors() + 1)
+        return -1;
+      return cast<ConstantInt>(Counts->getOperand(SuccNo + 1))->getSExtValue();
+    }
 
     void printFunction(Function &);
     void printBasicBlock(BasicBlock *BB);
     void printLoop(Loop *L);
 
-    void printCast(unsigned opcode, const Type *SrcTy, const Type *DstTy);
+    bool prepareStructuredControlFlow(Function &F);
+    void printStructuredTree(BasicBlock *BB);
+    void printStructuredNode(BasicBlock *BB,
+                             SmallVectorImpl<BasicBlock*> &MergeChildren);
+
     void printConstant(Constant *CPV, bool Static, raw_ostream &Out);
     void printConstant(Constant *CPV, bool Static);
-    void printConstantWithCast(Constant *CPV, unsigned Opcode);
+    void printConstantWithCast(Constant *CPV, bool Unsigned, bool Static);
     void printConstantArray(ConstantArray *CPA, bool Static);
     void printConstantVector(ConstantVector *CV, bool Static);
 
@@ -233,6 +968,9 @@ namespace {
     /// have its address taken in order to get a C value of the correct type.
     /// This happens for global variables, byval parameters, and direct allocas.
     bool isAddressExposed(const Value *V) const {
+      // In the typed array heap every pointer is a plain integer value.
+      if (HeapMemory)
+        return false;
       if (const Argument *A = dyn_cast<Argument>(V))
         return ByValParams.count(A);
       return isa<GlobalVariable>(V) || isDirectAlloca(V);
@@ -243,26 +981,52 @@ namespace {
     // what is acceptable to inline, so that variable declarations don't get
     // printed and an extra copy of the expr is not emitted.
     //
-    static bool isInlinableInst(const Instruction &I) {
+    bool isInlinableInst(const Instruction &I) const {
       // Always inline cmp instructions, even if they are shared by multiple
       // expressions.  GCC generates horrible code if we don't.
       if (isa<CmpInst>(I)) 
         return true;
 
+      if (isRematerializedCast(I))
+        return true;
+
+      // In the heap a direct alloca is an offset from '$sp', which is
+      // computed into its local like any other value.
+      if (HeapMemory && isDirectAlloca(&I))
+        return false;
+
+      // Scalarized aggregates are never built, their users read the elements.
+      if (const InsertValueInst *IVI = dyn_cast<InsertValueInst>(&I))
+        return isScalarizedAggregate(*IVI);
+
+      // An aggregate returned by a call may sit in the return slot of the
+      // callee, which its next call overwrites.
+      if (const ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(&I))
+        if (isa<CallInst>(EVI->getAggregateOperand()) ||
+            isa<InvokeInst>(EVI->getAggregateOperand()))
+          return false;
+
       // Must be an expression, must be used exactly once.  If it is dead, we
       // emit it inline where it would go.
       if (I.getType() == Type::getVoidTy(I.getContext()) || !I.hasOneUse() ||
           isa<TerminatorInst>(I) || isa<CallInst>(I) || isa<PHINode>(I) ||
-          isa<LoadInst>(I) || isa<VAArgInst>(I) || isa<InsertElementInst>(I) ||
-          isa<InsertValueInst>(I))
+          (isa<LoadInst>(I) && !FoldedLoads.count(cast<LoadInst>(&I))) ||
+          isa<VAArgInst>(I) || isa<InsertElementInst>(I))
         // Don't inline a load across a store or other bad things!
         return false;
 
       // Must not be used in inline asm, extractelement, or shufflevector.
+      // Elements of an aggregate are read wherever its users are printed, so
+      // they must not be inlined into it either.  Nor must the pointers of a
+      // memory intrinsic in the heap, which printHeapMemOp prints twice.
       if (I.hasOneUse()) {
         const Instruction &User = cast<Instruction>(*I.use_back());
         if (isInlineAsm(User) || isa<ExtractElementInst>(User) ||
-            isa<ShuffleVectorInst>(User))
+            isa<ShuffleVectorInst>(User) || isa<InsertValueInst>(User))
+          return false;
+        if (HeapMemory && isa<MemIntrinsic>(User) &&
+            (User.getOperand(1) == &I ||
+             (!isa<MemSetInst>(User) && User.getOperand(2) == &I)))
           return false;
       }
 
@@ -270,6 +1034,56 @@ namespace {
       return I.getParent() == cast<Instruction>(I.use_back())->getParent();
     }
 
+    /// isRematerializedCast - Return true if I is a cast that prints as its
+    /// operand, which is itself cheap to print, so that printing it at each
+    /// use costs nothing and saves a local.
+    bool isRematerializedCast(const Instruction &I) const {
+      if (OptLevel == CodeGenOpt::None)
+        return false;
+      if (isa<BitCastInst>(I)) {
+        if (!I.getType()->isPointerTy())
+          return false;
+      } else if (isa<PtrToIntInst>(I) || isa<IntToPtrInst>(I)) {
+        if (!HeapMemory || (!I.getType()->isIntegerTy(32) &&
+            !I.getOperand(0)->getType()->isIntegerTy(32)))
+          return false;
+      } else {
+        return false;
+      }
+      for (Value::const_use_iterator UI = I.use_begin(), UE = I.use_end();
+           UI != UE; ++UI) {
+        const Instruction &User = *cast<Instruction>(*UI);
+        if (isInlineAsm(User) || isa<ExtractElementInst>(User) ||
+            isa<ShuffleVectorInst>(User) || isa<InsertValueInst>(User))
+          return false;
+      }
+      return isCheapToReprint(I.getOperand(0));
+    }
+
+    /// isScalarizedAggregate - Return true if the aggregate built by I is only
+    /// taken apart, extended or returned.  Such an insertvalue chain is never
+    /// materialized as a JS array; the elements are read where it is used.
+    static bool isScalarizedAggregate(const InsertValueInst &I) {
+      for (Value::const_use_iterator UI = I.use_begin(), UE = I.use_end();
+           UI != UE; ++UI)
+        if (!isa<ExtractValueInst>(*UI) && !isa<InsertValueInst>(*UI) &&
+            !isa<ReturnInst>(*UI))
+          return false;
+      return true;
+    }
+
+    /// isCheapToReprint - Return true if printing V again costs no more than
+    /// reading a local, which holds for values that are not inlined and for
+    /// pointer casts of them.
+    bool isCheapToReprint(const Value *V) const {
+      const Instruction *I = dyn_cast<Instruction>(V);
+      if (!I || !isInlinableInst(*I) || isDirectAlloca(I))
+        return true;
+      if (isa<BitCastInst>(I) || isa<PtrToIntInst>(I) || isa<IntToPtrInst>(I))
+        return isCheapToReprint(I->getOperand(0));
+      return false;
+    }
+
     // isDirectAlloca - Define fixed sized allocas in the entry block as direct
     // variables which are accessed with the & operator.  This causes GCC to
     // generate significantly better code than to emit alloca calls directly.
@@ -291,19 +1105,45 @@ namespace {
       return false;
     }
 
-    // Converts an APFloat to a string via a double
-    static inline std::string apfToStr(const APFloat& V) {
-      double Double;
-      if (&V.getSemantics() == &APFloat::IEEEdouble) {
-	Double = V.convertToDouble();
+    /// apfToStr - Print V as the shortest decimal number that reads back as
+    /// exactly the same double.  With Single, the number only has to round to
+    /// the same float, for printing inside Math.fround.
+    static std::string apfToStr(const APFloat &V, bool Single = false) {
+      APFloat Tmp = V;
+      bool LosesInfo;
+      Tmp.convert(APFloat::IEEEdouble, APFloat::rmNearestTiesToEven,
+                  &LosesInfo);
+      double Double = Tmp.convertToDouble();
+      char Buffer[32];
+      if (Double == floor(Double) && fabs(Double) < 9007199254740992.0) {
+        snprintf(Buffer, sizeof(Buffer), "%.0f", Double);
+        return Buffer;
       }
-      else if (&V.getSemantics() == &APFloat::IEEEsingle) {
-	Double = (double) V.convertToFloat();
+      for (int Precision = 1; Precision <= 17; ++Precision) {
+        snprintf(Buffer, sizeof(Buffer), "%.*g", Precision, Double);
+        double Read = strtod(Buffer, 0);
+        if (Single ? (float)Read == (float)Double : Read == Double)
+          break;
       }
-      char Buffer[200];
-      snprintf(Buffer, 200, "%g", Double);
       return Buffer;
     }
+
+    /// isFroundedInst - Return true if I computes a float that has to be
+    /// rounded to single precision: float arithmetic, conversions to float and
+    /// calls that may return a double.
+    static bool isFroundedInst(const Instruction &I) {
+      if (!Float32 || !I.getType()->isFloatTy())
+        return false;
+      if (isa<FPTruncInst>(I))
+        return !isa<FPExtInst>(I.getOperand(0));
+      if (isa<BinaryOperator>(I) || isa<SIToFPInst>(I) || isa<UIToFPInst>(I))
+        return true;
+      if (const CallInst *CI = dyn_cast<CallInst>(&I)) {
+        const Function *F = CI->getCalledFunction();
+        return !F || F->isDeclaration();
+      }
+      return false;
+    }
     
     // Instruction visitation functions
     friend class InstVisitor<JsWriter>;
@@ -311,10 +1151,17 @@ namespace {
     void visitReturnInst(ReturnInst &I);
     void visitBranchInst(BranchInst &I);
     void visitSwitchInst(SwitchInst &I);
+    void getSwitchSuccessors(SwitchInst &SI,
+                             std::vector<BasicBlock*> &Succs) const;
+    SwitchLowering classifySwitch(SwitchInst &SI,
+                                  const std::vector<BasicBlock*> &Succs,
+                                  std::vector<SwitchCluster> &Clusters);
+    void printSwitchTables(Function &F);
+    void printSwitchTree(Value *Cond, const std::vector<SwitchCluster> &Clusters,
+                         unsigned Begin, unsigned End, int64_t Low,
+                         int64_t High);
     void visitIndirectBrInst(IndirectBrInst &I);
-    void visitInvokeInst(InvokeInst &I) {
-      llvm_unreachable("Lowerinvoke pass didn't work!");
-    }
+    void visitInvokeInst(InvokeInst &I);
 
     void visitUnwindInst(UnwindInst &I);
     void visitUnreachableInst(UnreachableInst &I);
@@ -327,6 +1174,9 @@ namespace {
     void visitCastInst (CastInst &I);
     void visitSelectInst(SelectInst &I);
     void visitCallInst (CallInst &I);
+    void printCall(CallSite CS, bool WroteCallee);
+    void printVarArgs(CallSite::arg_iterator AI, CallSite::arg_iterator AE,
+                      bool Spread);
     void visitInlineAsm(CallInst &I);
     bool visitBuiltinCall(CallInst &I, Intrinsic::ID ID, bool &WroteCallee);
 
@@ -342,6 +1192,24 @@ namespace {
 
     void visitInsertValueInst(InsertValueInst &I);
     void visitExtractValueInst(ExtractValueInst &I);
+    static Value *findAggregateElement(Value *Agg, const unsigned *Idx,
+                                       unsigned NumIdx, unsigned &Rest,
+                                       const InsertValueInst *Top);
+    void printAggregateElement(Value *Agg, SmallVectorImpl<unsigned> &Path,
+                               const InsertValueInst *Top);
+    void printAggregateElements(Value *Agg, SmallVectorImpl<unsigned> &Path,
+                                const InsertValueInst *Top);
+    bool hasReturnSlot(const Function &F) const {
+      return OptLevel != CodeGenOpt::None &&
+             (F.getReturnType()->isStructTy() || F.getReturnType()->isArrayTy());
+    }
+    std::string getReturnSlotName(const Function *F) {
+      return "$ret_" + GetValueName(F);
+    }
+    void printReturnSlot(Function &F);
+    void printReturnSlotStores(Value *RV, const Type *Ty,
+                               SmallVectorImpl<unsigned> &Path,
+                               const std::string &Slot);
 
     void visitInstruction(Instruction &I) {
 #ifndef NDEBUG
@@ -355,19 +1223,76 @@ namespace {
     }
 
     bool isGotoCodeNecessary(BasicBlock *From, BasicBlock *To);
+    const Value *getLocalVariable(const Value *V) const {
+      DenseMap<const Value*, const Value*>::const_iterator I =
+        LocalVariable.find(V);
+      return I == LocalVariable.end() ? V : I->second;
+    }
+    void findFoldedLoads(Function &F);
+    bool mayClobberLoad(const Instruction &I, const LoadInst &Load) const;
+    void coalesceLocals(Function &F);
+    void collectReadVariables(const Value *V,
+                              SmallPtrSet<const Value*, 8> &Vars);
+    const PHINode *orderPHICopies(BasicBlock *CurBlock, BasicBlock *Successor,
+                                  SmallVectorImpl<PHINode*> &Order);
+    bool hasPHICopiesForSuccessor(BasicBlock *CurBlock, BasicBlock *Successor);
     void printPHICopiesForSuccessor(BasicBlock *CurBlock,
-                                    BasicBlock *Successor, unsigned Indent);
-    void printBranchToBlock(BasicBlock *CurBlock, BasicBlock *SuccBlock,
-                            unsigned Indent);
+                                    BasicBlock *Successor);
+    void printBranchToBlock(BasicBlock *CurBlock, BasicBlock *SuccBlock);
+    void printEdge(BasicBlock *CurBlock, BasicBlock *SuccBlock);
     void printGEPExpression(Value *Ptr, gep_type_iterator I,
                             gep_type_iterator E, bool Static);
 
     std::string GetValueName(const Value *Operand);
   };
+
+  /// JsWriterWorker - A worker thread of the parallel function printer, with
+  /// the buffer its JsWriter prints into.
+  struct JsWriterWorker {
+    JsWriter &Parent;
+    std::string Buffer;
+    raw_string_ostream BufferOut;
+    formatted_raw_ostream Out;
+    JsWriter Writer;
+
+    explicit JsWriterWorker(JsWriter &P)
+      : Parent(P), BufferOut(Buffer), Out(BufferOut), Writer(Out, P) {}
+  };
 }
 
 char JsWriter::ID = 0;
 
+// Constants and types are uniqued in the LLVMContext, which is not thread
+// safe.  Worker threads create them under the global lock, which is a no-op
+// when printing serially.
+static Constant *getUniquedNullValue(const Type *Ty) {
+  llvm_acquire_global_lock();
+  Constant *C = Constant::getNullValue(Ty);
+  llvm_release_global_lock();
+  return C;
+}
+
+static Constant *getUniquedUndef(const Type *Ty) {
+  llvm_acquire_global_lock();
+  Constant *C = UndefValue::get(Ty);
+  llvm_release_global_lock();
+  return C;
+}
+
+static Constant *getUniquedBitMask(const IntegerType *ITy) {
+  llvm_acquire_global_lock();
+  Constant *C = ConstantInt::get(ITy, ITy->getBitMask());
+  llvm_release_global_lock();
+  return C;
+}
+
+static const PointerType *getUniquedPointerTo(const Type *EltTy) {
+  llvm_acquire_global_lock();
+  const PointerType *PTy = PointerType::getUnqual(EltTy);
+  llvm_release_global_lock();
+  return PTy;
+}
+
 
 static std::string CBEMangle(const std::string &S) {
   std::string Result;
@@ -469,72 +1394,1297 @@ bool JsBackendNameAllUsedStructsAndMergeFunctions::runOnModule(Module &M) {
   return Changed;
 }
 
-/// printStructReturnPointerFunctionType - This is like printType for a struct
-/// return type, except, instead of printing the type as void (*)(Struct*, ...)
-/// print it as "Struct (*)(...)", for struct return functions.
-void JsWriter::printStructReturnPointerFunctionType(raw_ostream &Out,
-                                                   const AttrListPtr &PAL,
-                                                   const PointerType *TheTy) {
-  const FunctionType *FTy = cast<FunctionType>(TheTy->getElementType());
-  std::string tstr;
-  raw_string_ostream FunctionInnards(tstr);
-  FunctionInnards << " (*) (";
-  bool PrintedType = false;
+/// createWordOp - Build a binary operator on words, folding away the
+/// identities that splitting constants into words commonly produces.
+static Value *createWordOp(IRBuilder<> &B, Instruction::BinaryOps Op,
+                           Value *L, Value *R, const Twine &Name = "") {
+  ConstantInt *LC = dyn_cast<ConstantInt>(L), *RC = dyn_cast<ConstantInt>(R);
+  if (LC && !RC && Op != Instruction::Sub)
+    return createWordOp(B, Op, R, L, Name);
+  if (RC && RC->isZero()) {
+    if (Op == Instruction::Mul || Op == Instruction::And)
+      return RC;
+    return L;
+  }
+  if (RC && RC->isOne() && Op == Instruction::Mul)
+    return L;
+  if (RC && RC->isAllOnesValue() && Op == Instruction::And)
+    return L;
+  return B.CreateBinOp(Op, L, R, Name);
+}
 
-  FunctionType::param_iterator I = FTy->param_begin(), E = FTy->param_end();
-  const Type *RetTy = cast<PointerType>(I->get())->getElementType();
-  unsigned Idx = 1;
-  for (++I, ++Idx; I != E; ++I, ++Idx) {
-    if (PrintedType)
-      FunctionInnards << ", ";
-    const Type *ArgTy = *I;
-    if (PAL.paramHasAttr(Idx, Attribute::ByVal)) {
-      assert(ArgTy->isPointerTy());
-      ArgTy = cast<PointerType>(ArgTy)->getElementType();
+bool JsLegalizeI64::isLegalType(const Type *Ty) {
+  return !Ty->isIntegerTy(64);
+}
+
+bool JsLegalizeI64::isLegalFunctionType(const FunctionType *FTy) {
+  if (!isLegalType(FTy->getReturnType()))
+    return false;
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i)
+    if (!isLegalType(FTy->getParamType(i)))
+      return false;
+  return true;
+}
+
+/// getLegalFunctionType - Return FTy with every i64 parameter replaced by its
+/// low and high words, and an i64 result replaced by its low word.
+const FunctionType *
+JsLegalizeI64::getLegalFunctionType(const FunctionType *FTy) {
+  std::vector<const Type*> Params;
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i) {
+    const Type *Ty = FTy->getParamType(i);
+    Params.push_back(isLegalType(Ty) ? Ty : Int32Ty);
+    if (!isLegalType(Ty))
+      Params.push_back(Int32Ty);
+  }
+  const Type *RetTy = FTy->getReturnType();
+  return FunctionType::get(isLegalType(RetTy) ? RetTy : Int32Ty, Params,
+                           FTy->isVarArg());
+}
+
+/// getLegalAttributes - Move the attributes PAL of a function or call whose
+/// arguments have the types Tys onto the indices the arguments take once the
+/// i64 ones are split.  The words of an i64 keep no attributes, and neither
+/// does an i64 result.
+AttrListPtr
+JsLegalizeI64::getLegalAttributes(const AttrListPtr &PAL, const Type *RetTy,
+                                  const std::vector<const Type*> &Tys) {
+  SmallVector<AttributeWithIndex, 8> Attrs;
+  if (Attributes A = PAL.getRetAttributes())
+    if (isLegalType(RetTy))
+      Attrs.push_back(AttributeWithIndex::get(0, A));
+  for (unsigned i = 0, Idx = 1, e = Tys.size(); i != e; ++i, ++Idx) {
+    if (!isLegalType(Tys[i]))
+      ++Idx;
+    else if (Attributes A = PAL.getParamAttributes(i + 1))
+      Attrs.push_back(AttributeWithIndex::get(Idx, A));
+  }
+  if (Attributes A = PAL.getFnAttributes())
+    Attrs.push_back(AttributeWithIndex::get(~0U, A));
+  return AttrListPtr::get(Attrs.begin(), Attrs.end());
+}
+
+GlobalVariable *JsLegalizeI64::getHighWord() {
+  if (!HighWord)
+    HighWord = new GlobalVariable(*TheModule, Int32Ty, false,
+                                  GlobalValue::InternalLinkage,
+                                  ConstantInt::get(Int32Ty, 0), "__js_i64_hi");
+  return HighWord;
+}
+
+/// getScratch - Return an 8 byte stack slot of F used to reinterpret the bits
+/// of doubles.
+Value *JsLegalizeI64::getScratch(Function *F) {
+  if (!Scratch)
+    Scratch = new AllocaInst(Type::getDoubleTy(F->getContext()), 0,
+                             "i64_scratch", F->getEntryBlock().begin());
+  return Scratch;
+}
+
+/// getDivMod - Return the runtime helper computing the quotient or remainder
+/// of two i64 values, passed as four words followed by a remainder flag.
+Function *JsLegalizeI64::getDivMod(bool Signed) {
+  const Type *Params[] = { Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty };
+  FunctionType *FTy = FunctionType::get(Int32Ty,
+                        std::vector<const Type*>(Params, array_endof(Params)),
+                        false);
+  return cast<Function>(TheModule->getOrInsertFunction(
+           Signed ? "__js_i64_sdivmod" : "__js_i64_udivmod", FTy));
+}
+
+/// legalizeSignature - Replace F by a function whose i64 arguments are split
+/// into low and high words, and move the body of F over to it.
+Function *JsLegalizeI64::legalizeSignature(Function *F) {
+  Function *NF = Function::Create(cast<FunctionType>(
+                                    getLegalFunctionType(F->getFunctionType())),
+                                  F->getLinkage(), "", TheModule);
+  NF->takeName(F);
+  NF->setCallingConv(F->getCallingConv());
+  std::vector<const Type*> Tys;
+  for (Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+       AI != AE; ++AI)
+    Tys.push_back(AI->getType());
+  NF->setAttributes(getLegalAttributes(F->getAttributes(), F->getReturnType(),
+                                       Tys));
+  NF->setVisibility(F->getVisibility());
+  if (F->hasSection())
+    NF->setSection(F->getSection());
+  NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+
+  Function::arg_iterator NAI = NF->arg_begin();
+  for (Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+       AI != AE; ++AI, ++NAI) {
+    NAI->setName(AI->getName());
+    if (isLegalType(AI->getType())) {
+      AI->replaceAllUsesWith(NAI);
+      continue;
     }
-    printType(FunctionInnards, ArgTy,
-        /*isSigned=*/PAL.paramHasAttr(Idx, Attribute::SExt), "");
-    PrintedType = true;
+    Argument *Lo = NAI++;
+    Lo->setName(AI->getName() + "_lo");
+    NAI->setName(AI->getName() + "_hi");
+    Halves[AI] = ValuePair(Lo, NAI);
   }
-  if (FTy->isVarArg()) {
-    if (!PrintedType)
-      FunctionInnards << " int"; //dummy argument for empty vararg functs
-    FunctionInnards << ", ...";
-  } else if (!PrintedType) {
-    FunctionInnards << "void";
+
+  F->replaceAllUsesWith(ConstantExpr::getBitCast(NF, F->getType()));
+  return NF;
+}
+
+/// getHalves - Return the low and high words of the i64 value V.
+JsLegalizeI64::ValuePair JsLegalizeI64::getHalves(Value *V) {
+  DenseMap<Value*, ValuePair>::iterator It = Halves.find(V);
+  if (It != Halves.end())
+    return It->second;
+
+  if (ConstantInt *CI = dyn_cast<ConstantInt>(V)) {
+    uint64_t Val = CI->getZExtValue();
+    return ValuePair(ConstantInt::get(Int32Ty, Val & 0xffffffffULL),
+                     ConstantInt::get(Int32Ty, Val >> 32));
   }
-  FunctionInnards << ')';
-  printType(Out, RetTy, 
-      /*isSigned=*/PAL.paramHasAttr(0, Attribute::SExt), FunctionInnards.str());
+  if (isa<UndefValue>(V))
+    return ValuePair(UndefValue::get(Int32Ty), UndefValue::get(Int32Ty));
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(V))
+    if (CE->getOpcode() == Instruction::PtrToInt)
+      return ValuePair(ConstantExpr::getPtrToInt(CE->getOperand(0), Int32Ty),
+                       ConstantInt::get(Int32Ty, 0));
+  if (Instruction *I = dyn_cast<Instruction>(V)) {
+    // Operands are normally legalized before their users, except when the
+    // use is reached first in the block order.
+    legalizeInstruction(I);
+    It = Halves.find(V);
+    if (It != Halves.end())
+      return It->second;
+  }
+  report_fatal_error("The Javascript backend cannot split this i64 value.");
 }
 
-raw_ostream &
-JsWriter::printSimpleType(raw_ostream &Out, const Type *Ty, bool isSigned,
-                         const std::string &NameSoFar) {
-  assert((Ty->isPrimitiveType() || Ty->isIntegerTy() || Ty->isVectorTy()) && 
-         "Invalid type for printSimpleType");
-  switch (Ty->getTypeID()) {
-  case Type::VoidTyID:   return Out << "void " << NameSoFar;
-  case Type::IntegerTyID: {
-    unsigned NumBits = cast<IntegerType>(Ty)->getBitWidth();
-    if (NumBits == 1) 
-      return Out << "bool " << NameSoFar;
-    else if (NumBits <= 8)
-      return Out << (isSigned?"signed":"unsigned") << " char " << NameSoFar;
-    else if (NumBits <= 16)
-      return Out << (isSigned?"signed":"unsigned") << " short " << NameSoFar;
-    else if (NumBits <= 32)
-      return Out << (isSigned?"signed":"unsigned") << " int " << NameSoFar;
-    else if (NumBits <= 64)
-      return Out << (isSigned?"signed":"unsigned") << " long long "<< NameSoFar;
-    else { 
-      assert(NumBits <= 128 && "Bit widths > 128 not implemented yet");
-      return Out << (isSigned?"llvmInt128":"llvmUInt128") << " " << NameSoFar;
+/// expandConstantExprs - Replace the i64 constant expression operands of I,
+/// other than the ptrtoints getHalves splits, by instructions, which are then
+/// split like any other.  The operands of a PHI node are computed at the end
+/// of the block they come from.
+void JsLegalizeI64::expandConstantExprs(Instruction *I) {
+  for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+    ConstantExpr *CE = dyn_cast<ConstantExpr>(I->getOperand(i));
+    if (!CE || isLegalType(CE->getType()) ||
+        CE->getOpcode() == Instruction::PtrToInt)
+      continue;
+    Instruction *InsertPt = I;
+    if (PHINode *PN = dyn_cast<PHINode>(I))
+      InsertPt = PN->getIncomingBlock(i / 2)->getTerminator();
+    Instruction *New;
+    if (CE->isCast())
+      New = CastInst::Create(Instruction::CastOps(CE->getOpcode()),
+                             CE->getOperand(0), CE->getType(), "", InsertPt);
+    else if (Instruction::isBinaryOp(CE->getOpcode()))
+      New = BinaryOperator::Create(Instruction::BinaryOps(CE->getOpcode()),
+                                   CE->getOperand(0), CE->getOperand(1), "",
+                                   InsertPt);
+    else if (CE->getOpcode() == Instruction::Select)
+      New = SelectInst::Create(CE->getOperand(0), CE->getOperand(1),
+                               CE->getOperand(2), "", InsertPt);
+    else
+      report_fatal_error("The Javascript backend does not support this i64 "
+                         "constant expression.");
+    I->setOperand(i, New);
+    Modified = true;
+  }
+}
+
+/// legalizeCall - Pass i64 arguments of a call as two words, and pick up the
+/// high word of an i64 result from the global it was returned through.
+void JsLegalizeI64::legalizeCall(CallSite CS) {
+  Instruction *I = CS.getInstruction();
+  Value *Callee = CS.getCalledValue();
+  const FunctionType *FTy = cast<FunctionType>(
+    cast<PointerType>(Callee->getType())->getElementType());
+
+  std::vector<Value*> Args;
+  std::vector<const Type*> Tys;
+  for (CallSite::arg_iterator AI = CS.arg_begin(), AE = CS.arg_end();
+       AI != AE; ++AI) {
+    Tys.push_back((*AI)->getType());
+    if (isLegalType((*AI)->getType())) {
+      Args.push_back(*AI);
+      continue;
     }
+    ValuePair Arg = getHalves(*AI);
+    Args.push_back(Arg.first);
+    Args.push_back(Arg.second);
   }
-  case Type::FloatTyID:  return Out << "float "   << NameSoFar;
-  case Type::DoubleTyID: return Out << "double "  << NameSoFar;
-  // Lacking emulation of FP80 on PPC, etc., we assume whichever of these is
+
+  if (!isLegalFunctionType(FTy)) {
+    const Type *Ty = PointerType::getUnqual(getLegalFunctionType(FTy));
+    if (Constant *C = dyn_cast<Constant>(Callee))
+      Callee = ConstantExpr::getBitCast(C, Ty);
+    else
+      Callee = new BitCastInst(Callee, Ty, "", I);
+  }
+
+  Instruction *New;
+  if (InvokeInst *II = dyn_cast<InvokeInst>(I)) {
+    if (!isLegalType(I->getType()))
+      report_fatal_error("The Javascript backend does not support invokes "
+                         "returning i64.");
+    New = InvokeInst::Create(Callee, II->getNormalDest(), II->getUnwindDest(),
+                             Args.begin(), Args.end(), "", I);
+    cast<InvokeInst>(New)->setCallingConv(II->getCallingConv());
+  } else {
+    New = CallInst::Create(Callee, Args.begin(), Args.end(), "", I);
+    cast<CallInst>(New)->setCallingConv(CS.getCallingConv());
+    cast<CallInst>(New)->setTailCall(cast<CallInst>(I)->isTailCall());
+  }
+  CallSite(New).setAttributes(getLegalAttributes(CS.getAttributes(),
+                                                 I->getType(), Tys));
+
+  if (isLegalType(I->getType())) {
+    New->takeName(I);
+    I->replaceAllUsesWith(New);
+  } else {
+    New->setName(I->getName() + "_lo");
+    Instruction *InsertPt = ++BasicBlock::iterator(New);
+    Value *Hi = new LoadInst(getHighWord(), I->getName() + "_hi", InsertPt);
+    Halves[I] = ValuePair(New, Hi);
+  }
+  Dead.push_back(I);
+}
+
+/// holdsHighWord - Return true if V was read from the high word global, which
+/// nothing from there to I in the same block may have written since.
+bool JsLegalizeI64::holdsHighWord(Value *V, Instruction *I) const {
+  LoadInst *LI = dyn_cast<LoadInst>(V);
+  if (!LI || LI->getPointerOperand() != HighWord ||
+      LI->getParent() != I->getParent())
+    return false;
+  // The calls being replaced are still around, and write nothing.
+  for (BasicBlock::iterator It = LI; &*It != I; ++It)
+    if (It->mayWriteToMemory() &&
+        std::find(Dead.begin(), Dead.end(), &*It) == Dead.end())
+      return false;
+  return true;
+}
+
+/// legalizeInstruction - Rewrite I in terms of the words of its i64 operands
+/// and result.
+void JsLegalizeI64::legalizeInstruction(Instruction *I) {
+  if (Halves.count(I))
+    return;
+
+  bool Legal = isLegalType(I->getType());
+  for (unsigned i = 0, e = I->getNumOperands(); Legal && i != e; ++i)
+    Legal = isLegalType(I->getOperand(i)->getType());
+  if (!Legal)
+    expandConstantExprs(I);
+  if (CallSite CS = CallSite::get(I)) {
+    if (Function *Callee = CS.getCalledFunction())
+      if (Callee->isIntrinsic())
+        return;
+    const FunctionType *FTy = cast<FunctionType>(
+      cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+    if (!Legal || !isLegalFunctionType(FTy))
+      legalizeCall(CS);
+    return;
+  }
+  if (Legal)
+    return;
+
+  LLVMContext &Ctx = I->getContext();
+  IRBuilder<> B(I->getParent(), I);
+  std::string Name = I->getName();
+  Value *Lo = 0, *Hi = 0;
+  Value *Zero = ConstantInt::get(Int32Ty, 0);
+
+  switch (I->getOpcode()) {
+  default:
+    report_fatal_error("The Javascript backend does not support this i64 "
+                       "operation.");
+  case Instruction::PHI: {
+    PHINode *PN = cast<PHINode>(I);
+    PHINode *LoPN = PHINode::Create(Int32Ty, Name + "_lo", I);
+    PHINode *HiPN = PHINode::Create(Int32Ty, Name + "_hi", I);
+    Halves[I] = ValuePair(LoPN, HiPN);
+    SplitPHIs.push_back(PN);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::GetElementPtr:
+  case Instruction::Alloca:
+    // Indices and array sizes only need their low word.
+    for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+      if (!isLegalType(I->getOperand(i)->getType())) {
+        if (ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(i)))
+          I->setOperand(i, ConstantInt::get(Int32Ty, CI->getSExtValue()));
+        else
+          I->setOperand(i, getHalves(I->getOperand(i)).first);
+        Modified = true;
+      }
+    return;
+  case Instruction::Ret: {
+    ValuePair V = getHalves(I->getOperand(0));
+    // The high word of the result of a call is already in place, and its
+    // reload is not needed.
+    if (!holdsHighWord(V.second, I))
+      B.CreateStore(V.second, getHighWord());
+    else if (V.second->use_empty())
+      Dead.push_back(cast<Instruction>(V.second));
+    B.CreateRet(V.first);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::Load: {
+    LoadInst *LI = cast<LoadInst>(I);
+    unsigned Align = std::min(LI->getAlignment() ? LI->getAlignment() : 4, 4U);
+    Value *Ptr = B.CreateBitCast(LI->getPointerOperand(),
+                                 PointerType::getUnqual(Int32Ty));
+    LoadInst *L = B.CreateLoad(Ptr, LI->isVolatile(), Name + "_lo");
+    LoadInst *H = B.CreateLoad(B.CreateConstGEP1_32(Ptr, 1), LI->isVolatile(),
+                               Name + "_hi");
+    L->setAlignment(Align);
+    H->setAlignment(Align);
+    Lo = L;
+    Hi = H;
+    break;
+  }
+  case Instruction::Store: {
+    StoreInst *SI = cast<StoreInst>(I);
+    unsigned Align = std::min(SI->getAlignment() ? SI->getAlignment() : 4, 4U);
+    ValuePair V = getHalves(SI->getOperand(0));
+    Value *Ptr = B.CreateBitCast(SI->getPointerOperand(),
+                                 PointerType::getUnqual(Int32Ty));
+    B.CreateStore(V.first, Ptr, SI->isVolatile())->setAlignment(Align);
+    B.CreateStore(V.second, B.CreateConstGEP1_32(Ptr, 1),
+                  SI->isVolatile())->setAlignment(Align);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::VAArg:
+    // legalizeCall passed the words as two variadic arguments.
+    Lo = B.CreateVAArg(I->getOperand(0), Int32Ty, Name + "_lo");
+    Hi = B.CreateVAArg(I->getOperand(0), Int32Ty, Name + "_hi");
+    break;
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor: {
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    Instruction::BinaryOps Op = (Instruction::BinaryOps)I->getOpcode();
+    Lo = createWordOp(B, Op, L.first, R.first, Name + "_lo");
+    Hi = createWordOp(B, Op, L.second, R.second, Name + "_hi");
+    break;
+  }
+  case Instruction::Add: {
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    Lo = createWordOp(B, Instruction::Add, L.first, R.first, Name + "_lo");
+    Value *Carry = B.CreateZExt(B.CreateICmpULT(Lo, L.first), Int32Ty);
+    Hi = B.CreateAdd(createWordOp(B, Instruction::Add, L.second, R.second),
+                     Carry, Name + "_hi");
+    break;
+  }
+  case Instruction::Sub: {
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    Lo = createWordOp(B, Instruction::Sub, L.first, R.first, Name + "_lo");
+    Value *Borrow = B.CreateZExt(B.CreateICmpULT(L.first, R.first), Int32Ty);
+    Hi = B.CreateSub(createWordOp(B, Instruction::Sub, L.second, R.second),
+                     Borrow, Name + "_hi");
+    break;
+  }
+  case Instruction::Mul: {
+    // The high word of the product of the low words is assembled from 16-bit
+    // partial products, which cannot overflow 32 bits.
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    const Instruction::BinaryOps Add = Instruction::Add, Mul = Instruction::Mul;
+    Value *L0 = B.CreateAnd(L.first, 0xffff), *L1 = B.CreateLShr(L.first, 16);
+    Value *R0 = B.CreateAnd(R.first, 0xffff), *R1 = B.CreateLShr(R.first, 16);
+    Value *T = createWordOp(B, Mul, L0, R0);
+    Value *U = createWordOp(B, Add, createWordOp(B, Mul, L1, R0),
+                            B.CreateLShr(T, 16));
+    Value *W = createWordOp(B, Add, createWordOp(B, Mul, L0, R1),
+                            B.CreateAnd(U, 0xffff));
+    Value *Carry = createWordOp(B, Add,
+                                createWordOp(B, Add,
+                                             createWordOp(B, Mul, L1, R1),
+                                             B.CreateLShr(U, 16)),
+                                B.CreateLShr(W, 16));
+    Lo = createWordOp(B, Mul, L.first, R.first, Name + "_lo");
+    Hi = createWordOp(B, Add, Carry,
+                      createWordOp(B, Add,
+                                   createWordOp(B, Mul, L.first, R.second),
+                                   createWordOp(B, Mul, L.second, R.first)),
+                      Name + "_hi");
+    break;
+  }
+  case Instruction::UDiv:
+  case Instruction::SDiv:
+  case Instruction::URem:
+  case Instruction::SRem: {
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    bool Signed = I->getOpcode() == Instruction::SDiv ||
+                  I->getOpcode() == Instruction::SRem;
+    bool Rem = I->getOpcode() == Instruction::URem ||
+               I->getOpcode() == Instruction::SRem;
+    Value *Args[] = { L.first, L.second, R.first, R.second,
+                      ConstantInt::get(Int32Ty, Rem) };
+    Lo = B.CreateCall(getDivMod(Signed), Args, array_endof(Args), Name + "_lo");
+    Hi = B.CreateLoad(getHighWord(), Name + "_hi");
+    break;
+  }
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr: {
+    ValuePair L = getHalves(I->getOperand(0));
+    Value *Amt = getHalves(I->getOperand(1)).first;
+    unsigned Op = I->getOpcode();
+    Value *Fill = Op == Instruction::AShr ? B.CreateAShr(L.second, 31) : Zero;
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(Amt)) {
+      unsigned N = CI->getZExtValue() & 63;
+      if (N == 0) {
+        Lo = L.first;
+        Hi = L.second;
+      } else if (N < 32 && Op == Instruction::Shl) {
+        Lo = B.CreateShl(L.first, N, Name + "_lo");
+        Hi = B.CreateOr(B.CreateShl(L.second, N),
+                        B.CreateLShr(L.first, 32 - N), Name + "_hi");
+      } else if (N < 32) {
+        Lo = B.CreateOr(B.CreateLShr(L.first, N),
+                        B.CreateShl(L.second, 32 - N), Name + "_lo");
+        Hi = Op == Instruction::LShr ? B.CreateLShr(L.second, N, Name + "_hi")
+                                     : B.CreateAShr(L.second, N, Name + "_hi");
+      } else if (Op == Instruction::Shl) {
+        Lo = Zero;
+        Hi = N == 32 ? L.first : B.CreateShl(L.first, N - 32, Name + "_hi");
+      } else {
+        Hi = Fill;
+        if (N == 32)
+          Lo = L.second;
+        else if (Op == Instruction::LShr)
+          Lo = B.CreateLShr(L.second, N - 32, Name + "_lo");
+        else
+          Lo = B.CreateAShr(L.second, N - 32, Name + "_lo");
+      }
+      break;
+    }
+
+    // Shift each word by the amount modulo 32, carry over the bits crossing
+    // the word boundary, then pick the words depending on the full amount.
+    Value *N = B.CreateAnd(Amt, 31);
+    Value *Small = B.CreateICmpULT(B.CreateAnd(Amt, 63), ConstantInt::get(Int32Ty, 32));
+    Value *NoCarry = B.CreateICmpEQ(N, Zero);
+    Value *Back = B.CreateSub(ConstantInt::get(Int32Ty, 32), N);
+    if (Op == Instruction::Shl) {
+      Value *Shifted = B.CreateShl(L.first, N);
+      Value *Carried = B.CreateSelect(NoCarry, Zero,
+                                      B.CreateLShr(L.first, Back));
+      Lo = B.CreateSelect(Small, Shifted, Zero, Name + "_lo");
+      Hi = B.CreateSelect(Small,
+                          B.CreateOr(B.CreateShl(L.second, N), Carried),
+                          Shifted, Name + "_hi");
+    } else {
+      Value *Shifted = Op == Instruction::LShr ? B.CreateLShr(L.second, N)
+                                               : B.CreateAShr(L.second, N);
+      Value *Carried = B.CreateSelect(NoCarry, Zero,
+                                      B.CreateShl(L.second, Back));
+      Lo = B.CreateSelect(Small, B.CreateOr(B.CreateLShr(L.first, N), Carried),
+                          Shifted, Name + "_lo");
+      Hi = B.CreateSelect(Small, Shifted, Fill, Name + "_hi");
+    }
+    break;
+  }
+  case Instruction::ICmp: {
+    ICmpInst *CI = cast<ICmpInst>(I);
+    ValuePair L = getHalves(I->getOperand(0)), R = getHalves(I->getOperand(1));
+    Value *Res;
+    if (CI->isEquality()) {
+      // Compare both words at once: x == y iff (xlo ^ ylo) | (xhi ^ yhi) == 0.
+      Value *X = isa<Constant>(R.first) && cast<Constant>(R.first)->isNullValue()
+        ? L.first : B.CreateXor(L.first, R.first);
+      Value *Y = isa<Constant>(R.second) && cast<Constant>(R.second)->isNullValue()
+        ? L.second : B.CreateXor(L.second, R.second);
+      Res = B.CreateICmp(CI->getPredicate(), B.CreateOr(X, Y), Zero);
+    } else {
+      // The high words decide, unless they are equal.
+      ICmpInst::Predicate HiPred, LoPred;
+      switch (CI->getPredicate()) {
+      default: llvm_unreachable("Invalid icmp predicate!");
+      case ICmpInst::ICMP_SLT: case ICmpInst::ICMP_SLE:
+        HiPred = ICmpInst::ICMP_SLT; break;
+      case ICmpInst::ICMP_SGT: case ICmpInst::ICMP_SGE:
+        HiPred = ICmpInst::ICMP_SGT; break;
+      case ICmpInst::ICMP_ULT: case ICmpInst::ICMP_ULE:
+        HiPred = ICmpInst::ICMP_ULT; break;
+      case ICmpInst::ICMP_UGT: case ICmpInst::ICMP_UGE:
+        HiPred = ICmpInst::ICMP_UGT; break;
+      }
+      LoPred = ICmpInst::getUnsignedPredicate(CI->getPredicate());
+      Res = B.CreateOr(B.CreateICmp(HiPred, L.second, R.second),
+                       B.CreateAnd(B.CreateICmpEQ(L.second, R.second),
+                                   B.CreateICmp(LoPred, L.first, R.first)));
+    }
+    Res->takeName(I);
+    I->replaceAllUsesWith(Res);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::Select: {
+    SelectInst *SI = cast<SelectInst>(I);
+    ValuePair T = getHalves(SI->getTrueValue());
+    ValuePair F = getHalves(SI->getFalseValue());
+    Lo = B.CreateSelect(SI->getCondition(), T.first, F.first, Name + "_lo");
+    Hi = B.CreateSelect(SI->getCondition(), T.second, F.second, Name + "_hi");
+    break;
+  }
+  case Instruction::Trunc: {
+    Value *V = getHalves(I->getOperand(0)).first;
+    if (I->getType() != Int32Ty)
+      V = B.CreateTrunc(V, I->getType());
+    V->takeName(I);
+    I->replaceAllUsesWith(V);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::ZExt:
+  case Instruction::SExt: {
+    Lo = I->getOperand(0);
+    if (Lo->getType() != Int32Ty)
+      Lo = I->getOpcode() == Instruction::ZExt ? B.CreateZExt(Lo, Int32Ty)
+                                               : B.CreateSExt(Lo, Int32Ty);
+    Hi = I->getOpcode() == Instruction::ZExt ? Zero
+                                             : B.CreateAShr(Lo, 31, Name + "_hi");
+    break;
+  }
+  case Instruction::PtrToInt:
+    Lo = B.CreatePtrToInt(I->getOperand(0), Int32Ty, Name + "_lo");
+    Hi = Zero;
+    break;
+  case Instruction::IntToPtr: {
+    Value *V = B.CreateIntToPtr(getHalves(I->getOperand(0)).first,
+                                I->getType());
+    V->takeName(I);
+    I->replaceAllUsesWith(V);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::SIToFP:
+  case Instruction::UIToFP: {
+    // hi * 2^32 + lo, where only the high word carries the sign.
+    ValuePair V = getHalves(I->getOperand(0));
+    const Type *DoubleTy = Type::getDoubleTy(Ctx);
+    Value *H = I->getOpcode() == Instruction::SIToFP
+      ? B.CreateSIToFP(V.second, DoubleTy) : B.CreateUIToFP(V.second, DoubleTy);
+    Value *Res = B.CreateFAdd(B.CreateFMul(H, ConstantFP::get(DoubleTy,
+                                                              4294967296.0)),
+                              B.CreateUIToFP(V.first, DoubleTy));
+    if (I->getType() != DoubleTy)
+      Res = B.CreateFPTrunc(Res, I->getType());
+    Res->takeName(I);
+    I->replaceAllUsesWith(Res);
+    Dead.push_back(I);
+    return;
+  }
+  case Instruction::FPToSI:
+  case Instruction::FPToUI: {
+    // The writer converts out of range doubles to i32 modulo 2^32, so the low
+    // word is a direct conversion.  The high word is the truncated quotient by
+    // 2^32, which is one too large for negative values with a nonzero low word.
+    const Type *DoubleTy = Type::getDoubleTy(Ctx);
+    Value *V = I->getOperand(0);
+    if (V->getType() != DoubleTy)
+      V = B.CreateFPExt(V, DoubleTy);
+    Lo = B.CreateFPToUI(V, Int32Ty, Name + "_lo");
+    Value *Q = B.CreateFPToSI(B.CreateFDiv(V, ConstantFP::get(DoubleTy,
+                                                              4294967296.0)),
+                              Int32Ty);
+    if (I->getOpcode() == Instruction::FPToUI) {
+      Hi = Q;
+      break;
+    }
+    Value *Adjust = B.CreateAnd(B.CreateFCmpOLT(V, ConstantFP::get(DoubleTy, 0)),
+                                B.CreateICmpNE(Lo, Zero));
+    Hi = B.CreateSub(Q, B.CreateZExt(Adjust, Int32Ty), Name + "_hi");
+    break;
+  }
+  case Instruction::BitCast: {
+    // Reinterpret the bits through a stack slot.
+    Value *Slot = getScratch(I->getParent()->getParent());
+    Value *Words = B.CreateBitCast(Slot, PointerType::getUnqual(Int32Ty));
+    if (isLegalType(I->getType())) {
+      ValuePair V = getHalves(I->getOperand(0));
+      B.CreateStore(V.first, Words);
+      B.CreateStore(V.second, B.CreateConstGEP1_32(Words, 1));
+      Value *Res = B.CreateLoad(B.CreateBitCast(Slot,
+                                  PointerType::getUnqual(I->getType())));
+      Res->takeName(I);
+      I->replaceAllUsesWith(Res);
+      Dead.push_back(I);
+      return;
+    }
+    B.CreateStore(I->getOperand(0),
+                  B.CreateBitCast(Slot,
+                    PointerType::getUnqual(I->getOperand(0)->getType())));
+    Lo = B.CreateLoad(Words, Name + "_lo");
+    Hi = B.CreateLoad(B.CreateConstGEP1_32(Words, 1), Name + "_hi");
+    break;
+  }
+  }
+
+  Halves[I] = ValuePair(Lo, Hi);
+  Dead.push_back(I);
+}
+
+bool JsLegalizeI64::legalizeFunction(Function &F) {
+  Scratch = 0;
+  Modified = false;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE;) {
+      Instruction *Inst = I++;
+      legalizeInstruction(Inst);
+    }
+
+  // Now that every value has been split, fill in the PHI nodes.
+  for (unsigned i = 0, e = SplitPHIs.size(); i != e; ++i) {
+    PHINode *PN = SplitPHIs[i];
+    ValuePair New = Halves[PN];
+    for (unsigned j = 0, je = PN->getNumIncomingValues(); j != je; ++j) {
+      ValuePair V = getHalves(PN->getIncomingValue(j));
+      cast<PHINode>(New.first)->addIncoming(V.first, PN->getIncomingBlock(j));
+      cast<PHINode>(New.second)->addIncoming(V.second, PN->getIncomingBlock(j));
+    }
+  }
+  SplitPHIs.clear();
+
+  for (unsigned i = 0, e = Dead.size(); i != e; ++i)
+    Dead[i]->dropAllReferences();
+  for (unsigned i = 0, e = Dead.size(); i != e; ++i) {
+    if (!Dead[i]->use_empty())
+      report_fatal_error("The Javascript backend left an i64 value behind.");
+    Dead[i]->eraseFromParent();
+  }
+  Modified |= !Dead.empty();
+  Dead.clear();
+  Halves.clear();
+  return Modified;
+}
+
+bool JsLegalizeI64::runOnModule(Module &M) {
+  TheModule = &M;
+  Int32Ty = Type::getInt32Ty(M.getContext());
+  HighWord = M.getGlobalVariable("__js_i64_hi", true);
+  bool Changed = false;
+
+  // Expand the intrinsics working on i64 values into plain instructions.  The
+  // memory intrinsics are switched over to their i32 flavor instead.
+  IntrinsicLowering IL(TD);
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E;) {
+      CallInst *CI = dyn_cast<CallInst>(&*I++);
+      Function *Callee = CI ? CI->getCalledFunction() : 0;
+      if (!Callee || !Callee->isIntrinsic() ||
+          isLegalFunctionType(Callee->getFunctionType()))
+        continue;
+      switch (Callee->getIntrinsicID()) {
+      case Intrinsic::dbg_declare:
+      case Intrinsic::dbg_value:
+        break;
+      case Intrinsic::memcpy:
+      case Intrinsic::memmove:
+      case Intrinsic::memset: {
+        const FunctionType *FTy = Callee->getFunctionType();
+        const Type *Tys[] = { FTy->getParamType(0), FTy->getParamType(1),
+                              Int32Ty };
+        if (Callee->getIntrinsicID() == Intrinsic::memset)
+          Tys[1] = Int32Ty;
+        Function *NewCallee = Intrinsic::getDeclaration(&M,
+            (Intrinsic::ID)Callee->getIntrinsicID(), Tys,
+            Callee->getIntrinsicID() == Intrinsic::memset ? 2 : 3);
+        Value *Len = CI->getOperand(3);
+        if (ConstantInt *C = dyn_cast<ConstantInt>(Len))
+          Len = ConstantInt::get(Int32Ty, C->getZExtValue());
+        else
+          Len = new TruncInst(Len, Int32Ty, "", CI);
+        Value *Args[] = { CI->getOperand(1), CI->getOperand(2), Len,
+                          CI->getOperand(4), CI->getOperand(5) };
+        CallInst::Create(NewCallee, Args, array_endof(Args), "", CI);
+        CI->eraseFromParent();
+        break;
+      }
+      default:
+        IL.LowerIntrinsicCall(CI);
+        break;
+      }
+      Changed = true;
+    }
+
+  // Functions with i64 in their signature are replaced, and their bodies
+  // legalized while the old arguments are still around.
+  std::vector<Function*> Illegal;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    if (!F->isIntrinsic() && !isLegalFunctionType(F->getFunctionType()))
+      Illegal.push_back(F);
+  SmallPtrSet<Function*, 16> Done;
+  for (unsigned i = 0, e = Illegal.size(); i != e; ++i) {
+    Function *NF = legalizeSignature(Illegal[i]);
+    legalizeFunction(*NF);
+    Illegal[i]->eraseFromParent();
+    Done.insert(NF);
+    Changed = true;
+  }
+
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    if (!F->isDeclaration() && !Done.count(F))
+      Changed |= legalizeFunction(*F);
+  return Changed;
+}
+
+/// getNumScalarElements - Return the number of scalars an aggregate of type Ty
+/// is made of.
+unsigned JsScalarizeAggregates::getNumScalarElements(const Type *Ty) {
+  if (const StructType *STy = dyn_cast<StructType>(Ty)) {
+    unsigned NumElts = 0;
+    for (unsigned i = 0, e = STy->getNumElements(); i != e; ++i)
+      NumElts += getNumScalarElements(STy->getElementType(i));
+    return NumElts;
+  }
+  if (const ArrayType *ATy = dyn_cast<ArrayType>(Ty))
+    return ATy->getNumElements() * getNumScalarElements(ATy->getElementType());
+  return 1;
+}
+
+/// splitPHI - Replace the aggregate PHI PN, whose only users are extractvalues
+/// and insertvalues updating it, by one PHI per element they read.  The
+/// elements are taken out of the incoming values at the end of each
+/// predecessor.
+bool JsScalarizeAggregates::splitPHI(PHINode *PN) {
+  SmallVector<InsertValueInst*, 4> Updates;
+  for (Value::use_iterator UI = PN->use_begin(), UE = PN->use_end();
+       UI != UE; ++UI) {
+    InsertValueInst *IVI = dyn_cast<InsertValueInst>(*UI);
+    if (IVI && IVI->getAggregateOperand() == PN &&
+        IVI->getInsertedValueOperand() != PN)
+      Updates.push_back(IVI);
+    else if (!isa<ExtractValueInst>(*UI) && *UI != PN)
+      return false;
+  }
+  if (!Updates.empty() &&
+      getNumScalarElements(PN->getType()) > MaxSplitAggregateElements)
+    return false;
+  // An invoke result is only available in the normal destination, so it can't
+  // be taken apart in the invoking block.
+  for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+    Instruction *In = dyn_cast<Instruction>(PN->getIncomingValue(i));
+    if (In && isa<InvokeInst>(In) && In->getParent() == PN->getIncomingBlock(i))
+      return false;
+  }
+
+  // An update is rebuilt from the elements it keeps, so that PN is only taken
+  // apart.
+  for (unsigned i = 0, e = Updates.size(); i != e; ++i) {
+    SmallVector<unsigned, 4> Path;
+    Updates[i]->setOperand(0, rebuildAggregate(PN, PN->getType(), Path,
+                                               UndefValue::get(PN->getType()),
+                                               Updates[i], Updates[i]));
+  }
+  SmallVector<ExtractValueInst*, 4> Extracts;
+  for (Value::use_iterator UI = PN->use_begin(), UE = PN->use_end();
+       UI != UE; ++UI)
+    if (ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(*UI))
+      Extracts.push_back(EVI);
+
+  std::map<std::vector<unsigned>, PHINode*> Elements;
+  for (unsigned i = 0, e = Extracts.size(); i != e; ++i) {
+    ExtractValueInst *EVI = Extracts[i];
+    std::vector<unsigned> Idx(EVI->idx_begin(), EVI->idx_end());
+    PHINode *&Elt = Elements[Idx];
+    if (!Elt) {
+      Elt = PHINode::Create(EVI->getType(), PN->getName() + ".elt", PN);
+      Elt->reserveOperandSpace(PN->getNumIncomingValues());
+      // A predecessor listed twice must bring in the same value both times.
+      DenseMap<BasicBlock*, Value*> Incoming;
+      for (unsigned j = 0, je = PN->getNumIncomingValues(); j != je; ++j) {
+        BasicBlock *Pred = PN->getIncomingBlock(j);
+        Value *&V = Incoming[Pred];
+        if (!V) {
+          Value *In = PN->getIncomingValue(j);
+          if (In == PN)
+            V = Elt;
+          else if (!(V = FindInsertedValue(In, &Idx[0], &Idx[0] + Idx.size())))
+            V = ExtractValueInst::Create(In, Idx.begin(), Idx.end(),
+                                         In->getName() + ".elt",
+                                         Pred->getTerminator());
+        }
+        Elt->addIncoming(V, Pred);
+      }
+    }
+    EVI->replaceAllUsesWith(Elt);
+    EVI->eraseFromParent();
+  }
+  PN->replaceAllUsesWith(UndefValue::get(PN->getType()));
+  PN->eraseFromParent();
+  ++NumAggregatePHIsSplit;
+  return true;
+}
+
+/// rebuildAggregate - Insert into Result the scalar elements of Agg below the
+/// position Path, each read by its own extractvalue.  The elements that Skip
+/// overwrites are left out.
+Value *JsScalarizeAggregates::rebuildAggregate(Value *Agg, const Type *Ty,
+                                               SmallVectorImpl<unsigned> &Path,
+                                               Value *Result,
+                                               Instruction *InsertBefore,
+                                               const InsertValueInst *Skip) {
+  if (Skip && Path.size() >= Skip->getNumIndices() &&
+      std::equal(Skip->idx_begin(), Skip->idx_end(), Path.begin()))
+    return Result;
+  if (!isAggregateType(Ty)) {
+    Value *Elt = ExtractValueInst::Create(Agg, Path.begin(), Path.end(),
+                                          Agg->getName() + ".elt",
+                                          InsertBefore);
+    return InsertValueInst::Create(Result, Elt, Path.begin(), Path.end(),
+                                   Agg->getName() + ".copy", InsertBefore);
+  }
+  const CompositeType *CTy = cast<CompositeType>(Ty);
+  unsigned NumElts = Ty->isStructTy() ? cast<StructType>(Ty)->getNumElements()
+                                      : cast<ArrayType>(Ty)->getNumElements();
+  for (unsigned i = 0; i != NumElts; ++i) {
+    Path.push_back(i);
+    Result = rebuildAggregate(Agg, CTy->getTypeAtIndex(i), Path, Result,
+                              InsertBefore, Skip);
+    Path.pop_back();
+  }
+  return Result;
+}
+
+/// readCallResult - Move the extractvalues of the aggregate returned by Call
+/// right after it, merging those of the same element, and hand its other users
+/// a copy rebuilt from its elements.
+void JsScalarizeAggregates::readCallResult(Instruction *Call) {
+  Instruction *InsertPt;
+  if (InvokeInst *II = dyn_cast<InvokeInst>(Call)) {
+    BasicBlock *Normal = II->getNormalDest();
+    if (!Normal->getSinglePredecessor() || isa<PHINode>(Normal->begin()))
+      Normal = SplitEdge(II->getParent(), Normal, this);
+    InsertPt = Normal->getFirstNonPHI();
+  } else {
+    InsertPt = llvm::next(BasicBlock::iterator(Call));
+  }
+
+  SmallVector<ExtractValueInst*, 4> Extracts;
+  SmallVector<Use*, 4> Others;
+  for (Value::use_iterator UI = Call->use_begin(), UE = Call->use_end();
+       UI != UE; ++UI) {
+    // Nested aggregates are copied along with the rest.
+    ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(*UI);
+    if (EVI && !isAggregateType(EVI->getType()))
+      Extracts.push_back(EVI);
+    else
+      Others.push_back(&UI.getUse());
+  }
+  // Keep the extractvalues in program order, as the use list is reversed.
+  // Reading the same element twice would only take another local.
+  std::reverse(Extracts.begin(), Extracts.end());
+  std::map<std::vector<unsigned>, ExtractValueInst*> Read;
+  for (unsigned i = 0, e = Extracts.size(); i != e; ++i) {
+    ExtractValueInst *&First =
+      Read[std::vector<unsigned>(Extracts[i]->idx_begin(),
+                                 Extracts[i]->idx_end())];
+    if (!First) {
+      First = Extracts[i];
+      if (First == InsertPt)
+        InsertPt = llvm::next(BasicBlock::iterator(InsertPt));
+      else
+        First->moveBefore(InsertPt);
+    } else {
+      Extracts[i]->replaceAllUsesWith(First);
+      Extracts[i]->eraseFromParent();
+    }
+  }
+  if (Others.empty())
+    return;
+
+  SmallVector<unsigned, 4> Path;
+  Value *Copy = rebuildAggregate(Call, Call->getType(), Path,
+                                 UndefValue::get(Call->getType()), InsertPt);
+  for (unsigned i = 0, e = Others.size(); i != e; ++i)
+    Others[i]->set(Copy);
+}
+
+/// foldExtracts - Replace the extractvalues that read a value inserted, a
+/// constant or a part of an insertvalue chain by what they read.
+bool JsScalarizeAggregates::foldExtracts(Function &F) {
+  bool Changed = false;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ) {
+    ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(&*I++);
+    if (!EVI)
+      continue;
+    // Read an element of an element straight from the outer aggregate.
+    while (ExtractValueInst *Inner =
+             dyn_cast<ExtractValueInst>(EVI->getAggregateOperand())) {
+      std::vector<unsigned> Idx(Inner->idx_begin(), Inner->idx_end());
+      Idx.insert(Idx.end(), EVI->idx_begin(), EVI->idx_end());
+      ExtractValueInst *Outer =
+        ExtractValueInst::Create(Inner->getAggregateOperand(), Idx.begin(),
+                                 Idx.end(), "", EVI);
+      Outer->takeName(EVI);
+      EVI->replaceAllUsesWith(Outer);
+      EVI->eraseFromParent();
+      EVI = Outer;
+      Changed = true;
+    }
+    if (Value *V = FindInsertedValue(EVI->getAggregateOperand(),
+                                     EVI->idx_begin(), EVI->idx_end(), EVI)) {
+      EVI->replaceAllUsesWith(V);
+      EVI->eraseFromParent();
+      ++NumExtractsFolded;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+/// eraseDeadAggregates - Erase the insertvalues and extractvalues that nothing
+/// reads anymore.
+bool JsScalarizeAggregates::eraseDeadAggregates(Function &F) {
+  bool Changed = false;
+  for (bool Erased = true; Erased; ) {
+    Erased = false;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ) {
+      Instruction *Inst = &*I++;
+      if ((isa<InsertValueInst>(Inst) || isa<ExtractValueInst>(Inst)) &&
+          Inst->use_empty()) {
+        Inst->eraseFromParent();
+        Erased = Changed = true;
+      }
+    }
+  }
+  return Changed;
+}
+
+bool JsScalarizeAggregates::runOnFunction(Function &F) {
+  bool Changed = false;
+
+  // Split the aggregate PHIs first.  Splitting one takes its incoming PHIs
+  // apart, which may let those be split in turn.
+  for (bool Split = true; Split; ) {
+    Split = false;
+    std::vector<PHINode*> PHIs;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+      if (isa<PHINode>(*I) && isAggregateType(I->getType()))
+        PHIs.push_back(cast<PHINode>(&*I));
+    for (unsigned i = 0, e = PHIs.size(); i != e; ++i)
+      Split |= splitPHI(PHIs[i]);
+    Changed |= Split;
+  }
+
+  Changed |= foldExtracts(F);
+  Changed |= eraseDeadAggregates(F);
+
+  std::vector<Instruction*> Calls;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+    if ((isa<CallInst>(*I) || isa<InvokeInst>(*I)) &&
+        isAggregateType(I->getType()) && !I->use_empty())
+      Calls.push_back(&*I);
+  for (unsigned i = 0, e = Calls.size(); i != e; ++i)
+    readCallResult(Calls[i]);
+  if (Calls.empty())
+    return Changed;
+
+  // The copies of call results may be taken apart again.
+  foldExtracts(F);
+  eraseDeadAggregates(F);
+  return true;
+}
+
+bool JsAnnotateProfile::runOnModule(Module &M) {
+  ProfileInfo &PI = getAnalysis<ProfileInfo>();
+  LLVMContext &Context = M.getContext();
+  unsigned Kind = Context.getMDKindID(ProfileMDName);
+  const Type *Int64Ty = Type::getInt64Ty(Context);
+  bool Changed = false;
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+      double Count = PI.getExecutionCount(BB);
+      if (Count == ProfileInfo::MissingValue)
+        continue;
+      // Missing edge weights are recorded as ProfileInfo::MissingValue, -1.
+      TerminatorInst *TI = BB->getTerminator();
+      SmallVector<Value*, 8> Counts;
+      Counts.push_back(ConstantInt::get(Int64Ty, (int64_t)Count, true));
+      for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i) {
+        double Weight =
+          PI.getEdgeWeight(ProfileInfo::getEdge(BB, TI->getSuccessor(i)));
+        Counts.push_back(ConstantInt::get(Int64Ty, (int64_t)Weight, true));
+      }
+      TI->setMetadata(Kind, MDNode::get(Context, Counts.data(), Counts.size()));
+      Changed = true;
+    }
+  return Changed;
+}
+
+static void FindStaticTors(GlobalVariable *GV, std::set<Function*> &StaticTors);
+
+/// isPrintedFunction - Return true if the writer prints a body for F.
+static bool isPrintedFunction(const Function *F) {
+  return !F->isDeclaration() && !F->hasAvailableExternallyLinkage();
+}
+
+bool JsSplitChunks::runOnModule(Module &M) {
+  CallGraph &CG = getAnalysis<CallGraph>();
+  LLVMContext &Context = M.getContext();
+  unsigned Kind = Context.getMDKindID(ProfileMDName);
+
+  // Startup runs main and the static constructors and destructors.  A module
+  // without any is a library, which is entered through the functions visible
+  // outside of it.
+  std::set<Function*> Roots;
+  if (GlobalVariable *GV = M.getNamedGlobal("llvm.global_ctors"))
+    FindStaticTors(GV, Roots);
+  if (GlobalVariable *GV = M.getNamedGlobal("llvm.global_dtors"))
+    FindStaticTors(GV, Roots);
+  if (Function *Main = M.getFunction("main"))
+    Roots.insert(Main);
+  if (Roots.empty())
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+      if (isPrintedFunction(F) && !F->hasLocalLinkage())
+        Roots.insert(F);
+
+  SmallPtrSet<const Function*, 64> Placed;
+  bool HasProfile = false;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isPrintedFunction(F))
+      continue;
+    MDNode *Counts = F->getEntryBlock().getTerminator()->getMetadata(Kind);
+    if (!Counts)
+      continue;
+    HasProfile = true;
+    if (cast<ConstantInt>(Counts->getOperand(0))->getSExtValue() > 0)
+      Placed.insert(F);
+  }
+
+  SmallVector<CallGraphNode*, 32> Worklist;
+  for (std::set<Function*>::iterator I = Roots.begin(), E = Roots.end();
+       I != E; ++I)
+    if (isPrintedFunction(*I) && Placed.insert(*I) && !HasProfile)
+      Worklist.push_back(CG[*I]);
+  while (!Worklist.empty()) {
+    CallGraphNode *N = Worklist.pop_back_val();
+    for (CallGraphNode::iterator I = N->begin(), E = N->end(); I != E; ++I) {
+      Function *Callee = I->second->getFunction();
+      if (Callee && isPrintedFunction(Callee) && Placed.insert(Callee))
+        Worklist.push_back(I->second);
+    }
+  }
+
+  NamedMDNode *Chunks = 0;
+  SmallVector<Value*, 32> Chunk;
+  unsigned Size = 0;
+  for (Module::iterator I = M.begin(), IE = M.end(); I != IE; ++I) {
+    if (!isPrintedFunction(I) || Placed.count(I))
+      continue;
+    Worklist.push_back(CG[I]);
+    while (!Worklist.empty()) {
+      CallGraphNode *N = Worklist.pop_back_val();
+      Function *F = N->getFunction();
+      if (!F || !isPrintedFunction(F) || !Placed.insert(F))
+        continue;
+      Chunk.push_back(F);
+      ++NumChunkedFunctions;
+      for (inst_iterator II = inst_begin(F), E = inst_end(F); II != E; ++II)
+        ++Size;
+      // Visit the callees in call order.
+      for (unsigned i = N->size(); i != 0; --i)
+        Worklist.push_back((*N)[i-1]);
+      if (Size < ChunkSize)
+        continue;
+      if (!Chunks)
+        Chunks = NamedMDNode::Create(Context, ChunksMDName, 0, 0, &M);
+      Chunks->addOperand(MDNode::get(Context, Chunk.data(), Chunk.size()));
+      Chunk.clear();
+      Size = 0;
+    }
+  }
+  if (!Chunk.empty()) {
+    if (!Chunks)
+      Chunks = NamedMDNode::Create(Context, ChunksMDName, 0, 0, &M);
+    Chunks->addOperand(MDNode::get(Context, Chunk.data(), Chunk.size()));
+  }
+  return Chunks != 0;
+}
+
+/// markOperand - Mark the globals that V refers to as live.
+void JsPruneExports::markOperand(Value *V) {
+  if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+    markLive(GV);
+    return;
+  }
+  Constant *C = dyn_cast<Constant>(V);
+  if (!C || !VisitedConstants.insert(C))
+    return;
+  for (User::op_iterator OI = C->op_begin(), E = C->op_end(); OI != E; ++OI)
+    markOperand(*OI);
+}
+
+/// isPrunableGlobal - Return true if -js-exports may internalize or remove
+/// GV.  main is run by the module, and the llvm globals list the static
+/// constructors and destructors.
+static bool isPrunableGlobal(const GlobalValue *GV,
+                             const std::set<std::string> &Exports) {
+  return GV->getName() != "main" && !GV->getName().startswith("llvm.") &&
+         !Exports.count(GV->getName());
+}
+
+bool JsPruneExports::runOnModule(Module &M) {
+  OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getFile(ExportsFile.c_str()));
+  if (!Buffer)
+    report_fatal_error("Cannot read the export list " + ExportsFile);
+  std::set<std::string> Exports;
+  StringRef Names = Buffer->getBuffer();
+  while (true) {
+    size_t Start = Names.find_first_not_of(" \t\r\n");
+    if (Start == StringRef::npos)
+      break;
+    Names = Names.substr(Start);
+    size_t End = Names.find_first_of(" \t\r\n");
+    Exports.insert(Names.substr(0, End));
+    Names = Names.substr(std::min(End, Names.size()));
+  }
+
+  std::vector<GlobalValue*> Globals;
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I)
+    Globals.push_back(I);
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
+    Globals.push_back(I);
+  for (Module::alias_iterator I = M.alias_begin(), E = M.alias_end();
+       I != E; ++I)
+    Globals.push_back(I);
+
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    GlobalValue *GV = Globals[i];
+    if (!isPrunableGlobal(GV, Exports))
+      markLive(GV);
+    else if (!GV->isDeclaration())
+      GV->setLinkage(GlobalValue::InternalLinkage);
+  }
+  while (!Worklist.empty()) {
+    GlobalValue *GV = Worklist.pop_back_val();
+    if (Function *F = dyn_cast<Function>(GV)) {
+      for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+        for (User::op_iterator OI = I->op_begin(), OE = I->op_end();
+             OI != OE; ++OI)
+          markOperand(*OI);
+    } else if (GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV)) {
+      if (GVar->hasInitializer())
+        markOperand(GVar->getInitializer());
+    } else if (GlobalAlias *GA = dyn_cast<GlobalAlias>(GV)) {
+      markOperand(GA->getAliasee());
+    }
+  }
+
+  std::string ErrorInfo;
+  OwningPtr<raw_fd_ostream> Report;
+  if (!ExportsReport.empty()) {
+    Report.reset(new raw_fd_ostream(ExportsReport.c_str(), ErrorInfo));
+    if (!ErrorInfo.empty())
+      report_fatal_error("Cannot write the export report: " + ErrorInfo);
+  }
+  // Drop the references between the dead globals before erasing them.
+  std::vector<GlobalValue*> Dead;
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    GlobalValue *GV = Globals[i];
+    if (Live.count(GV))
+      continue;
+    Dead.push_back(GV);
+    if (Function *F = dyn_cast<Function>(GV)) {
+      if (F->isDeclaration())
+        continue;
+      unsigned Size = 0;
+      for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+        ++Size;
+      if (Report)
+        *Report << "function " << F->getName() << ' ' << Size
+                << " instructions\n";
+      ++NumPrunedFunctions;
+      F->deleteBody();
+    } else if (GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV)) {
+      if (GVar->isDeclaration())
+        continue;
+      uint64_t Size = TD.getTypeAllocSize(GVar->getType()->getElementType());
+      if (Report)
+        *Report << "global " << GVar->getName() << ' ' << Size << " bytes\n";
+      NumPrunedBytes += Size;
+      GVar->setInitializer(0);
+    } else {
+      cast<GlobalAlias>(GV)->setAliasee(0);
+    }
+  }
+  for (unsigned i = 0, e = Dead.size(); i != e; ++i) {
+    Dead[i]->removeDeadConstantUsers();
+    Dead[i]->eraseFromParent();
+  }
+  return true;
+}
+
+/// printStructReturnPointerFunctionType - This is like printType for a struct
+/// return type, except, instead of printing the type as void (*)(Struct*, ...)
+/// print it as "Struct (*)(...)", for struct return functions.
+void JsWriter::printStructReturnPointerFunctionType(raw_ostream &Out,
+                                                   const AttrListPtr &PAL,
+                                                   const PointerType *TheTy) {
+  const FunctionType *FTy = cast<FunctionType>(TheTy->getElementType());
+  std::string tstr;
+  raw_string_ostream FunctionInnards(tstr);
+  FunctionInnards << " (*) (";
+  bool PrintedType = false;
+
+  FunctionType::param_iterator I = FTy->param_begin(), E = FTy->param_end();
+  const Type *RetTy = cast<PointerType>(I->get())->getElementType();
+  unsigned Idx = 1;
+  for (++I, ++Idx; I != E; ++I, ++Idx) {
+    if (PrintedType)
+      FunctionInnards << ", ";
+    const Type *ArgTy = *I;
+    if (PAL.paramHasAttr(Idx, Attribute::ByVal)) {
+      assert(ArgTy->isPointerTy());
+      ArgTy = cast<PointerType>(ArgTy)->getElementType();
+    }
+    printType(FunctionInnards, ArgTy,
+        /*isSigned=*/PAL.paramHasAttr(Idx, Attribute::SExt), "");
+    PrintedType = true;
+  }
+  if (FTy->isVarArg()) {
+    if (!PrintedType)
+      FunctionInnards << " int"; //dummy argument for empty vararg functs
+    FunctionInnards << ", ...";
+  } else if (!PrintedType) {
+    FunctionInnards << "void";
+  }
+  FunctionInnards << ')';
+  printType(Out, RetTy, 
+      /*isSigned=*/PAL.paramHasAttr(0, Attribute::SExt), FunctionInnards.str());
+}
+
+raw_ostream &
+JsWriter::printSimpleType(raw_ostream &Out, const Type *Ty, bool isSigned,
+                         const std::string &NameSoFar) {
+  assert((Ty->isPrimitiveType() || Ty->isIntegerTy() || Ty->isVectorTy()) && 
+         "Invalid type for printSimpleType");
+  switch (Ty->getTypeID()) {
+  case Type::VoidTyID:   return Out << "void " << NameSoFar;
+  case Type::IntegerTyID: {
+    unsigned NumBits = cast<IntegerType>(Ty)->getBitWidth();
+    if (NumBits == 1) 
+      return Out << "bool " << NameSoFar;
+    else if (NumBits <= 8)
+      return Out << (isSigned?"signed":"unsigned") << " char " << NameSoFar;
+    else if (NumBits <= 16)
+      return Out << (isSigned?"signed":"unsigned") << " short " << NameSoFar;
+    else if (NumBits <= 32)
+      return Out << (isSigned?"signed":"unsigned") << " int " << NameSoFar;
+    else if (NumBits <= 64)
+      return Out << (isSigned?"signed":"unsigned") << " long long "<< NameSoFar;
+    else { 
+      assert(NumBits <= 128 && "Bit widths > 128 not implemented yet");
+      return Out << (isSigned?"llvmInt128":"llvmUInt128") << " " << NameSoFar;
+    }
+  }
+  case Type::FloatTyID:  return Out << "float "   << NameSoFar;
+  case Type::DoubleTyID: return Out << "double "  << NameSoFar;
+  // Lacking emulation of FP80 on PPC, etc., we assume whichever of these is
   // present matches host 'long double'.
   case Type::X86_FP80TyID:
   case Type::PPC_FP128TyID:
@@ -782,72 +2932,6 @@ static bool isFPCSafeToPrint(const ConstantFP *CFP) {
 #endif
 }
 
-/// Print out the casting for a cast operation. This does the double casting
-/// necessary for conversion to the destination type, if necessary. 
-/// @brief Print a cast
-void JsWriter::printCast(unsigned opc, const Type *SrcTy, const Type *DstTy) {
-  // Print the destination type cast
-  switch (opc) {
-    case Instruction::UIToFP:
-    case Instruction::SIToFP:
-    case Instruction::IntToPtr:
-    case Instruction::Trunc:
-    case Instruction::BitCast:
-    case Instruction::FPExt:
-    case Instruction::FPTrunc: // For these the DstTy sign doesn't matter
-      Out << '(';
-      printType(Out, DstTy);
-      Out << ')';
-      break;
-    case Instruction::ZExt:
-    case Instruction::PtrToInt:
-    case Instruction::FPToUI: // For these, make sure we get an unsigned dest
-      Out << '(';
-      printSimpleType(Out, DstTy, false);
-      Out << ')';
-      break;
-    case Instruction::SExt: 
-    case Instruction::FPToSI: // For these, make sure we get a signed dest
-      Out << '(';
-      printSimpleType(Out, DstTy, true);
-      Out << ')';
-      break;
-    default:
-      llvm_unreachable("Invalid cast opcode");
-  }
-
-  // Print the source type cast
-  switch (opc) {
-    case Instruction::UIToFP:
-    case Instruction::ZExt:
-      Out << '(';
-      printSimpleType(Out, SrcTy, false);
-      Out << ')';
-      break;
-    case Instruction::SIToFP:
-    case Instruction::SExt:
-      Out << '(';
-      printSimpleType(Out, SrcTy, true); 
-      Out << ')';
-      break;
-    case Instruction::IntToPtr:
-    case Instruction::PtrToInt:
-      // Avoid "cast to pointer from integer of different size" warnings
-      Out << "(unsigned long)";
-      break;
-    case Instruction::Trunc:
-    case Instruction::BitCast:
-    case Instruction::FPExt:
-    case Instruction::FPTrunc:
-    case Instruction::FPToSI:
-    case Instruction::FPToUI:
-      break; // These don't need a source cast.
-    default:
-      llvm_unreachable("Invalid cast opcode");
-      break;
-  }
-}
-
 void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
   if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(CPV)) {
     switch (CE->getOpcode()) {
@@ -863,22 +2947,31 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
     case Instruction::PtrToInt:
     case Instruction::IntToPtr:
     case Instruction::BitCast:
+      if (HeapMemory && (CE->getOpcode() == Instruction::BitCast ||
+                         CE->getOpcode() == Instruction::IntToPtr ||
+                         CE->getOpcode() == Instruction::PtrToInt)) {
+        // Pointers are already integers.
+        printConstant(CE->getOperand(0), Static);
+        return;
+      }
+      // Like visitCastInst, mask the result to the narrower integer type.
+      if (CE->getOpcode() == Instruction::BitCast ||
+          CE->getOpcode() == Instruction::IntToPtr ||
+          CE->getOpcode() == Instruction::FPExt) {
+        printConstant(CE->getOperand(0), Static);
+        return;
+      }
       Out << "(";
-      printCast(CE->getOpcode(), CE->getOperand(0)->getType(), CE->getType());
       if (CE->getOpcode() == Instruction::SExt &&
-          CE->getOperand(0)->getType() == Type::getInt1Ty(CPV->getContext())) {
-        // Make sure we really sext from bool here by subtracting from 0
-        Out << "0-";
-      }
+          CE->getOperand(0)->getType() == Type::getInt1Ty(CPV->getContext()))
+        Out << "0 - ";
       printConstant(CE->getOperand(0), Static);
-      if (CE->getType() == Type::getInt1Ty(CPV->getContext()) &&
-          (CE->getOpcode() == Instruction::Trunc ||
-           CE->getOpcode() == Instruction::FPToUI ||
-           CE->getOpcode() == Instruction::FPToSI ||
-           CE->getOpcode() == Instruction::PtrToInt)) {
-        // Make sure we really truncate to bool here by anding with 1
-        Out << "&1u";
-      }
+      if (unsigned Bits = (CE->getOpcode() == Instruction::ZExt ||
+                           CE->getOpcode() == Instruction::UIToFP ?
+                             CE->getOperand(0)->getType() :
+                             CE->getType())->getPrimitiveSizeInBits())
+        if (Bits < 32)
+          Out << " & " << (1 << Bits) - 1;
       Out << ')';
       return;
 
@@ -917,8 +3010,15 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
     case Instruction::LShr:
     case Instruction::AShr:
     {
-      Out << '(';
-      printConstantWithCast(CE->getOperand(0), CE->getOpcode());
+      // Integer divisions round like those of visitBinaryOperator.
+      bool IsIntDiv = CE->getOpcode() == Instruction::UDiv ||
+                      CE->getOpcode() == Instruction::SDiv;
+      bool Unsigned = CE->getOpcode() == Instruction::UDiv ||
+                      CE->getOpcode() == Instruction::URem ||
+                      (CE->getOpcode() == Instruction::ICmp &&
+                       ICmpInst::isUnsigned(CE->getPredicate()));
+      Out << (IsIntDiv ? "Math.floor(" : "(");
+      printConstantWithCast(CE->getOperand(0), Unsigned, Static);
       switch (CE->getOpcode()) {
       case Instruction::Add:
       case Instruction::FAdd: Out << " + "; break;
@@ -955,7 +3055,7 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
         break;
       default: llvm_unreachable("Illegal opcode here!");
       }
-      printConstantWithCast(CE->getOperand(1), CE->getOpcode());
+      printConstantWithCast(CE->getOperand(1), Unsigned, Static);
       Out << ')';
       return;
     }
@@ -984,10 +3084,10 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
         case FCmpInst::FCMP_OGT: op = "ogt"; break;
         case FCmpInst::FCMP_OGE: op = "oge"; break;
         }
-        Out << "llvm_fcmp_" << op << "(";
-        printConstantWithCast(CE->getOperand(0), CE->getOpcode());
+        Out << "$rt.fcmp_" << op << "(";
+        printConstant(CE->getOperand(0), Static);
         Out << ", ";
-        printConstantWithCast(CE->getOperand(1), CE->getOpcode());
+        printConstant(CE->getOperand(1), Static);
         Out << ")";
       }
       Out << ')';
@@ -1015,6 +3115,8 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
       Out << (CI->getZExtValue() ? "true" : "false");
     else if (Ty == Type::getInt32Ty(CPV->getContext()))
       Out << CI->getSExtValue();
+    else if (Coercions && CI->getBitWidth() < 32)
+      Out << CI->getZExtValue();
     else if (CI->isMinValue(true)) {
       Out << CI->getZExtValue();
     } else {
@@ -1076,18 +3178,29 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
 
         if (FPC->getType() == Type::getFloatTy(FPC->getContext()))
           Out << "LLVM_NAN" << (Val == QuietNaN ? "" : "S") << "F(\""
-              << Buffer << "\") /*nan*/ ";
+              << Buffer << "\")";
         else
           Out << "LLVM_NAN" << (Val == QuietNaN ? "" : "S") << "(\""
-              << Buffer << "\") /*nan*/ ";
+              << Buffer << "\")";
+        if (!Minify)
+          Out << " /*nan*/ ";
       } else if (IsInf(V)) {
         // The value is Inf
         if (V < 0) Out << '-';
         Out << "LLVM_INF" <<
             (FPC->getType() == Type::getFloatTy(FPC->getContext()) ? "F" : "")
-            << " /*inf*/ ";
+            << (Minify ? "" : " /*inf*/ ");
+      } else if (Float32 && FPC->getType()->isFloatTy()) {
+        // A float is rounded from its shortest decimal when that reads back
+        // as another double.  asm.js wants every float literal rounded.
+        std::string Str = apfToStr(FPC->getValueAPF());
+        std::string SingleStr = apfToStr(FPC->getValueAPF(), true);
+        if (Coercions || Str != SingleStr)
+          Out << "Math.fround(" << SingleStr << ')';
+        else
+          Out << Str;
       } else {
-	Out << apfToStr(FPC->getValueAPF());
+        Out << apfToStr(FPC->getValueAPF());
       }
     }
     break;
@@ -1103,7 +3216,7 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
       Out << '[';
       if (AT->getNumElements()) {
         Out << ' ';
-        Constant *CZ = Constant::getNullValue(AT->getElementType());
+        Constant *CZ = getUniquedNullValue(AT->getElementType());
         printConstant(CZ, Static);
         for (unsigned i = 1, e = AT->getNumElements(); i != e; ++i) {
           Out << ", ";
@@ -1127,7 +3240,7 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
       assert(isa<ConstantAggregateZero>(CPV) || isa<UndefValue>(CPV));
       const VectorType *VT = cast<VectorType>(CPV->getType());
       Out << "[ ";
-      Constant *CZ = Constant::getNullValue(VT->getElementType());
+      Constant *CZ = getUniquedNullValue(VT->getElementType());
       printConstant(CZ, Static);
       for (unsigned i = 1, e = VT->getNumElements(); i != e; ++i) {
         Out << ", ";
@@ -1144,10 +3257,10 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
       Out << '[';
       if (ST->getNumElements()) {
         Out << ' ';
-        printConstant(Constant::getNullValue(ST->getElementType(0)), Static);
+        printConstant(getUniquedNullValue(ST->getElementType(0)), Static);
         for (unsigned i = 1, e = ST->getNumElements(); i != e; ++i) {
           Out << ", ";
-          printConstant(Constant::getNullValue(ST->getElementType(i)), Static);
+          printConstant(getUniquedNullValue(ST->getElementType(i)), Static);
         }
       }
       Out << " ]";
@@ -1166,7 +3279,7 @@ void JsWriter::printConstant(Constant *CPV, bool Static, raw_ostream &Out) {
 
   case Type::PointerTyID:
     if (isa<ConstantPointerNull>(CPV)) {
-      Out << "null";
+      Out << (HeapMemory ? "0" : "null");
       break;
     } else if (GlobalValue *GV = dyn_cast<GlobalValue>(CPV)) {
       writeOperand(GV, Static);
@@ -1189,54 +3302,27 @@ void JsWriter::printConstant(Constant *CPV, bool Static) {
   printConstant(CPV, Static, Out);
 }
 
-//  Print a constant assuming that it is the operand for a given Opcode. The
-//  opcodes that care about sign need to cast their operands to the expected
-//  type before the operation proceeds. This function does the casting.
-void JsWriter::printConstantWithCast(Constant* CPV, unsigned Opcode) {
-
-  // Extract the operand's type, we'll need it.
-  const Type* OpTy = CPV->getType();
-
-  // Indicate whether to do the cast or not.
-  bool shouldCast = false;
-  bool typeIsSigned = false;
-
-  // Based on the Opcode for which this Constant is being written, determine
-  // the new type to which the operand should be casted by setting the value
-  // of OpTy. If we change OpTy, also set shouldCast to true so it gets
-  // casted below.
-  switch (Opcode) {
-    default:
-      // for most instructions, it doesn't matter
-      break; 
-    case Instruction::Add:
-    case Instruction::Sub:
-    case Instruction::Mul:
-      // We need to cast integer arithmetic so that it is always performed
-      // as unsigned, to avoid undefined behavior on overflow.
-    case Instruction::LShr:
-    case Instruction::UDiv:
-    case Instruction::URem:
-      shouldCast = true;
-      break;
-    case Instruction::AShr:
-    case Instruction::SDiv:
-    case Instruction::SRem:
-      shouldCast = true;
-      typeIsSigned = true;
-      break;
+/// printConstantWithCast - Print the constant operand CPV of a constant
+/// expression.  JS numbers hold integers signed, so an operand the expression
+/// reads as unsigned is zero extended first.
+void JsWriter::printConstantWithCast(Constant *CPV, bool Unsigned,
+                                     bool Static) {
+  unsigned Bits = CPV->getType()->isIntegerTy() ?
+    CPV->getType()->getPrimitiveSizeInBits() : 0;
+  if (!Unsigned || !Bits || Bits > 32) {
+    printConstant(CPV, Static);
+    return;
   }
-
-  // Write out the casted constant if we should, otherwise just write the
-  // operand.
-  if (shouldCast) {
-    Out << "((";
-    printSimpleType(Out, OpTy, typeIsSigned);
-    Out << ")";
-    printConstant(CPV, false);
-    Out << ")";
-  } else 
-    printConstant(CPV, false);
+  if (ConstantInt *CI = dyn_cast<ConstantInt>(CPV)) {
+    Out << CI->getZExtValue();
+    return;
+  }
+  Out << '(';
+  printConstant(CPV, Static);
+  if (Bits == 32)
+    Out << " >>> 0)";
+  else
+    Out << " & " << (1ULL << Bits) - 1 << ')';
 }
 
 std::string JsWriter::GetValueName(const Value *Operand) {
@@ -1246,6 +3332,16 @@ std::string JsWriter::GetValueName(const Value *Operand) {
     Mang->getNameWithPrefix(Str, GV, false);
     return CBEMangle(Str.str().str());
   }
+
+  // Coalesced SSA values are named after the local they share.
+  const Value *Var = getLocalVariable(Operand);
+  if (Var != Operand)
+    return GetValueName(Var);
+
+  DenseMap<const Value*, std::string>::const_iterator MI =
+    MinifiedNames.find(Operand);
+  if (MI != MinifiedNames.end())
+    return MI->second;
     
   std::string Name = Operand->getName();
     
@@ -1289,24 +3385,67 @@ void JsWriter::writeInstComputationInline(Instruction &I) {
       report_fatal_error("The Javascript backend does not currently support integer "
                         "types of widths other than 1, 8, 16, 32, 64.\n");
   }
+  if (isFroundedInst(I)) {
+    Out << "Math.fround(";
+    visit(I);
+    Out << ')';
+    return;
+  }
   visit(I);
 }
 
 
+/// isExternalVarArgFunction - Return true if V is a variadic function of the
+/// JS environment, which takes its variadic arguments as they are.
+static bool isExternalVarArgFunction(const Value *V) {
+  const Function *F = dyn_cast<Function>(V);
+  return F && F->isDeclaration() && F->isVarArg() && !F->isIntrinsic();
+}
+
 void JsWriter::writeOperandInternal(Value *Operand, bool Static) {
   if (Instruction *I = dyn_cast<Instruction>(Operand))
     // Should we inline this instruction to build a tree?
     if (isInlinableInst(*I) && !isDirectAlloca(I)) {
       Out << '(';
-      writeInstComputationInline(*I);
+      // asm.js arithmetic does not take a heap read until it is coerced.
+      const Type *Ty = I->getType();
+      if (!Coercions || !isa<LoadInst>(I)) {
+        writeInstComputationInline(*I);
+      } else if (Float32 && Ty->isFloatTy()) {
+        Out << "Math.fround(";
+        writeInstComputationInline(*I);
+        Out << ')';
+      } else if (Ty->isFloatingPointTy()) {
+        Out << '+';
+        writeInstComputationInline(*I);
+      } else {
+        writeInstComputationInline(*I);
+        Out << " | 0";
+      }
       Out << ')';
       return;
     }
 
   Constant* CPV = dyn_cast<Constant>(Operand);
 
+  if (CPV && !Static) {
+    DenseMap<const Constant*, unsigned>::const_iterator I =
+      PooledConstants.find(CPV);
+    if (I != PooledConstants.end()) {
+      Out << "$C" << I->second;
+      return;
+    }
+  }
+
   if (CPV && !isa<GlobalValue>(CPV)) {
     printConstant(CPV, Static);
+  } else if (HeapMemory && isa<Function>(Operand)) {
+    assert(FunctionTableIndices.count(cast<Function>(Operand)) &&
+           "Address of a function without a table entry!");
+    Out << FunctionTableIndices.lookup(cast<Function>(Operand));
+  } else if (isExternalVarArgFunction(Operand)) {
+    // Its pointer may be called with a buffer, see printVarArgForwarders.
+    Out << GetValueName(Operand) << "$va";
   } else {
     Out << GetValueName(Operand);
   }
@@ -1409,9 +3548,33 @@ void JsWriter::writeOperandWithCast(Value* Operand, const ICmpInst &Cmp) {
   // optimize things like "p < NULL" to false (p may contain an integer value
   // f.e.).
   bool shouldCast = Cmp.isRelational()
+    && Operand->getType()->isIntegerTy()
     && Operand->getType()->getPrimitiveSizeInBits() < 32
     && !Cmp.isSigned();
 
+  if (Coercions && Cmp.isRelational() &&
+      Operand->getType()->isIntegerTy()) {
+    unsigned NumBits = Operand->getType()->getPrimitiveSizeInBits();
+    // i32 values are kept signed and narrower ones zero extended, so only
+    // these two cases need to be reinterpreted.
+    if (NumBits == 32 && Cmp.isUnsigned()) {
+      ConstantInt *CI = dyn_cast<ConstantInt>(Operand);
+      if (CI && !CI->getValue().isNegative()) {
+        writeOperand(Operand);
+        return;
+      }
+      Out << "(";
+      writeOperand(Operand);
+      Out << " >>> 0)";
+      return;
+    }
+    if (NumBits < 32 && Cmp.isSigned()) {
+      writeSignExtended(Operand);
+      return;
+    }
+    shouldCast = false;
+  }
+
   // Write out the casted operand if we should, otherwise just write the
   // operand.
   if (!shouldCast) {
@@ -1429,6 +3592,33 @@ void JsWriter::writeOperandWithCast(Value* Operand, const ICmpInst &Cmp) {
   Out << " & " << (1 << Operand->getType()->getPrimitiveSizeInBits()) - 1 << ')';
 }
 
+/// writeSignExtended - Print an integer narrower than 32 bits, which is kept
+/// zero extended, as a signed i32.
+void JsWriter::writeSignExtended(Value *Operand) {
+  unsigned Shift = 32 - Operand->getType()->getPrimitiveSizeInBits();
+  Out << "(";
+  writeOperand(Operand);
+  Out << " << " << Shift << " >> " << Shift << ")";
+}
+
+/// printCoercedValue - Print V with the asm.js coercion for a value of type
+/// Ty: "|0" for integers and pointers that fit in an i32, "+" otherwise.
+void JsWriter::printCoercedValue(Value *V, const Type *Ty) {
+  if (Ty->isIntegerTy() ? Ty->getPrimitiveSizeInBits() <= 32
+                        : Ty->isPointerTy()) {
+    writeOperand(V);
+    Out << " | 0";
+  } else if (Float32 && Ty->isFloatTy()) {
+    Out << "Math.fround(";
+    writeOperand(V);
+    Out << ')';
+  } else if (Ty->isFloatingPointTy() || Ty->isIntegerTy()) {
+    Out << "+";
+    writeOperand(V);
+  } else
+    writeOperand(V);
+}
+
 /// FindStaticTors - Given a static ctor/dtor list, unpack its contents into
 /// the StaticTors set.
 static void FindStaticTors(GlobalVariable *GV, std::set<Function*> &StaticTors){
@@ -1500,20 +3690,98 @@ static void PrintEscapedString(const std::string &Str, raw_ostream &Out) {
   PrintEscapedString(Str.c_str(), Str.size(), Out);
 }
 
+/// isExported - Return true if GV is published on the module object.
+static bool isExported(const GlobalValue *GV) {
+  return !GV->hasLocalLinkage() && !GV->hasHiddenVisibility();
+}
+
+/// JsProfilingFunctions - The functions that edge profiled code calls from main
+/// to register its counters, with the type of the record they are dumped as.
+namespace {
+  struct JsProfilingFunction {
+    const char *Name;
+    ProfilingType Type;
+  };
+}
+
+static const JsProfilingFunction JsProfilingFunctions[] = {
+  { "llvm_start_edge_profiling",     EdgeInfo },
+  { "llvm_start_opt_edge_profiling", OptEdgeInfo }
+};
+
+/// getProfileCounterArray - Return the global array that Ptr points to the
+/// start of, if it is an array of counters.
+static GlobalVariable *getProfileCounterArray(Value *Ptr) {
+  GlobalVariable *GV = dyn_cast<GlobalVariable>(Ptr->stripPointerCasts());
+  if (!GV || !GV->hasDefinitiveInitializer())
+    return 0;
+  const ArrayType *ATy = dyn_cast<ArrayType>(GV->getType()->getElementType());
+  return ATy && ATy->getElementType()->isIntegerTy(32) ? GV : 0;
+}
+
 bool JsWriter::doInitialization(Module &M) {
   FunctionPass::doInitialization(M);
   
   // Initialize
   TheModule = &M;
 
-  TD = new TargetData(&M);
+  if (HeapMemory)
+    // The heap is laid out like the target, whatever the module was compiled
+    // for, so that every double sits where $HEAPF64 can reach it.
+    TD = new TargetData(TargetLayout);
+  else
+    TD = new TargetData(&M);
   IL = new IntrinsicLowering(*TD);
   IL->AddPrototypes(M);
 
+  if (ProfileLayout)
+    ProfileKind = M.getContext().getMDKindID(ProfileMDName);
+  for (unsigned i = 0, e = array_lengthof(JsProfilingFunctions); i != e; ++i) {
+    Function *F = M.getFunction(JsProfilingFunctions[i].Name);
+    if (!F || !F->isDeclaration())
+      continue;
+    for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E;
+         ++UI) {
+      CallSite CS = CallSite::get(*UI);
+      if (CS.getInstruction() && CS.isCallee(UI) && CS.arg_size() == 4)
+        if (GlobalVariable *GV = getProfileCounterArray(CS.getArgument(2)))
+          ProfileCounters.insert(GV);
+    }
+  }
+
+  if (useCache()) {
+    sys::Path Dir(CacheDir);
+    std::string ErrorInfo;
+    if (!Dir.exists() && Dir.createDirectoryOnDisk(true, &ErrorInfo))
+      report_fatal_error("Cannot create the JS cache directory: " + ErrorInfo);
+  }
+
   TAsm = new CBEMCAsmInfo();
   TCtx = new MCContext(*TAsm);
   Mang = new Mangler(*TCtx, *TD);
 
+  // Unnamed globals are numbered by the mangler as they are first printed.
+  // Number them in module order instead, so that the numbers do not depend on
+  // the order the functions get printed in.
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
+    if (!I->hasName())
+      GetValueName(I);
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I)
+    if (!I->hasName())
+      GetValueName(I);
+
+  if (Minify) {
+    for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
+      GlobalNames.insert(GetValueName(I));
+    for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+         I != E; ++I)
+      GlobalNames.insert(GetValueName(I));
+    for (Module::alias_iterator I = M.alias_begin(), E = M.alias_end();
+         I != E; ++I)
+      GlobalNames.insert(GetValueName(I));
+  }
+
   if(M.getFunction("main")) {
     Out << "<!doctype html>\n";
     Out << "<html>\n";
@@ -1527,6 +3795,9 @@ bool JsWriter::doInitialization(Module &M) {
   Out << "$w[\"" << M.getModuleIdentifier() << "\"] = {};\n";
   Out << "var _ = $w[\"" << M.getModuleIdentifier() << "\"];\n";
 
+  if (needsRuntime(M))
+    printRuntime();
+
   // Keep track of which functions are static ctors/dtors so they can have
   // an attribute added to their prototypes.
   std::set<Function*> StaticCtors, StaticDtors;
@@ -1570,27 +3841,70 @@ bool JsWriter::doInitialization(Module &M) {
         << "/* End Module asm statements */\n";
   }
 
-  // Loop over the symbol table, emitting all named constants...
-  printModuleTypes(M.getTypeSymbolTable());
+  // Loop over the symbol table, emitting all named constants...
+  printModuleTypes(M.getTypeSymbolTable());
+
+  if (HeapMemory) {
+    assignFunctionTableIndices(M);
+    printHeapGlobals(M);
+  }
+
+  printI64Runtime(M);
+
+  // An unwind outside of a landing pad throws an exception of its own type.
+  bool HasUnwind = false;
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+      if (isa<UnwindInst>(BB->getTerminator()))
+        HasUnwind = true;
+  if (HasUnwind) {
+    printSectionHeader("Exceptions");
+    Out << "function $Unwind() {}\n";
+  }
+
+  // va_arg in the heap returns the address of the next slot of a va_list.
+  bool HasVAArg = false;
+  if (HeapMemory)
+    for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+      for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+        if (isa<VAArgInst>(*I))
+          HasVAArg = true;
+  if (HasVAArg) {
+    printSectionHeader("Variable Arguments");
+    Out << "function $va_arg(ap) {\n"
+        << "  var p = $HEAP32[ap >> 2];\n"
+        << "  $HEAP32[ap >> 2] = p + 8;\n"
+        << "  return p;\n"
+        << "}\n";
+  }
+  if (!HeapMemory)
+    printVarArgForwarders(M);
+
+  printProfilingRuntime(M);
+
+  if (HeapMemory)
+    printConstantPool(M);
 
   // Output the module-level locals
-  if (!M.global_empty()) {
+  if (!HeapMemory && !M.global_empty()) {
     Module::global_iterator I = M.global_begin(), E = M.global_end();
     bool Found = false;
     for(;I != E; ++I) {
-      if (!I->isDeclaration() && !getGlobalVariableClass(I) && (I->hasLocalLinkage() || I->hasHiddenVisibility())) {
-	Out << "\n/* Module Local Variables */\n";
+      if (!I->isDeclaration() && !getGlobalVariableClass(I) &&
+          (LocalBindings || !isExported(I))) {
+	printSectionHeader("Module Local Variables");
 	Out << "var " << GetValueName(I) << " = ";
-	writeOperand(I->getInitializer(), true);
+	printGlobalInitializer(I);
 	Found = true;
 	++I;
 	break;
       }
     }
     for (; I != E; ++I) {
-      if (!I->isDeclaration() && !getGlobalVariableClass(I) && (I->hasLocalLinkage() || I->hasHiddenVisibility())) {      
+      if (!I->isDeclaration() && !getGlobalVariableClass(I) &&
+          (LocalBindings || !isExported(I))) {      
 	Out << ", " << GetValueName(I) << " = ";
-	writeOperand(I->getInitializer(), true);
+	printGlobalInitializer(I);
 	continue;
       }
     }
@@ -1600,10 +3914,10 @@ bool JsWriter::doInitialization(Module &M) {
   }
   
   // Output the module members
-  if (!M.global_empty()) {
+  if (!HeapMemory && !M.global_empty()) {
     Module::global_iterator I = M.global_begin(), E = M.global_end();
     for(;I != E; ++I) {
-      if (!I->isDeclaration() && !getGlobalVariableClass(I) && !(I->hasLocalLinkage() || I->hasHiddenVisibility())) {
+      if (!I->isDeclaration() && !getGlobalVariableClass(I) && isExported(I)) {
 	if (I->hasDLLImportLinkage()) {
 	  // can't import from DLLs
 	  llvm_unreachable(0);
@@ -1616,17 +3930,21 @@ bool JsWriter::doInitialization(Module &M) {
 	  // no support for thread locals
 	  llvm_unreachable(0);
 	}
-	Out << "\n/* Module Members */\n";
-
-	Out << "_." << GetValueName(I) << " = ";
-	writeOperand(I->getInitializer(), true);
-	Out << ";\n";
+	printSectionHeader("Module Members");
+
+	if (LocalBindings) {
+	  printGlobalExport(I);
+	} else {
+	  Out << "_." << GetValueName(I) << " = ";
+	  printGlobalInitializer(I);
+	  Out << ";\n";
+	}
 	++I;
 	break;
       }
     }
     for (; I != E; ++I) {
-      if (!I->isDeclaration() && !getGlobalVariableClass(I) && !(I->hasLocalLinkage() || I->hasHiddenVisibility())) {
+      if (!I->isDeclaration() && !getGlobalVariableClass(I) && isExported(I)) {
 	if (I->hasDLLImportLinkage()) {
 	  // can't import from DLLs
 	  llvm_unreachable(0);
@@ -1640,23 +3958,693 @@ bool JsWriter::doInitialization(Module &M) {
 	  llvm_unreachable(0);
 	}
 
-	Out << "_." << GetValueName(I) << " = ";
-	writeOperand(I->getInitializer(), true);
-	Out << ";\n";
+	if (LocalBindings) {
+	  printGlobalExport(I);
+	} else {
+	  Out << "_." << GetValueName(I) << " = ";
+	  printGlobalInitializer(I);
+	  Out << ";\n";
+	}
 	continue;
       }
     }
   }
 
+  if (NamedMDNode *Chunks = M.getNamedMetadata(ChunksMDName))
+    if (splitChunks()) {
+      NumChunks = Chunks->getNumOperands();
+      for (unsigned i = 0; i != NumChunks; ++i) {
+        MDNode *Chunk = Chunks->getOperand(i);
+        for (unsigned j = 0, e = Chunk->getNumOperands(); j != e; ++j)
+          FunctionChunks[cast<Function>(Chunk->getOperand(j))] = i + 1;
+      }
+      if (NumChunks)
+        printChunkLoader();
+    }
+
   if (!M.empty()) {
-    Out << "\n/* Module Methods */\n";
+    printSectionHeader("Module Methods");
+  }
+  return false;
+}
+
+
+/// getFunctionTableName - Return the name of the function table for functions
+/// of type FTy.  Functions share a table when they agree on the JS types of
+/// their result and parameters.
+static std::string getFunctionTableName(const FunctionType *FTy) {
+  std::string Name = "$FT_";
+  for (unsigned i = 0, e = FTy->getNumParams() + 1; i != e; ++i) {
+    const Type *Ty = i ? FTy->getParamType(i - 1) : FTy->getReturnType();
+    if (Ty->isVoidTy())
+      Name += 'v';
+    else if (Ty->isFloatTy())
+      Name += 'f';
+    else if (Ty->isFloatingPointTy())
+      Name += 'd';
+    else if (Ty->isIntegerTy(64))
+      Name += 'j';
+    else if (Ty->isIntegerTy() || Ty->isPointerTy())
+      Name += 'i';
+    else
+      Name += 'o';
+  }
+  if (FTy->isVarArg())
+    Name += 'x';
+  return Name;
+}
+
+/// getFunctionTableSize - Return the number of entries of a table holding
+/// NumFunctions functions after the null entry.
+static unsigned getFunctionTableSize(unsigned NumFunctions) {
+  return 1U << Log2_32_Ceil(NumFunctions + 1);
+}
+
+/// isCalledOnly - Return true if every use of V calls it, possibly through a
+/// pointer cast.
+static bool isCalledOnly(const Value *V) {
+  for (Value::const_use_iterator UI = V->use_begin(), E = V->use_end();
+       UI != E; ++UI) {
+    const ConstantExpr *CE = dyn_cast<ConstantExpr>(*UI);
+    if (CE && CE->isCast()) {
+      if (!isCalledOnly(CE))
+        return false;
+      continue;
+    }
+    const Instruction *I = dyn_cast<Instruction>(*UI);
+    if (!I || !(isa<CallInst>(I) || isa<InvokeInst>(I)))
+      return false;
+    ImmutableCallSite CS(I);
+    if (!CS.isCallee(UI))
+      return false;
+  }
+  return true;
+}
+
+/// assignFunctionTableIndices - Give every function whose address is taken
+/// an index into the table for its signature.  Every signature that is called
+/// indirectly gets a table, even if it only holds the null entry.
+void JsWriter::assignFunctionTableIndices(Module &M) {
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I) {
+    for (inst_iterator II = inst_begin(I), IE = inst_end(I); II != IE; ++II) {
+      CallSite CS = CallSite::get(&*II);
+      if (!CS.getInstruction())
+        continue;
+      Value *Callee = CS.getCalledValue();
+      if (!isa<InlineAsm>(Callee) && !isa<Function>(Callee->stripPointerCasts()))
+        FunctionTables[getFunctionTableName(cast<FunctionType>(
+          cast<PointerType>(Callee->getType())->getElementType()))];
+    }
+    if (I->isIntrinsic() || isCalledOnly(I))
+      continue;
+    std::vector<const Function*> &Table =
+      FunctionTables[getFunctionTableName(I->getFunctionType())];
+    FunctionTableIndices[I] = Table.size() + 1;
+    Table.push_back(I);
+  }
+}
+
+/// printFunctionTables - Print the function tables.  They refer to the
+/// functions, so they come after the last one.
+void JsWriter::printFunctionTables() {
+  printSectionHeader("Function Tables");
+  Out << "function $badcall() { throw 'bad function pointer'; }\n";
+  for (std::map<std::string, std::vector<const Function*> >::iterator
+       I = FunctionTables.begin(), E = FunctionTables.end(); I != E; ++I) {
+    const std::vector<const Function*> &Table = I->second;
+    Out << "var " << I->first << " = [$badcall";
+    for (unsigned i = 0, e = Table.size(); i != e; ++i) {
+      // External functions are looked up when they are called, as they are
+      // for direct calls.  The variadic ones drop the buffer an indirect call
+      // passes and take the arguments it spreads after it, see printVarArgs.
+      Out << ", ";
+      if (isExternalVarArgFunction(Table[i]))
+        Out << "function() { var a = Array.prototype.slice.call(arguments); "
+            << "a.splice(" << Table[i]->getFunctionType()->getNumParams()
+            << ", 1); return " << GetValueName(Table[i])
+            << ".apply(null, a); }";
+      else if (Table[i]->isDeclaration())
+        Out << "function() { return " << GetValueName(Table[i])
+            << ".apply(null, arguments); }";
+      else
+        Out << (LocalBindings ? "" : "_.") << GetValueName(Table[i]);
+    }
+    for (unsigned i = Table.size() + 1, e = getFunctionTableSize(Table.size());
+         i != e; ++i)
+      Out << ", $badcall";
+    Out << "];\n";
+  }
+}
+
+/// printFunctionTableCall - Print the target of an indirect call through the
+/// function pointer Callee of type FTy.
+void JsWriter::printFunctionTableCall(Value *Callee, const FunctionType *FTy) {
+  std::map<std::string, std::vector<const Function*> >::const_iterator Table =
+    FunctionTables.find(getFunctionTableName(FTy));
+  assert(Table != FunctionTables.end() && "Indirect call without a table!");
+  Out << Table->first << '[';
+  writeOperand(Callee);
+  Out << " & " << getFunctionTableSize(Table->second.size()) - 1 << ']';
+}
+
+/// tableHasExternalVarArgs - Return true if the function table of FTy holds a
+/// variadic function of the JS environment.
+bool JsWriter::tableHasExternalVarArgs(const FunctionType *FTy) const {
+  std::map<std::string, std::vector<const Function*> >::const_iterator Table =
+    FunctionTables.find(getFunctionTableName(FTy));
+  if (Table == FunctionTables.end())
+    return false;
+  for (unsigned i = 0, e = Table->second.size(); i != e; ++i)
+    if (isExternalVarArgFunction(Table->second[i]))
+      return true;
+  return false;
+}
+
+/// printVarArgForwarders - Without the heap a pointer to a variadic function
+/// of the JS environment is a forwarder, which spreads the buffer an
+/// indirect call passes into separate arguments.
+void JsWriter::printVarArgForwarders(Module &M) {
+  bool Found = false;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!isExternalVarArgFunction(F) || isCalledOnly(F))
+      continue;
+    if (!Found)
+      printSectionHeader("Variable Argument Forwarders");
+    Found = true;
+    unsigned NumParams = F->getFunctionType()->getNumParams();
+    Out << "function " << GetValueName(F) << "$va() {\n"
+        << "  var a = Array.prototype.slice.call(arguments, 0, " << NumParams
+        << ");\n"
+        << "  return " << GetValueName(F) << ".apply(null, a.concat(arguments["
+        << NumParams << "]));\n"
+        << "}\n";
+  }
+}
+
+/// printHeapGlobals - Allocate the typed array heap, give every defined global
+/// variable a fixed address in it and copy the initializers into place.
+void JsWriter::printHeapGlobals(Module &M) {
+  std::vector<GlobalVariable*> Globals;
+  uint64_t Addr = HeapStaticBase;
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I) {
+    if (I->isDeclaration() || getGlobalVariableClass(I))
+      continue;
+    if (I->isThreadLocal())
+      report_fatal_error("Thread local globals are not supported by the "
+                         "Javascript backend.");
+    Addr = RoundUpToAlignment(Addr, TD->getPreferredAlignment(I));
+    GlobalAddresses[I] = Addr;
+    Addr += TD->getTypeAllocSize(I->getType()->getElementType());
+    Globals.push_back(I);
+  }
+  uint64_t StackBase = RoundUpToAlignment(Addr, HeapStackAlign);
+  if (StackBase >= HeapSize)
+    report_fatal_error("Static data does not fit in the Javascript heap, "
+                       "use a larger -js-heap-size.");
+
+  printSectionHeader("Heap");
+  Out << "var $HEAP = new ArrayBuffer(" << RoundUpToAlignment(HeapSize, 8)
+      << ");\n";
+  Out << "var $HEAP8 = new Int8Array($HEAP), $HEAPU8 = new Uint8Array($HEAP),\n"
+      << "    $HEAP16 = new Int16Array($HEAP), "
+      << "$HEAPU16 = new Uint16Array($HEAP),\n"
+      << "    $HEAP32 = new Int32Array($HEAP), "
+      << "$HEAPU32 = new Uint32Array($HEAP),\n"
+      << "    $HEAPF32 = new Float32Array($HEAP), "
+      << "$HEAPF64 = new Float64Array($HEAP);\n";
+  Out << "var $STACKTOP = " << StackBase << ";\n";
+
+  if (Globals.empty())
+    return;
+
+  // Globals are bound to their address, so that code can refer to them by
+  // name.  Externally visible ones are published on the module object too.
+  printSectionHeader("Module Local Variables");
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i)
+    Out << (i ? ", " : "var ") << GetValueName(Globals[i]) << " = "
+        << GlobalAddresses[Globals[i]];
+  Out << ";\n";
+
+  bool Found = false;
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    GlobalVariable *GV = Globals[i];
+    if (!isExported(GV))
+      continue;
+    if (!Found)
+      printSectionHeader("Module Members");
+    Found = true;
+    printGlobalExport(GV);
+  }
+
+  // Large initializers are copied out of a single data segment, which is much
+  // cheaper to parse than array literals.  The segment spans the static data
+  // from the first large initializer to the end of the last one.
+  std::vector<std::vector<unsigned char> > Bytes(Globals.size());
+  std::vector<std::vector<std::pair<uint64_t, Constant*> > >
+    Fixups(Globals.size());
+  uint64_t SegmentBegin = StackBase, SegmentEnd = 0;
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    getConstantBytes(Globals[i]->getInitializer(), 0, Bytes[i], Fixups[i]);
+    // The heap starts out zeroed, so trailing zeros need no copy.
+    while (!Bytes[i].empty() && Bytes[i].back() == 0)
+      Bytes[i].pop_back();
+    if (Bytes[i].empty() || Bytes[i].size() < DataSegmentThreshold)
+      continue;
+    uint64_t Addr = GlobalAddresses[Globals[i]];
+    SegmentBegin = std::min(SegmentBegin, Addr);
+    SegmentEnd = std::max(SegmentEnd, Addr + Bytes[i].size());
+  }
+
+  printSectionHeader("Static Data");
+  if (SegmentEnd) {
+    std::vector<unsigned char> Segment(SegmentEnd - SegmentBegin);
+    for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+      if (Bytes[i].size() < DataSegmentThreshold)
+        continue;
+      std::copy(Bytes[i].begin(), Bytes[i].end(), Segment.begin() +
+                (GlobalAddresses[Globals[i]] - SegmentBegin));
+      Bytes[i].clear();
+    }
+    printDataSegment(Segment, SegmentBegin);
+  }
+
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    GlobalVariable *GV = Globals[i];
+    if (!Bytes[i].empty()) {
+      Out << "$HEAPU8.set([";
+      for (unsigned b = 0, be = Bytes[i].size(); b != be; ++b)
+        Out << (b ? "," : "") << (unsigned)Bytes[i][b];
+      Out << "], " << GetValueName(GV) << ");\n";
+    }
+
+    // Pointers that have no address in the heap are stored at load time.
+    for (unsigned f = 0, fe = Fixups[i].size(); f != fe; ++f) {
+      Out << "$HEAP32[(" << GetValueName(GV);
+      if (Fixups[i][f].first)
+        Out << " + " << Fixups[i][f].first;
+      Out << ") >> 2] = ";
+      printConstant(Fixups[i][f].second, true);
+      Out << ";\n";
+    }
+  }
+}
+
+/// printDataSegment - Print the code that copies Data to heap address Addr,
+/// decoding it from a base64 string in one pass.
+void JsWriter::printDataSegment(const std::vector<unsigned char> &Data,
+                                uint64_t Addr) {
+  static const char Base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  Out << "$HEAPU8.set((function(s) {\n"
+      << "  var n = s.length, t = new Uint8Array(128), i, j = 0, v;\n"
+      << "  var b = new Uint8Array(n / 4 * 3 - (s.charAt(n - 1) == '=') -\n"
+      << "                         (s.charAt(n - 2) == '='));\n"
+      << "  for (i = 0; i < 64; i++)\n"
+      << "    t[\"" << Base64 << "\".charCodeAt(i)] = i;\n"
+      << "  for (i = 0; i < n; i += 4) {\n"
+      << "    v = t[s.charCodeAt(i)] << 18 | t[s.charCodeAt(i + 1)] << 12 |\n"
+      << "        t[s.charCodeAt(i + 2)] << 6 | t[s.charCodeAt(i + 3)];\n"
+      << "    b[j++] = v >> 16;\n"
+      << "    if (j < b.length) b[j++] = v >> 8;\n"
+      << "    if (j < b.length) b[j++] = v;\n"
+      << "  }\n"
+      << "  return b;\n"
+      << "})(\"";
+  for (unsigned i = 0, e = Data.size(); i < e; i += 3) {
+    unsigned V = Data[i] << 16;
+    if (i + 1 < e) V |= Data[i + 1] << 8;
+    if (i + 2 < e) V |= Data[i + 2];
+    Out << Base64[V >> 18] << Base64[(V >> 12) & 63]
+        << (i + 1 < e ? Base64[(V >> 6) & 63] : '=')
+        << (i + 2 < e ? Base64[V & 63] : '=');
+  }
+  Out << "\"), " << Addr << ");\n";
+}
+
+/// printConstantPool - Number the struct and array constants that the
+/// functions of M use as operands, and print each of them once.  The
+/// instructions that take aggregates apart read the elements of a zero
+/// aggregate as they are, so it only needs an array elsewhere.
+void JsWriter::printConstantPool(Module &M) {
+  std::vector<Constant*> ConstantPool;
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    if (F->hasAvailableExternallyLinkage())
+      continue;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+        Constant *C = dyn_cast<Constant>(I->getOperand(i));
+        if (!C || (!isa<ConstantArray>(C) && !isa<ConstantStruct>(C) &&
+                   !isa<ConstantAggregateZero>(C)) ||
+            (!C->getType()->isStructTy() && !C->getType()->isArrayTy()))
+          continue;
+        if (isa<ConstantAggregateZero>(C) &&
+            (isa<InsertValueInst>(*I) || isa<ExtractValueInst>(*I) ||
+             isa<ReturnInst>(*I)))
+          continue;
+        if (PooledConstants.count(C)) {
+          ++NumPooledReuses;
+          continue;
+        }
+        PooledConstants[C] = ConstantPool.size();
+        ConstantPool.push_back(C);
+        NumPooledBytes += TD->getTypeAllocSize(C->getType());
+      }
+  }
+  if (ConstantPool.empty())
+    return;
+
+  printSectionHeader("Constant Pool");
+  for (unsigned i = 0, e = ConstantPool.size(); i != e; ++i) {
+    Out << "var $C" << i << " = ";
+    printConstant(ConstantPool[i], false);
+    Out << ";\n";
+  }
+}
+
+/// isFPIntBitCast - Return true if I reinterprets a float as an i32 or a
+/// double as an i64, or the other way around.
+static inline bool isFPIntBitCast(const Instruction &I) {
+  if (!isa<BitCastInst>(I))
+    return false;
+  const Type *SrcTy = I.getOperand(0)->getType();
+  const Type *DstTy = I.getType();
+  return ((SrcTy->isFloatTy() || SrcTy->isDoubleTy()) &&
+          DstTy->isIntegerTy()) ||
+         ((DstTy->isFloatTy() || DstTy->isDoubleTy()) && SrcTy->isIntegerTy());
+}
+
+/// printI64Runtime - Print the helpers that the i64 legalization calls for
+/// division.  The high word of the result is returned through __js_i64_hi.
+/// The division itself is done by the runtime.
+void JsWriter::printI64Runtime(Module &M) {
+  Function *UDivMod = M.getFunction("__js_i64_udivmod");
+  Function *SDivMod = M.getFunction("__js_i64_sdivmod");
+  if (!UDivMod && !SDivMod)
+    return;
+
+  std::string Hi = "$HEAP32[" + GetValueName(M.getNamedGlobal("__js_i64_hi")) +
+                   " >> 2]";
+  printSectionHeader("i64 Runtime");
+  for (unsigned Signed = 0; Signed != 2; ++Signed) {
+    if (!(Signed ? SDivMod : UDivMod))
+      continue;
+    const char *Name = Signed ? "sdivmod" : "udivmod";
+    Out << "function __js_i64_" << Name << "(alo, ahi, blo, bhi, rem) {\n"
+        << "  var lo = $rt." << Name << "64(alo, ahi, blo, bhi, rem);\n"
+        << "  " << Hi << " = $rt.hi;\n"
+        << "  return lo;\n"
+        << "}\n";
+  }
+}
+
+/// needsRuntime - Return true if the code printed for M calls into the
+/// runtime support library.
+bool JsWriter::needsRuntime(Module &M) {
+  if (M.getFunction("__js_i64_udivmod") || M.getFunction("__js_i64_sdivmod"))
+    return true;
+
+  SmallPtrSet<const Constant*, 16> Visited;
+  SmallVector<const Constant*, 16> Worklist;
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I)
+    if (I->hasInitializer())
+      Worklist.push_back(I->getInitializer());
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      if (isFPIntBitCast(*I))
+        return true;
+      if (CheckedDivision && I->getType()->isIntegerTy(32) &&
+          (I->getOpcode() == Instruction::UDiv ||
+           I->getOpcode() == Instruction::SDiv ||
+           I->getOpcode() == Instruction::URem ||
+           I->getOpcode() == Instruction::SRem))
+        return true;
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+        if (const Constant *C = dyn_cast<Constant>(I->getOperand(i)))
+          Worklist.push_back(C);
+    }
+
+  // Floating point comparisons that are constant expressions call the
+  // runtime.
+  while (!Worklist.empty()) {
+    const Constant *C = Worklist.pop_back_val();
+    if (isa<GlobalValue>(C) || !Visited.insert(C))
+      continue;
+    if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(C))
+      if (CE->getOpcode() == Instruction::FCmp &&
+          CE->getPredicate() != FCmpInst::FCMP_FALSE &&
+          CE->getPredicate() != FCmpInst::FCMP_TRUE)
+        return true;
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i)
+      Worklist.push_back(cast<Constant>(C->getOperand(i)));
   }
   return false;
 }
 
+/// printRuntime - Bind '$rt' to the runtime support library, defining it
+/// unless -js-external-runtime says that the page already has.  Every module
+/// that defines it does so under the same versioned name, and only the first
+/// one loaded builds it.  The scratch arrays assume a little endian host.
+void JsWriter::printRuntime() {
+  printSectionHeader("Runtime");
+  Out << "var $rt = $w[\"" << JsRuntimeName << "\"]";
+  if (ExternalRuntime) {
+    Out << ";\n";
+    return;
+  }
+  Out << " || ($w[\"" << JsRuntimeName << "\"] = (function() {\n"
+      << "  var f64 = new Float64Array(1), f32 = new Float32Array(f64.buffer),\n"
+      << "      i32 = new Int32Array(f64.buffer);\n"
+      << "  function div0() {\n"
+      << "    throw new RangeError(\"integer division by zero\");\n"
+      << "  }\n"
+      << "  var rt = {\n"
+      << "    hi: 0,\n"
+      // Unordered comparisons are true if either operand is NaN, which every
+      // ordered JS comparison is false for.
+      << "    fcmp_ord: function(a, b) { return a == a && b == b; },\n"
+      << "    fcmp_uno: function(a, b) { return a != a || b != b; },\n"
+      << "    fcmp_ueq: function(a, b) { return !(a < b || a > b); },\n"
+      << "    fcmp_une: function(a, b) { return a != b; },\n"
+      << "    fcmp_ult: function(a, b) { return !(a >= b); },\n"
+      << "    fcmp_ule: function(a, b) { return !(a > b); },\n"
+      << "    fcmp_ugt: function(a, b) { return !(a <= b); },\n"
+      << "    fcmp_uge: function(a, b) { return !(a < b); },\n"
+      << "    fcmp_oeq: function(a, b) { return a == b; },\n"
+      << "    fcmp_one: function(a, b) { return a < b || a > b; },\n"
+      << "    fcmp_olt: function(a, b) { return a < b; },\n"
+      << "    fcmp_ole: function(a, b) { return a <= b; },\n"
+      << "    fcmp_ogt: function(a, b) { return a > b; },\n"
+      << "    fcmp_oge: function(a, b) { return a >= b; },\n"
+      // i64 values outside the heap are doubles.
+      << "    f32_bits: function(x) { f32[0] = x; return i32[0]; },\n"
+      << "    bits_f32: function(x) { i32[0] = x; return f32[0]; },\n"
+      << "    f64_bits: function(x) {\n"
+      << "      f64[0] = x;\n"
+      << "      return i32[1] * 4294967296 + (i32[0] >>> 0);\n"
+      << "    },\n"
+      << "    bits_f64: function(x) {\n"
+      << "      i32[0] = x;\n"
+      << "      i32[1] = Math.floor(x / 4294967296);\n"
+      << "      return f64[0];\n"
+      << "    },\n"
+      << "    udiv: function(a, b) {\n"
+      << "      if (!(b >>>= 0)) div0();\n"
+      << "      return (a >>> 0) / b >>> 0;\n"
+      << "    },\n"
+      << "    sdiv: function(a, b) {\n"
+      << "      if (!(b |= 0)) div0();\n"
+      << "      return (a | 0) / b | 0;\n"
+      << "    },\n"
+      << "    urem: function(a, b) {\n"
+      << "      if (!(b >>>= 0)) div0();\n"
+      << "      return (a >>> 0) % b >>> 0;\n"
+      << "    },\n"
+      << "    srem: function(a, b) {\n"
+      << "      if (!(b |= 0)) div0();\n"
+      << "      return (a | 0) % b | 0;\n"
+      << "    },\n"
+      // Shift and subtract long division of i64 words, with a fast path for
+      // 32-bit values.  The high word of the result is left in hi.
+      << "    udivmod64: function(alo, ahi, blo, bhi, rem) {\n"
+      << "      var qlo = 0, qhi = 0, rlo = 0, rhi = 0, i, c, t;\n"
+      << "      if (!ahi && !bhi) {\n"
+      << "        rt.hi = 0;\n"
+      << "        return (rem ? (alo >>> 0) % (blo >>> 0)\n"
+      << "                    : (alo >>> 0) / (blo >>> 0)) | 0;\n"
+      << "      }\n"
+      << "      for (i = 63; i >= 0; i--) {\n"
+      << "        c = rhi >>> 31;\n"
+      << "        rhi = rhi << 1 | rlo >>> 31;\n"
+      << "        rlo = rlo << 1 | (i >= 32 ? ahi >>> i - 32 : alo >>> i) & 1;\n"
+      << "        if (c || (rhi >>> 0) > (bhi >>> 0) ||\n"
+      << "            rhi == bhi && (rlo >>> 0) >= (blo >>> 0)) {\n"
+      << "          t = (rlo >>> 0) < (blo >>> 0);\n"
+      << "          rlo = rlo - blo | 0;\n"
+      << "          rhi = rhi - bhi - t | 0;\n"
+      << "          if (i >= 32) qhi |= 1 << i - 32; else qlo |= 1 << i;\n"
+      << "        }\n"
+      << "      }\n"
+      << "      rt.hi = rem ? rhi : qhi;\n"
+      << "      return rem ? rlo : qlo;\n"
+      << "    },\n"
+      // Divide the magnitudes, the remainder takes the sign of the dividend.
+      << "    sdivmod64: function(alo, ahi, blo, bhi, rem) {\n"
+      << "      var neg = 0, lo;\n"
+      << "      if (ahi < 0) { alo = -alo | 0; ahi = ~ahi + !alo | 0; neg = 1; }\n"
+      << "      if (bhi < 0) { blo = -blo | 0; bhi = ~bhi + !blo | 0;"
+      << " if (!rem) neg ^= 1; }\n"
+      << "      lo = rt.udivmod64(alo, ahi, blo, bhi, rem);\n"
+      << "      if (neg) { lo = -lo | 0; rt.hi = ~rt.hi + !lo | 0; }\n"
+      << "      return lo;\n"
+      << "    }\n"
+      << "  };\n"
+      << "  return rt;\n"
+      << "})());\n";
+}
+
+/// printChunkLoader - Print '$load', which fetches and evaluates the chunk
+/// numbered by its argument the first time it is called.  The stubs return
+/// what the loaded function returns, so the chunk is fetched synchronously,
+/// and it is evaluated in the scope of the module so that it sees the module
+/// locals.  The names of the loader locals can not be taken by functions.
+void JsWriter::printChunkLoader() {
+  printSectionHeader("Chunks");
+  Out << "var $loaded = [];\n"
+      << "function $load($chunk) {\n"
+      << "  if ($loaded[$chunk])\n"
+      << "    return;\n"
+      << "  var $url = \"";
+  PrintEscapedString(sys::Path(ChunkPrefix).getLast(), Out);
+  Out << ".\" + $chunk + \".js\", $src;\n"
+      << "  if (typeof XMLHttpRequest != \"undefined\") {\n"
+      << "    var $xhr = new XMLHttpRequest();\n"
+      << "    $xhr.open(\"GET\", $url, false);\n"
+      << "    $xhr.send(null);\n"
+      << "    $src = $xhr.responseText;\n"
+      << "  } else {\n"
+      << "    $src = require(\"fs\").readFileSync($url, \"utf8\");\n"
+      << "  }\n"
+      << "  eval($src);\n"
+      << "  $loaded[$chunk] = true;\n"
+      << "}\n";
+}
+
+/// printChunkStub - Print the stub that stands in for F, which is printed to
+/// a chunk, until the chunk is loaded.  Outside the heap it stands in for F
+/// for good, see FunctionChunks.
+void JsWriter::printChunkStub(const Function *F) {
+  std::string Name = GetValueName(F);
+  std::string Ref = (LocalBindings ? "" : "_.") + Name;
+  Out << "\n" << (LocalBindings ? "function " : Ref + " = function ") << Name
+      << "() { $load(" << FunctionChunks.lookup(F) << "); return "
+      << (HeapMemory ? Ref : Name + ".$body") << ".apply(this, arguments); }";
+  if (!LocalBindings)
+    Out << ";";
+  Out << "\n";
+  if (LocalBindings && isExported(F))
+    Out << "_." << Name << " = " << Name << ";\n";
+  Out << "\n";
+}
+
+/// evaluateAddress - If C is a pointer with a known heap address, set Addr to
+/// it and return true.
+bool JsWriter::evaluateAddress(Constant *C, uint64_t &Addr) {
+  if (isa<ConstantPointerNull>(C)) {
+    Addr = 0;
+    return true;
+  }
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(C)) {
+    DenseMap<const GlobalVariable*, uint64_t>::iterator I =
+      GlobalAddresses.find(GV);
+    if (I == GlobalAddresses.end())
+      return false;
+    Addr = I->second;
+    return true;
+  }
+  ConstantExpr *CE = dyn_cast<ConstantExpr>(C);
+  if (!CE)
+    return false;
+  switch (CE->getOpcode()) {
+  case Instruction::BitCast:
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+    return evaluateAddress(CE->getOperand(0), Addr);
+  case Instruction::GetElementPtr: {
+    SmallVector<Value*, 8> Indices(CE->op_begin()+1, CE->op_end());
+    for (unsigned i = 0, e = Indices.size(); i != e; ++i)
+      if (!isa<ConstantInt>(Indices[i]))
+        return false;
+    if (!evaluateAddress(CE->getOperand(0), Addr))
+      return false;
+    Addr += TD->getIndexedOffset(CE->getOperand(0)->getType(),
+                                 Indices.data(), Indices.size());
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+/// getConstantBytes - Write the little endian memory image of C to Bytes,
+/// starting at Offset.  Pointers whose address is not known at compile time
+/// are recorded in Fixups instead.
+void JsWriter::getConstantBytes(Constant *C, uint64_t Offset,
+                      std::vector<unsigned char> &Bytes,
+                      std::vector<std::pair<uint64_t, Constant*> > &Fixups) {
+  const Type *Ty = C->getType();
+  uint64_t Size = TD->getTypeAllocSize(Ty);
+  if (Bytes.size() < Offset + Size)
+    Bytes.resize(Offset + Size);
+  if (C->isNullValue() || isa<UndefValue>(C))
+    return;
+
+  if (const ConstantArray *CA = dyn_cast<ConstantArray>(C)) {
+    uint64_t EltSize = TD->getTypeAllocSize(CA->getType()->getElementType());
+    for (unsigned i = 0, e = CA->getNumOperands(); i != e; ++i)
+      getConstantBytes(CA->getOperand(i), Offset + i*EltSize, Bytes, Fixups);
+    return;
+  }
+  if (const ConstantVector *CV = dyn_cast<ConstantVector>(C)) {
+    uint64_t EltSize = TD->getTypeAllocSize(CV->getType()->getElementType());
+    for (unsigned i = 0, e = CV->getNumOperands(); i != e; ++i)
+      getConstantBytes(CV->getOperand(i), Offset + i*EltSize, Bytes, Fixups);
+    return;
+  }
+  if (const ConstantStruct *CS = dyn_cast<ConstantStruct>(C)) {
+    const StructLayout *SL = TD->getStructLayout(CS->getType());
+    for (unsigned i = 0, e = CS->getNumOperands(); i != e; ++i)
+      getConstantBytes(CS->getOperand(i), Offset + SL->getElementOffset(i),
+                       Bytes, Fixups);
+    return;
+  }
+  if (Ty->isUnionTy()) {
+    getConstantBytes(cast<Constant>(C->getOperand(0)), Offset, Bytes, Fixups);
+    return;
+  }
+
+  APInt Val;
+  uint64_t Addr;
+  if (const ConstantInt *CI = dyn_cast<ConstantInt>(C))
+    Val = CI->getValue();
+  else if (const ConstantFP *CFP = dyn_cast<ConstantFP>(C))
+    Val = CFP->getValueAPF().bitcastToAPInt();
+  else if (evaluateAddress(C, Addr))
+    Val = APInt(TD->getTypeSizeInBits(Ty), Addr);
+  else {
+    Fixups.push_back(std::make_pair(Offset, C));
+    return;
+  }
+  // Types like i1 are narrower than the bytes they are stored in.
+  unsigned StoreSize = TD->getTypeStoreSize(Ty);
+  Val.zextOrTrunc(8*StoreSize);
+  for (unsigned i = 0; i != StoreSize; ++i)
+    Bytes[Offset+i] = Val.lshr(8*i).getLoBits(8).getZExtValue();
+}
 
 /// Output all floating point constants that cannot be printed accurately...
-void JsWriter::printFloatingPointConstants(Function &F) {
+void JsWriter::printFloatingPointConstants(raw_ostream &Out, Function &F) {
   // Scan the module for floating point constants.  If any FP constant is used
   // in the function, we want to redirect it here so that we do not depend on
   // the precision of the printed form, unless the printed form preserves
@@ -1664,16 +4652,17 @@ void JsWriter::printFloatingPointConstants(Function &F) {
   //
   for (constant_iterator I = constant_begin(&F), E = constant_end(&F);
        I != E; ++I)
-    printFloatingPointConstants(*I);
+    printFloatingPointConstants(Out, *I);
 
   Out << '\n';
 }
 
-void JsWriter::printFloatingPointConstants(const Constant *C) {
+void JsWriter::printFloatingPointConstants(raw_ostream &Out,
+                                           const Constant *C) {
   // If this is a constant expression, recursively check for constant fp values.
   if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(C)) {
     for (unsigned i = 0, e = CE->getNumOperands(); i != e; ++i)
-      printFloatingPointConstants(CE->getOperand(i));
+      printFloatingPointConstants(Out, CE->getOperand(i));
     return;
   }
     
@@ -1725,6 +4714,594 @@ void JsWriter::printFloatingPointConstants(const Constant *C) {
 
 
 
+/// numberAnonymousValues - Number the unnamed arguments, blocks and values of
+/// F in order.
+void JsWriter::numberAnonymousValues(Function &F) {
+  for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+       AI != AE; ++AI)
+    if (!AI->hasName())
+      GetValueName(AI);
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    if (!BB->hasName())
+      GetValueName(BB);
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+      if (!I->hasName() && !I->getType()->isVoidTy())
+        GetValueName(I);
+  }
+}
+
+/// JsReservedNames - Reserved words, and the global names the printed code
+/// refers to, which locals must not be called.
+static const char *const JsReservedNames[] = {
+  "Array", "ArrayBuffer", "Float32Array", "Float64Array", "Infinity",
+  "Int16Array", "Int32Array", "Int8Array", "Math", "NaN", "Uint16Array",
+  "Uint32Array", "Uint8Array", "arguments", "break", "case", "catch", "class",
+  "const", "continue", "debugger", "default", "delete", "do", "else", "enum",
+  "eval", "export", "extends", "false", "finally", "for", "function", "if",
+  "implements", "import", "in", "instanceof", "interface", "let", "new",
+  "null", "package", "private", "protected", "public", "return", "static",
+  "super", "switch", "this", "throw", "true", "try", "typeof", "undefined",
+  "var", "void", "while", "window", "with", "yield"
+};
+
+/// getMinifiedName - Return the shortest unused name, counting from Next.
+std::string JsWriter::getMinifiedName(unsigned &Next) {
+  static const char Chars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  while (true) {
+    // Names never contain '_' or '$', which the writer's own names use.
+    unsigned N = Next++;
+    std::string Name(1, Chars[N % 52]);
+    for (N /= 52; N; N /= 62)
+      Name += Chars[--N % 62];
+
+    bool Reserved = GlobalNames.count(Name);
+    for (unsigned i = 0, e = array_lengthof(JsReservedNames);
+         i != e && !Reserved; ++i)
+      Reserved = Name == JsReservedNames[i];
+    if (!Reserved)
+      return Name;
+  }
+}
+
+static bool hasMoreReferences(const std::pair<unsigned, const Value*> &A,
+                              const std::pair<unsigned, const Value*> &B) {
+  return A.first > B.first;
+}
+
+/// assignMinifiedNames - With -js-minify, name the arguments, locals and
+/// labels of F by their number of references, most referenced first.  Labels
+/// live in their own namespace and are counted separately.
+void JsWriter::assignMinifiedNames(Function &F) {
+  MinifiedNames.clear();
+  if (!Minify)
+    return;
+
+  std::vector<std::pair<unsigned, const Value*> > Locals;
+  DenseMap<const Value*, unsigned> LocalIndex;
+  for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+       AI != AE; ++AI) {
+    LocalIndex[AI] = Locals.size();
+    Locals.push_back(std::make_pair(AI->getNumUses() + 1, AI));
+  }
+  for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I) {
+    if (!isDirectAlloca(&*I) && (I->getType()->isVoidTy() ||
+                                 isInlinableInst(*I)))
+      continue;
+    const Value *Var = getLocalVariable(&*I);
+    std::pair<DenseMap<const Value*, unsigned>::iterator, bool> Ins =
+      LocalIndex.insert(std::make_pair(Var, Locals.size()));
+    if (Ins.second)
+      Locals.push_back(std::make_pair(0, Var));
+    Locals[Ins.first->second].first += I->getNumUses() + 1;
+  }
+
+  std::vector<std::pair<unsigned, const Value*> > Labels;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    Labels.push_back(std::make_pair(BB->getNumUses(), BB));
+
+  // Ties keep their order in the function.
+  std::stable_sort(Locals.begin(), Locals.end(), hasMoreReferences);
+  std::stable_sort(Labels.begin(), Labels.end(), hasMoreReferences);
+
+  unsigned Next = 0;
+  for (unsigned i = 0, e = Locals.size(); i != e; ++i)
+    MinifiedNames[Locals[i].second] = getMinifiedName(Next);
+  Next = 0;
+  for (unsigned i = 0, e = Labels.size(); i != e; ++i)
+    MinifiedNames[Labels[i].second] = getMinifiedName(Next);
+}
+
+/// computeStructLayouts - Compute the layout of every struct type F refers to.
+/// TargetData caches struct layouts as they are asked for, which must not
+/// happen on the worker threads.
+void JsWriter::computeStructLayouts(Function &F) {
+  SmallPtrSet<const Type*, 16> Visited;
+  SmallPtrSet<const Value*, 16> Seen;
+  SmallVector<const Value*, 16> Worklist;
+  for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+       AI != AE; ++AI)
+    Worklist.push_back(AI);
+  for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I)
+    Worklist.push_back(&*I);
+
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    computeStructLayouts(V->getType(), Visited);
+    // Constant expressions may refer to types that no value of F has.
+    const User *U = dyn_cast<User>(V);
+    if (!U || isa<GlobalValue>(U))
+      continue;
+    for (unsigned i = 0, e = U->getNumOperands(); i != e; ++i) {
+      const Value *Op = U->getOperand(i);
+      if (isa<Constant>(Op) && Seen.insert(Op))
+        Worklist.push_back(Op);
+      else if (!isa<Constant>(Op))
+        computeStructLayouts(Op->getType(), Visited);
+    }
+  }
+}
+
+void JsWriter::computeStructLayouts(const Type *Ty,
+                                    SmallPtrSet<const Type*, 16> &Visited) {
+  if (!Visited.insert(Ty))
+    return;
+  if (const StructType *STy = dyn_cast<StructType>(Ty))
+    if (STy->isSized())
+      TD->getStructLayout(STy);
+  for (Type::subtype_iterator I = Ty->subtype_begin(), E = Ty->subtype_end();
+       I != E; ++I)
+    computeStructLayouts(*I, Visited);
+}
+
+/// printDeferredFunctions - Print the bodies of the deferred functions on the
+/// worker threads, and write them out in module order.
+void JsWriter::printDeferredFunctions() {
+  unsigned NumWorkers = std::min<unsigned>(std::max<unsigned>(EmitThreads, 1),
+                                           DeferredFunctions.size());
+  bool StartedThreads = false;
+#if defined(LLVM_MULTITHREADED) && defined(HAVE_PTHREAD_H)
+  if (NumWorkers > 1 && !llvm_is_multithreaded())
+    StartedThreads = llvm_start_multithreaded();
+  if (!llvm_is_multithreaded())
+    NumWorkers = 1;
+#else
+  NumWorkers = 1;
+#endif
+
+  if (!SourceMapFile.empty())
+    DeferredSourceMappings.resize(DeferredFunctions.size());
+
+  std::vector<JsWriterWorker*> Workers;
+  for (unsigned i = 0; i != NumWorkers; ++i)
+    Workers.push_back(new JsWriterWorker(*this));
+  NextDeferredFunction = 0;
+
+  // The current thread is the first worker.
+#if defined(LLVM_MULTITHREADED) && defined(HAVE_PTHREAD_H)
+  std::vector<pthread_t> Threads;
+  for (unsigned i = 1; i != NumWorkers; ++i) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, 0, runDeferredFunctionQueue, Workers[i]) == 0)
+      Threads.push_back(Thread);
+  }
+  runDeferredFunctionQueue(Workers[0]);
+  for (unsigned i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], 0);
+#else
+  runDeferredFunctionQueue(Workers[0]);
+#endif
+
+  if (StartedThreads)
+    llvm_stop_multithreaded();
+
+  for (unsigned i = 0; i != NumWorkers; ++i) {
+    LocalsBefore += Workers[i]->Writer.LocalsBefore;
+    LocalsAfter += Workers[i]->Writer.LocalsAfter;
+    delete Workers[i];
+  }
+  if (!DeferredCache.empty())
+    storeCachedFunctions();
+  // The functions of a chunk are followed by the updates of the function
+  // tables, which hold their stubs.
+  std::vector<std::string> Chunks(NumChunks), ChunkTableUpdates(NumChunks);
+  for (unsigned i = 0, e = DeferredFunctions.size(); i != e; ++i) {
+    const Function *F = DeferredFunctions[i].first;
+    if (unsigned Chunk = FunctionChunks.lookup(F)) {
+      Chunks[Chunk - 1] += DeferredFunctions[i].second;
+      printChunkStub(F);
+      if (unsigned Index = FunctionTableIndices.lookup(F))
+        raw_string_ostream(ChunkTableUpdates[Chunk - 1])
+          << getFunctionTableName(F->getFunctionType()) << '[' << Index
+          << "] = " << (LocalBindings ? "" : "_.") << GetValueName(F)
+          << ";\n";
+      continue;
+    }
+    unsigned Line = Positions.getLine(), Column = Positions.getColumn();
+    Out << DeferredFunctions[i].second;
+    if (SourceMapFile.empty())
+      continue;
+    std::vector<SourceMapping> &Mappings = DeferredSourceMappings[i];
+    for (unsigned m = 0, me = Mappings.size(); m != me; ++m) {
+      if (Mappings[m].Line == 0)
+        Mappings[m].Column += Column;
+      Mappings[m].Line += Line;
+      SourceMappings.push_back(Mappings[m]);
+    }
+  }
+  for (unsigned i = 0; i != NumChunks; ++i) {
+    std::string ErrorInfo;
+    std::string File = ChunkPrefix + "." + utostr(i + 1) + ".js";
+    raw_fd_ostream ChunkOut(File.c_str(), ErrorInfo);
+    if (!ErrorInfo.empty())
+      report_fatal_error("Cannot write the chunk " + File + ": " + ErrorInfo);
+    ChunkOut << Chunks[i] << ChunkTableUpdates[i];
+  }
+  DeferredFunctions.clear();
+  DeferredSourceMappings.clear();
+  DeferredCache.clear();
+}
+
+void *JsWriter::runDeferredFunctionQueue(void *Worker) {
+  JsWriterWorker *W = static_cast<JsWriterWorker*>(Worker);
+  W->Writer.printDeferredFunctionQueue(W->Parent, W->Buffer);
+  return 0;
+}
+
+/// printDeferredFunctionQueue - Take the deferred functions of Parent in turn
+/// and append their bodies to their text, using Buffer as the output buffer.
+void JsWriter::printDeferredFunctionQueue(JsWriter &Parent,
+                                          std::string &Buffer) {
+  while (true) {
+    unsigned i = sys::AtomicIncrement(&Parent.NextDeferredFunction) - 1;
+    if (i >= Parent.DeferredFunctions.size())
+      break;
+    if (!Parent.DeferredCache.empty() && Parent.DeferredCache[i].Hit)
+      continue;
+    Function &F = *Parent.DeferredFunctions[i].first;
+
+    DominatorTreeBase<BasicBlock> FunctionDT(false);
+    FunctionDT.recalculate(F);
+    LoopInfoBase<BasicBlock, Loop> FunctionLI;
+    FunctionLI.Calculate(FunctionDT);
+    DT = &FunctionDT;
+    LI = &FunctionLI;
+
+    // Mappings are relative to the start of the text, which already holds
+    // the floating point constants of F.
+    const std::string &Text = Parent.DeferredFunctions[i].second;
+    Positions.reset();
+    Positions.advance(Text.data(), Text.size());
+
+    printFunction(F);
+    // With a source map, Out prints through Positions into the stream that
+    // fills Buffer.
+    Out.flush();
+    Positions.getStream().flush();
+    Parent.DeferredFunctions[i].second += Buffer;
+    Buffer.clear();
+    if (!SourceMapFile.empty()) {
+      Parent.DeferredSourceMappings[i].swap(SourceMappings);
+      SourceMappings.clear();
+    }
+  }
+  LI = 0;
+  DT = 0;
+}
+
+/// getMinifiedNameLength - Return the length of the minified name numbered N.
+static unsigned getMinifiedNameLength(unsigned N) {
+  unsigned Length = 1;
+  for (N /= 52; N; N /= 62) {
+    --N;
+    ++Length;
+  }
+  return Length;
+}
+
+/// getCacheKey - Return the text that determines what printFunction prints
+/// for F: the build of the backend and its options, the IR of F, the structure
+/// of the types it uses, and what the writer knows about the globals and
+/// constants it refers to.  The IR only names the struct types and globals.
+std::string JsWriter::getCacheKey(Function &F) {
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << "js-backend " << __DATE__ << ' ' << __TIME__ << '\n'
+     << "options " << HeapMemory << Coercions << Float32 << Minify
+     << LocalBindings << ProfileLayout << CheckedDivision << ' ' << OptLevel
+     << ' ' << HeapSize << '\n'
+     << "chunk " << FunctionChunks.count(&F) << '\n'
+     << "layout " << TheModule->getDataLayout() << '\n';
+  F.print(OS);
+
+  SmallPtrSet<const Type*, 16> Types;
+  SmallPtrSet<const Value*, 16> Seen;
+  SmallVector<const Value*, 16> Worklist;
+  unsigned NumValues = 0;
+  for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+       AI != AE; ++AI, ++NumValues)
+    Worklist.push_back(AI);
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    Worklist.push_back(BB);
+    ++NumValues;
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      Worklist.push_back(I);
+      ++NumValues;
+    }
+  }
+  std::reverse(Worklist.begin(), Worklist.end());
+
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    if (Types.insert(V->getType()))
+      OS << "type " << V->getType()->getDescription() << '\n';
+    if (!V->hasName() && !isa<Constant>(V))
+      OS << "anon " << AnonValueNumbers.lookup(V) << '\n';
+
+    if (const GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+      OS << "global " << GetValueName(GV) << ' ' << GV->getLinkage() << ' '
+         << GV->isDeclaration();
+      if (const GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV))
+        OS << ' ' << GlobalAddresses.lookup(GVar) << ' '
+           << ProfileCounters.count(GVar);
+      if (const Function *Callee = dyn_cast<Function>(GV))
+        OS << ' ' << FunctionTableIndices.lookup(Callee);
+      OS << '\n';
+      continue;
+    }
+    if (const ConstantFP *FPC = dyn_cast<ConstantFP>(V)) {
+      std::map<const ConstantFP*, unsigned>::const_iterator I =
+        FPConstantMap.find(FPC);
+      if (I != FPConstantMap.end())
+        OS << "fp " << I->second << '\n';
+      continue;
+    }
+    if (const Constant *C = dyn_cast<Constant>(V)) {
+      DenseMap<const Constant*, unsigned>::const_iterator I =
+        PooledConstants.find(C);
+      if (I != PooledConstants.end())
+        OS << "pool " << I->second << '\n';
+    }
+
+    // Indirect calls in the heap mask the index into their function table.
+    CallSite CS = CallSite::get(const_cast<Value*>(V));
+    if (HeapMemory && CS.getInstruction() &&
+        !isa<Function>(CS.getCalledValue()->stripPointerCasts())) {
+      const Type *Ty = CS.getCalledValue()->getType();
+      std::map<std::string, std::vector<const Function*> >::const_iterator T =
+        FunctionTables.find(getFunctionTableName(
+          cast<FunctionType>(cast<PointerType>(Ty)->getElementType())));
+      if (T != FunctionTables.end())
+        OS << "table " << T->second.size() << ' '
+           << tableHasExternalVarArgs(cast<FunctionType>(
+                cast<PointerType>(Ty)->getElementType())) << '\n';
+    }
+    if (const BasicBlock *BB = dyn_cast<BasicBlock>(V)) {
+      if (ProfileKind)
+        for (int i = -1, e = BB->getTerminator()->getNumSuccessors(); i != e;
+             ++i)
+          OS << "count " << getProfileCount(BB, i) << '\n';
+      continue;
+    }
+
+    const User *U = dyn_cast<User>(V);
+    if (!U)
+      continue;
+    for (unsigned i = 0, e = U->getNumOperands(); i != e; ++i) {
+      const Value *Op = U->getOperand(i);
+      if (isa<Constant>(Op) && Seen.insert(Op))
+        Worklist.push_back(Op);
+      else if (!isa<Constant>(Op) && Types.insert(Op->getType()))
+        OS << "type " << Op->getType()->getDescription() << '\n';
+    }
+  }
+
+  // Minified names skip the globals with the same name.  Only names as long
+  // as those F may need matter.
+  if (Minify) {
+    unsigned MaxLength = getMinifiedNameLength(
+      NumValues + GlobalNames.size() + array_lengthof(JsReservedNames));
+    for (std::set<std::string>::const_iterator I = GlobalNames.begin(),
+         E = GlobalNames.end(); I != E; ++I)
+      if (I->size() <= MaxLength)
+        OS << "reserved " << *I << '\n';
+  }
+  return OS.str();
+}
+
+/// getCacheFileName - Return the file that the text printed under Key is
+/// cached in.  Keys with the same hash share it, and the key is stored with
+/// the text to tell them apart.
+std::string JsWriter::getCacheFileName(const std::string &Key) {
+  sys::Path File(CacheDir);
+  File.appendComponent(utohexstr(HashString(Key)) + ".js");
+  return File.str();
+}
+
+/// lookUpCachedFunction - Complete the text of the deferred function F from
+/// the cache if it is there.  A cache file holds the length of the key, the
+/// key, and the text.
+void JsWriter::lookUpCachedFunction(Function &F) {
+  std::string &Text = DeferredFunctions.back().second;
+  CachedFunction C = { getCacheKey(F), Text.size(), false };
+  OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getFile(getCacheFileName(C.Key)));
+  if (Buffer) {
+    StringRef Entry = Buffer->getBuffer();
+    std::string Header = utostr(C.Key.size()) + "\n";
+    if (Entry.startswith(Header) &&
+        Entry.substr(Header.size(), C.Key.size()) == C.Key) {
+      Text += Entry.substr(Header.size() + C.Key.size());
+      C.Hit = true;
+    }
+  }
+  if (C.Hit)
+    ++NumCacheHits;
+  else
+    ++NumCacheMisses;
+  DeferredCache.push_back(C);
+}
+
+/// storeCachedFunctions - Add the text of the deferred functions that missed
+/// the cache to it.  Each file is written under a unique name and renamed into
+/// place, so that concurrent builds sharing the cache never read a partial
+/// one.  The cache is only an optimization, files that can not be written are
+/// skipped.
+void JsWriter::storeCachedFunctions() {
+  for (unsigned i = 0, e = DeferredCache.size(); i != e; ++i) {
+    const CachedFunction &C = DeferredCache[i];
+    if (C.Hit)
+      continue;
+    sys::Path File(getCacheFileName(C.Key));
+    sys::Path Temp(File.str() + ".tmp");
+    std::string Error;
+    if (Temp.makeUnique(false, &Error))
+      continue;
+    {
+      raw_fd_ostream OS(Temp.c_str(), Error, raw_fd_ostream::F_Binary);
+      if (!Error.empty())
+        continue;
+      OS << C.Key.size() << '\n' << C.Key
+         << StringRef(DeferredFunctions[i].second).substr(C.BodyStart);
+    }
+    if (Temp.renamePathOnDisk(File, &Error))
+      Temp.eraseFromDisk();
+  }
+}
+
+/// printJSONString - Print Str as a JSON string literal.
+static void printJSONString(StringRef Str, raw_ostream &Out) {
+  Out << '"';
+  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
+    unsigned char C = Str[i];
+    if (C == '"' || C == '\\')
+      Out << '\\' << C;
+    else if (C == '\n')
+      Out << "\\n";
+    else if (C == '\t')
+      Out << "\\t";
+    else if (C < 0x20)
+      Out << "\\u00" << hexdigit(C >> 4) << hexdigit(C & 0x0F);
+    else
+      Out << C;
+  }
+  Out << '"';
+}
+
+/// printBase64VLQ - Print Value as a source map base64 VLQ: the sign goes to
+/// the lowest bit, then 5 bits per digit, lowest first.
+static void printBase64VLQ(int Value, raw_ostream &Out) {
+  static const char Base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned VLQ = Value < 0 ? (unsigned(-Value) << 1) | 1 : unsigned(Value) << 1;
+  do {
+    unsigned Digit = VLQ & 31;
+    VLQ >>= 5;
+    if (VLQ)
+      Digit |= 32;
+    Out << Base64[Digit];
+  } while (VLQ);
+}
+
+/// printSourceMap - Write the source map of the module to SourceMapFile.
+/// Statements map to the debug location of their instruction when it has one,
+/// and to the line of the instruction in the IR of M otherwise.  That IR is
+/// embedded in the map, since it is the IR after lowering.
+void JsWriter::printSourceMap(Module &M) {
+  std::vector<std::string> Sources;
+  std::map<std::string, unsigned> SourceIndex;
+  std::string IR;
+  DenseMap<const Instruction*, unsigned> IRLines;
+  int IRSource = -1;
+
+  std::string Mappings;
+  raw_string_ostream MappingsOut(Mappings);
+  unsigned PrevLine = 0;
+  int PrevColumn = 0, PrevSource = 0, PrevSrcLine = 0, PrevSrcColumn = 0;
+  for (unsigned i = 0, e = SourceMappings.size(); i != e; ++i) {
+    const SourceMapping &SM = SourceMappings[i];
+    int Source, SrcLine, SrcColumn = 0;
+
+    MDNode *Dbg = SM.I->getDbgMetadata();
+    DILocation Loc(Dbg);
+    if (Dbg && Loc.getLineNumber()) {
+      std::string File = Loc.getFilename();
+      StringRef Dir = Loc.getDirectory();
+      if (!Dir.empty() && (File.empty() || File[0] != '/'))
+        File = Dir.str() + "/" + File;
+      std::map<std::string, unsigned>::iterator I = SourceIndex.find(File);
+      if (I == SourceIndex.end()) {
+        I = SourceIndex.insert(std::make_pair(File, Sources.size())).first;
+        Sources.push_back(File);
+      }
+      Source = I->second;
+      SrcLine = Loc.getLineNumber() - 1;
+      if (Loc.getColumnNumber())
+        SrcColumn = Loc.getColumnNumber() - 1;
+    } else {
+      if (IRSource < 0) {
+        raw_string_ostream IROut(IR);
+        JsPositionStream IRPositions(IROut);
+        JsIRLineAnnotator Annotator(IRPositions, IRLines);
+        M.print(IRPositions, &Annotator);
+        IROut.flush();
+        IRSource = Sources.size();
+        Sources.push_back(M.getModuleIdentifier());
+      }
+      Source = IRSource;
+      SrcLine = IRLines.lookup(SM.I);
+    }
+
+    // Segments are separated by ',' and lines by ';'.  The generated column
+    // is relative to the previous segment on the same line, the other fields
+    // to the previous segment.
+    if (SM.Line != PrevLine) {
+      MappingsOut << std::string(SM.Line - PrevLine, ';');
+      PrevLine = SM.Line;
+      PrevColumn = 0;
+    } else if (i) {
+      MappingsOut << ',';
+    }
+    printBase64VLQ(SM.Column - PrevColumn, MappingsOut);
+    printBase64VLQ(Source - PrevSource, MappingsOut);
+    printBase64VLQ(SrcLine - PrevSrcLine, MappingsOut);
+    printBase64VLQ(SrcColumn - PrevSrcColumn, MappingsOut);
+    PrevColumn = SM.Column;
+    PrevSource = Source;
+    PrevSrcLine = SrcLine;
+    PrevSrcColumn = SrcColumn;
+  }
+  MappingsOut.flush();
+  SourceMappings.clear();
+
+  std::string ErrorInfo;
+  raw_fd_ostream MapOut(SourceMapFile.c_str(), ErrorInfo);
+  if (!ErrorInfo.empty())
+    report_fatal_error("Cannot write the source map: " + ErrorInfo);
+
+  MapOut << "{\"version\":3,\"sources\":[";
+  for (unsigned i = 0, e = Sources.size(); i != e; ++i) {
+    if (i)
+      MapOut << ',';
+    printJSONString(Sources[i], MapOut);
+  }
+  MapOut << ']';
+  if (IRSource >= 0) {
+    MapOut << ",\"sourcesContent\":[";
+    for (unsigned i = 0, e = Sources.size(); i != e; ++i) {
+      if (i)
+        MapOut << ',';
+      if (int(i) == IRSource)
+        printJSONString(IR, MapOut);
+      else
+        MapOut << "null";
+    }
+    MapOut << ']';
+  }
+  MapOut << ",\"names\":[],\"mappings\":";
+  printJSONString(Mappings, MapOut);
+  MapOut << "}\n";
+}
+
 /// printSymbolTable - Run through symbol table looking for type names.  If a
 /// type name is found, emit its declaration...
 ///
@@ -1764,7 +5341,17 @@ void JsWriter::printFunctionSignature(const Function *F, bool Prototype) {
     Out << "var " << GetValueName(F);
     return;
   } 
-  Out << "_." << GetValueName(F) << " = function " << GetValueName(F) << "(";
+  // A function printed to a chunk replaces its stub when the chunk is loaded,
+  // or is the body of the stub.  The body is named apart from the function so
+  // that it does not see itself under the name of its stub.
+  if (LocalBindings && !FunctionChunks.count(F))
+    Out << "function " << GetValueName(F) << "(";
+  else if (!HeapMemory && FunctionChunks.count(F))
+    Out << (LocalBindings ? "" : "_.") << GetValueName(F)
+        << ".$body = function $" << GetValueName(F) << "(";
+  else
+    Out << (LocalBindings ? "" : "_.") << GetValueName(F) << " = function "
+        << GetValueName(F) << "(";
   if(!F->arg_empty()) {
     // print out arguments
     Function::const_arg_iterator AI = F->arg_begin(), AE = F->arg_end();
@@ -1774,59 +5361,111 @@ void JsWriter::printFunctionSignature(const Function *F, bool Prototype) {
       Out << ", " << GetValueName(AI);
     }
   }
+  // The variadic arguments come in one buffer, see printVarArgs.
+  if (F->isVarArg())
+    Out << (F->arg_empty() ? "$va" : ", $va");
   Out << ")";
 }
 
-static inline bool isFPIntBitCast(const Instruction &I) {
-  if (!isa<BitCastInst>(I))
-    return false;
-  const Type *SrcTy = I.getOperand(0)->getType();
-  const Type *DstTy = I.getType();
-  return (SrcTy->isFloatingPointTy() && DstTy->isIntegerTy()) ||
-         (DstTy->isFloatingPointTy() && SrcTy->isIntegerTy());
-}
+void JsWriter::printFunction(Function &F) {
+  UseDispatcher = !prepareStructuredControlFlow(F);
+  Indent = 2;
+
+  findFoldedLoads(F);
+  coalesceLocals(F);
+  assignMinifiedNames(F);
+  printSwitchTables(F);
+  printReturnSlot(F);
 
-void JsWriter::printFunction(Function &F) {
   printFunctionSignature(&F, false);
   Out << " {\n";
-  
+
+  if (Coercions)
+    for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+         AI != AE; ++AI) {
+      const Type *Ty = AI->getType();
+      if (Ty->isIntegerTy() || Ty->isFloatingPointTy() ||
+          (HeapMemory && Ty->isPointerTy())) {
+        indent() << GetValueName(AI) << " = ";
+        printCoercedValue(AI, Ty);
+        Out << ";\n";
+      }
+    }
+
   bool PrintedVar = false;
+  std::set<std::string> Shadows;
   
   // print local variable information for the function
   for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I) {
     if (isDirectAlloca(&*I) || (I->getType() != Type::getVoidTy(F.getContext()) &&
 						       !isInlinableInst(*I))) {
-      if(!PrintedVar) {
-	Out << "  var " << GetValueName(&*I);
-	PrintedVar = true;
-      } else {
-	Out << ", " << GetValueName(&*I);
+      LocalsBefore += isa<PHINode>(*I) ? 2 : 1;
+      if (getLocalVariable(&*I) == &*I) {
+        (PrintedVar ? Out << ", " : indent() << "var ") << GetValueName(&*I);
+        PrintedVar = true;
+        ++LocalsAfter;
       }
-      if(isa<PHINode>(*I)) {
-	Out << ", " << GetValueName(&*I) << "_";
+      const PHINode *PN = dyn_cast<PHINode>(&*I);
+      if (PN && ShadowedPHIs.count(PN) &&
+          Shadows.insert(GetValueName(PN) + "_").second) {
+	(PrintedVar ? Out << ", " : indent() << "var ") << GetValueName(PN) << "_";
+        PrintedVar = true;
+        ++LocalsAfter;
       }
     }
-    // We need a temporary for the BitCast to use so it can pluck a value out
-    // of a union to do the BitCast. This is separate from the need for a
-    // variable to hold the result of the BitCast. 
-    if (isFPIntBitCast(*I)) {
-      Out << "  llvmBitCastUnion " << GetValueName(&*I)
-          << "__BITCAST_TEMPORARY;\n";
-      PrintedVar = true;
-    }
   }
 
   if (PrintedVar) {
     Out << ";\n";
   }
 
+  HasInvoke = false;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    if (isa<InvokeInst>(BB->getTerminator()))
+      HasInvoke = true;
+  if (HeapMemory)
+    computeStackFrame(F);
+  if (HasInvoke)
+    indent() << "var $exn, $threw"
+             << (HeapMemory && HasDynamicAllocas ? ", $top" : "") << ";\n";
+
+  if (HeapMemory) {
+    if (HasStackFrame)
+      indent() << "var $sp = $STACKTOP;\n";
+    if (FrameSize)
+      indent() << "$STACKTOP = $sp + " << FrameSize << ";\n";
+    for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+         AI != AE; ++AI) {
+      if (!AI->hasByValAttr())
+        continue;
+      std::string Name = GetValueName(AI), Copy = "$sp";
+      if (uint64_t Offset = FrameOffsets.lookup(AI))
+        Copy += " + " + utostr(Offset);
+      indent() << "$HEAPU8.copyWithin(" << Copy << ", " << Name << ", "
+               << Name << " + " << TD->getTypeAllocSize(
+                    cast<PointerType>(AI->getType())->getElementType())
+               << ");\n";
+      indent() << Name << " = " << Copy << ";\n";
+    }
+  }
+
+  if (!UseDispatcher) {
+    printStructuredTree(&F.getEntryBlock());
+    printFunctionEnd(&F);
+    return;
+  }
+
   std::string cls = "";
   raw_string_ostream Closing(cls);
 
   // print the basic blocks
+  Indent = 8;
   Function::iterator BB = F.begin(), E = F.end();
   if(BB != E) {
-    Out << "  var _ = '" << GetValueName(BB) << "'; /* jump variable */\n";
+    Out << "  var _ = '" << GetValueName(BB) << "';";
+    if (!Minify)
+      Out << " /* jump variable */";
+    Out << "\n";
     Out << "  while(1) {\n";
     Out << "    switch(_) {\n";
     if (Loop *L = LI->getLoopFor(BB)) {
@@ -1840,7 +5479,17 @@ void JsWriter::printFunction(Function &F) {
     Closing << "  }\n";
     ++BB;
   }
+  // The cases are tested in order, so with a profile the hottest blocks and
+  // loops come first after the entry block.
+  std::vector<BasicBlock*> Blocks;
+  std::vector<std::pair<int64_t, unsigned> > Order;
   for(; BB != E; ++BB) {
+    Order.push_back(std::make_pair(-getProfileCount(BB), Blocks.size()));
+    Blocks.push_back(BB);
+  }
+  std::sort(Order.begin(), Order.end());
+  for (unsigned i = 0, e = Order.size(); i != e; ++i) {
+    BasicBlock *BB = Blocks[Order[i].second];
     if (Loop *L = LI->getLoopFor(BB)) {
       if (L->getHeader() == BB && L->getParentLoop() == 0)
         printLoop(L);
@@ -1850,10 +5499,115 @@ void JsWriter::printFunction(Function &F) {
   }
 
   Out << Closing.str();
-  Out << "};\n";
+  printFunctionEnd(&F);
+}
+
+/// printFunctionEnd - Close the function that printFunctionSignature opened.
+/// A function bound to a local is a declaration, which is published after its
+/// body.
+void JsWriter::printFunctionEnd(const Function *F) {
+  if (!LocalBindings) {
+    Out << "};\n";
+  } else {
+    Out << (FunctionChunks.count(F) ? "};\n" : "}\n");
+    if (isExported(F) && (HeapMemory || !FunctionChunks.count(F)))
+      Out << "_." << GetValueName(F) << " = " << GetValueName(F) << ";\n";
+  }
   Out << "\n";
 }
 
+/// printGlobalExport - Publish a global bound to a local on the module object.
+/// Without the heap the local holds the value itself, so the property forwards
+/// to it.
+void JsWriter::printGlobalExport(const GlobalVariable *GV) {
+  std::string Name = GetValueName(GV);
+  if (HeapMemory) {
+    Out << "_." << Name << " = " << Name << ";\n";
+    return;
+  }
+  Out << "Object.defineProperty(_, \"" << Name << "\", {get: function() { "
+      << "return " << Name << "; }, set: function(v) { " << Name
+      << " = v; }, enumerable: true});\n";
+}
+
+/// printGlobalInitializer - Print the initial value of the global GV, which
+/// is not in the heap.  Profile counters are a typed array, so that they wrap
+/// around like the unsigned counters of the C runtime.
+void JsWriter::printGlobalInitializer(GlobalVariable *GV) {
+  if (ProfileCounters.count(GV)) {
+    // Optimal edge profiling marks the edges it does not count with -1.
+    Constant *Init = GV->getInitializer();
+    Out << "new Uint32Array(";
+    if (Init->isNullValue())
+      Out << cast<ArrayType>(Init->getType())->getNumElements();
+    else
+      writeOperand(Init, true);
+    Out << ")";
+    return;
+  }
+  writeOperand(GV->getInitializer(), true);
+}
+
+/// printProfilingRuntime - Print the functions that edge profiled code calls
+/// to register its counters.  $llvmprof returns the bytes of the records of all
+/// counters, preceded by the command line, in the llvmprof.out format.  It is
+/// published on the module object, and under node the records are appended to
+/// llvmprof.out when the process exits, once profiling has started, as the C
+/// runtime does.
+void JsWriter::printProfilingRuntime(Module &M) {
+  bool Printed = false;
+  for (unsigned i = 0, e = array_lengthof(JsProfilingFunctions); i != e; ++i) {
+    Function *F = M.getFunction(JsProfilingFunctions[i].Name);
+    if (!F || !F->isDeclaration() || F->use_empty())
+      continue;
+    if (!Printed) {
+      printSectionHeader("Profiling");
+      Out << "var $profile = [];\n"
+          << "function $llvmprof() {\n"
+          << "  var args = typeof process == 'object' ? "
+          << "process.argv.slice(1).join(' ') : '';\n"
+          << "  if (args)\n"
+          << "    args += ' ';\n"
+          << "  var p = 2 + (args.length + 3 >> 2), size = p, i;\n"
+          << "  for (i = 0; i < $profile.length; ++i)\n"
+          << "    size += 2 + $profile[i][1].length;\n"
+          << "  var out = new Uint32Array(size);\n"
+          << "  var bytes = new Uint8Array(out.buffer);\n"
+          << "  out[0] = " << ArgumentInfo << ";\n"
+          << "  out[1] = args.length;\n"
+          << "  for (i = 0; i < args.length; ++i)\n"
+          << "    bytes[8 + i] = args.charCodeAt(i);\n"
+          << "  for (i = 0; i < $profile.length; ++i) {\n"
+          << "    out[p] = $profile[i][0];\n"
+          << "    out[p + 1] = $profile[i][1].length;\n"
+          << "    out.set($profile[i][1], p + 2);\n"
+          << "    p += 2 + $profile[i][1].length;\n"
+          << "  }\n"
+          << "  return bytes;\n"
+          << "}\n"
+          << "_.$llvmprof = $llvmprof;\n"
+          << "function $profile_start(type, counters) {\n"
+          << "  if (!$profile.length && typeof process == 'object' && "
+          << "process.on)\n"
+          << "    process.on('exit', function() {\n"
+          << "      require('fs').appendFileSync('llvmprof.out', "
+          << "$llvmprof());\n"
+          << "    });\n"
+          << "  $profile.push([type, counters]);\n"
+          << "}\n";
+      Printed = true;
+    }
+    // In the heap the counters are viewed where they are.
+    Out << "function " << GetValueName(F) << "(argc, argv, counters, n) {\n"
+        << "  $profile_start(" << JsProfilingFunctions[i].Type << ", "
+        << (HeapMemory ? "$HEAPU32.subarray(counters >> 2, (counters >> 2) + n)"
+                       : "counters")
+        << ");\n"
+        << "  return argc;\n"
+        << "}\n";
+  }
+}
+
 void JsWriter::printLoop(Loop *L) {
   for (unsigned i = 0, e = L->getBlocks().size(); i != e; ++i) {
     BasicBlock *BB = L->getBlocks()[i];
@@ -1865,13 +5619,182 @@ void JsWriter::printLoop(Loop *L) {
   }
 }
 
+/// passesVarArgsInBuffer - Return true if the variadic arguments of CS are
+/// passed in one buffer after the named ones, to be read with va_arg.  The
+/// functions of the JS environment take them as separate arguments instead.
+static bool passesVarArgsInBuffer(CallSite CS) {
+  const FunctionType *FTy = cast<FunctionType>(
+    cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+  if (!FTy->isVarArg())
+    return false;
+  const Function *F =
+    dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+  return !F || !F->isDeclaration();
+}
+
+/// isDoubleVarArg - Return true if a variadic argument of type Ty takes a
+/// $HEAPF64 slot, rather than a $HEAP32 one.
+static bool isDoubleVarArg(const Type *Ty) {
+  if (Ty->isFloatingPointTy() || Ty->isIntegerTy(64))
+    return true;
+  if (!Ty->isIntegerTy() && !Ty->isPointerTy())
+    report_fatal_error("Variadic arguments of this type are not supported by "
+                       "the Javascript backend.");
+  return false;
+}
+
+/// computeStackFrame - Lay out the byval copies, the fixed size allocas and
+/// the variadic argument slots of F in its stack frame.  Functions with a
+/// frame save and restore the heap stack pointer.
+void JsWriter::computeStackFrame(Function &F) {
+  FrameOffsets.clear();
+  FrameSize = 0;
+  // The catch of an invoke resets the stack pointer from '$sp'.
+  HasStackFrame = HasInvoke;
+  HasDynamicAllocas = false;
+  // The caller passes the address of a byval argument, which the callee
+  // copies so that its writes do not reach the caller's object.
+  for (Function::arg_iterator AI = F.arg_begin(), AE = F.arg_end();
+       AI != AE; ++AI) {
+    if (!AI->hasByValAttr())
+      continue;
+    HasStackFrame = true;
+    const Type *Ty = cast<PointerType>(AI->getType())->getElementType();
+    unsigned Align = std::max(F.getParamAlignment(AI->getArgNo() + 1),
+                              (unsigned)TD->getPrefTypeAlignment(Ty));
+    FrameSize = RoundUpToAlignment(FrameSize, std::min(Align, HeapStackAlign));
+    FrameOffsets[AI] = FrameSize;
+    FrameSize += TD->getTypeAllocSize(Ty);
+  }
+  for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I) {
+    const AllocaInst *AI = dyn_cast<AllocaInst>(&*I);
+    if (!AI)
+      continue;
+    HasStackFrame = true;
+    if (!isDirectAlloca(AI)) {
+      HasDynamicAllocas = true;
+      continue;
+    }
+    const Type *Ty = AI->getAllocatedType();
+    unsigned Align = std::max(AI->getAlignment(),
+                              (unsigned)TD->getPrefTypeAlignment(Ty));
+    FrameSize = RoundUpToAlignment(FrameSize, std::min(Align, HeapStackAlign));
+    FrameOffsets[AI] = FrameSize;
+    FrameSize += TD->getTypeAllocSize(Ty);
+  }
+
+  // The variadic argument slots are shared by all calls.
+  uint64_t VarArgsSize = 0;
+  for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I) {
+    CallSite CS = CallSite::get(&*I);
+    if (!CS.getInstruction() || !passesVarArgsInBuffer(CS))
+      continue;
+    const FunctionType *FTy = cast<FunctionType>(
+      cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+    VarArgsSize = std::max(VarArgsSize,
+                           8 * uint64_t(CS.arg_size() - FTy->getNumParams()));
+  }
+  VarArgsOffset = RoundUpToAlignment(FrameSize, 8);
+  if (VarArgsSize) {
+    HasStackFrame = true;
+    FrameSize = VarArgsOffset + VarArgsSize;
+  }
+  FrameSize = RoundUpToAlignment(FrameSize, HeapStackAlign);
+}
+
+/// prepareStructuredControlFlow - Number the reachable blocks of F in reverse
+/// post-order and find the merge points, i.e. the blocks with more than one
+/// forward predecessor.  Returns false if F has a retreating edge that is not
+/// a back edge to a dominating loop header, meaning the CFG is irreducible.
+bool JsWriter::prepareStructuredControlFlow(Function &F) {
+  RPONumber.clear();
+  MergeBlocks.clear();
+
+  ReversePostOrderTraversal<Function*> RPOT(&F);
+  std::vector<BasicBlock*> Blocks(RPOT.begin(), RPOT.end());
+  for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+    RPONumber[Blocks[i]] = i;
+
+  for (unsigned i = 0, e = Blocks.size(); i != e; ++i) {
+    BasicBlock *BB = Blocks[i];
+    SmallPtrSet<BasicBlock*, 8> Visited;
+    unsigned ForwardPreds = 0;
+    for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI) {
+      BasicBlock *Pred = *PI;
+      DenseMap<BasicBlock*, unsigned>::iterator N = RPONumber.find(Pred);
+      // Ignore unreachable predecessors and duplicate (switch) edges.
+      if (N == RPONumber.end() || !Visited.insert(Pred))
+        continue;
+      if (N->second < i)
+        ++ForwardPreds;
+      else if (!DT->dominates(BB, Pred))
+        return false;
+    }
+    if (ForwardPreds > 1)
+      MergeBlocks.insert(BB);
+  }
+  return true;
+}
+
+/// printStructuredTree - Print the code for BB and all blocks it immediately
+/// dominates.  Loop headers are wrapped in a labeled 'while(1)' that back
+/// edges 'continue'.
+void JsWriter::printStructuredTree(BasicBlock *BB) {
+  // Merge points dominated by BB are printed after it, each one following a
+  // labeled block that forward edges 'break' out of.  The earliest merge point
+  // in reverse post-order gets the innermost block.
+  SmallVector<BasicBlock*, 4> MergeChildren;
+  DomTreeNode *Node = DT->getNode(BB);
+  for (DomTreeNode::iterator I = Node->begin(), E = Node->end(); I != E; ++I)
+    if (MergeBlocks.count((*I)->getBlock()))
+      MergeChildren.push_back((*I)->getBlock());
+  std::sort(MergeChildren.begin(), MergeChildren.end(), RPOOrder(RPONumber));
+
+  if (!LI->isLoopHeader(BB)) {
+    printStructuredNode(BB, MergeChildren);
+    return;
+  }
+
+  indent() << GetValueName(BB) << ": while(1) {\n";
+  Context.push_back(ControlContext(LoopHeadedBy, BB));
+  Indent += 2;
+  printStructuredNode(BB, MergeChildren);
+  Indent -= 2;
+  Context.pop_back();
+  indent() << "}\n";
+}
+
+void JsWriter::printStructuredNode(BasicBlock *BB,
+                                  SmallVectorImpl<BasicBlock*> &MergeChildren) {
+  if (MergeChildren.empty()) {
+    printBasicBlock(BB);
+    return;
+  }
+
+  BasicBlock *Follow = MergeChildren.back();
+  MergeChildren.pop_back();
+  indent() << GetValueName(Follow) << ": {\n";
+  Context.push_back(ControlContext(BlockFollowedBy, Follow));
+  Indent += 2;
+  printStructuredNode(BB, MergeChildren);
+  Indent -= 2;
+  Context.pop_back();
+  indent() << "}\n";
+  printStructuredTree(Follow);
+}
+
 void JsWriter::printBasicBlock(BasicBlock *BB) {
-  Out << "      case '" << GetValueName(BB) << "':\n";
+  if (UseDispatcher)
+    Out << "      case '" << GetValueName(BB) << "':\n";
   // Output all of the instructions in the basic block...
   for (BasicBlock::iterator II = BB->begin(), E = --BB->end(); II != E;
        ++II) {
+    // PHIs without a shadow were assigned on the incoming edges.
+    if (isa<PHINode>(II) && !ShadowedPHIs.count(cast<PHINode>(II)))
+      continue;
     if (!isInlinableInst(*II)) {
-      Out << "        ";
+      indent();
+      addSourceMapping(*II);
       if (II->getType() != Type::getVoidTy(BB->getContext()) &&
           !isInlineAsm(*II)) {
 	outputLValue(II);
@@ -1882,6 +5805,7 @@ void JsWriter::printBasicBlock(BasicBlock *BB) {
   }
 
   // Don't emit prefix or suffix for the terminator.
+  addSourceMapping(*BB->getTerminator());
   visit(*BB->getTerminator());
 }
 
@@ -1891,50 +5815,259 @@ void JsWriter::printBasicBlock(BasicBlock *BB) {
 //
 void JsWriter::visitReturnInst(ReturnInst &I) {
   // If this is a struct return function, return the temporary struct.
-  bool isStructReturn = I.getParent()->getParent()->hasStructRetAttr();
+  bool isStructReturn = !HeapMemory &&
+                        I.getParent()->getParent()->hasStructRetAttr();
+
+  if (HeapMemory && HasStackFrame)
+    indent() << "$STACKTOP = $sp;\n";
 
   if (isStructReturn) {
-    Out << "        return StructReturn;\n";
+    indent() << "return StructReturn;\n";
     return;
   }
   
-  if (I.getNumOperands() > 1) {
-    Out << "  return [\n";
-    for (unsigned i = 0, e = I.getNumOperands(); i != e; ++i) {
-      Out << "      ";
-      writeOperand(I.getOperand(i));
-      if (i != e - 1)
-        Out << ",";
-      Out << "\n";
+  // Aggregates are returned element by element in the return slot, or as a
+  // fresh array when there is none.
+  Value *RV = I.getNumOperands() ? I.getOperand(0) : 0;
+  if (RV && (RV->getType()->isStructTy() || RV->getType()->isArrayTy())) {
+    const Function *F = I.getParent()->getParent();
+    SmallVector<unsigned, 4> Path;
+    if (hasReturnSlot(*F)) {
+      std::string Slot = getReturnSlotName(F);
+      printReturnSlotStores(RV, RV->getType(), Path, Slot);
+      indent() << "return " << Slot << ";\n";
+    } else {
+      indent() << "return ";
+      printAggregateElement(RV, Path, 0);
+      Out << ";\n";
     }
-    Out << "    ];\n";
-    Out << "  }\n";
     return;
   }
 
-  Out << "        return";
+  indent() << "return";
   if (I.getNumOperands()) {
     Out << ' ';
-    writeOperand(I.getOperand(0));
+    if (Coercions && (HeapMemory || !I.getOperand(0)->getType()->isPointerTy()))
+      printCoercedValue(I.getOperand(0), I.getOperand(0)->getType());
+    else
+      writeOperand(I.getOperand(0));
   }
   Out << ";\n";
 }
 
+/// getJsCaseValue - Return the number a case value is printed as.
+static int64_t getJsCaseValue(const ConstantInt *CI) {
+  if (CI->getBitWidth() == 32)
+    return CI->getSExtValue();
+  if (Coercions || CI->isMinValue(true))
+    return CI->getZExtValue();
+  return CI->getSExtValue();
+}
+
+static bool clusterLess(const SwitchCluster &A,
+                        const SwitchCluster &B) {
+  return A.Low < B.Low;
+}
+
+/// getSwitchSuccessors - Collect the distinct successors of SI, the default
+/// destination first.  With a profile the others follow hottest first.
+void JsWriter::getSwitchSuccessors(SwitchInst &SI,
+                                   std::vector<BasicBlock*> &Succs) const {
+  SmallPtrSet<BasicBlock*, 16> Seen;
+  std::vector<std::pair<int64_t, unsigned> > Order;
+  Succs.push_back(SI.getDefaultDest());
+  Seen.insert(SI.getDefaultDest());
+  for (unsigned i = 1, e = SI.getNumSuccessors(); i != e; ++i)
+    if (Seen.insert(SI.getSuccessor(i)))
+      Order.push_back(std::make_pair(-getProfileCount(SI.getParent(), i), i));
+  std::sort(Order.begin(), Order.end());
+  for (unsigned i = 0, e = Order.size(); i != e; ++i)
+    Succs.push_back(SI.getSuccessor(Order[i].second));
+}
+
+/// classifySwitch - Decide how SI is lowered.  Clusters gets the case values
+/// that do not go to the default destination, in ascending order, with runs
+/// of consecutive values going to the same successor merged into one range.
+/// Successors are numbered by their position in Succs.
+JsWriter::SwitchLowering
+JsWriter::classifySwitch(SwitchInst &SI, const std::vector<BasicBlock*> &Succs,
+                         std::vector<SwitchCluster> &Clusters) {
+  const IntegerType *Ty = cast<IntegerType>(SI.getCondition()->getType());
+  if (OptLevel == CodeGenOpt::None || Ty->getBitWidth() == 1 ||
+      Ty->getBitWidth() > 32)
+    return PlainSwitch;
+
+  DenseMap<BasicBlock*, unsigned> SuccNumber;
+  for (unsigned i = 0, e = Succs.size(); i != e; ++i)
+    SuccNumber[Succs[i]] = i;
+
+  std::vector<SwitchCluster> Values;
+  for (unsigned i = 1, e = SI.getNumCases(); i != e; ++i) {
+    unsigned Succ = SuccNumber[SI.getSuccessor(i)];
+    if (Succ == 0)
+      continue;
+    SwitchCluster C;
+    C.Low = C.High = getJsCaseValue(SI.getCaseValue(i));
+    C.Succ = Succ;
+    Values.push_back(C);
+  }
+  if (Values.size() < MinSwitchCaseValues)
+    return PlainSwitch;
+  std::sort(Values.begin(), Values.end(), clusterLess);
+
+  Clusters.push_back(Values[0]);
+  for (unsigned i = 1, e = Values.size(); i != e; ++i) {
+    SwitchCluster &Last = Clusters.back();
+    if (Values[i].Succ == Last.Succ && Values[i].Low == Last.High + 1)
+      Last.High = Values[i].High;
+    else
+      Clusters.push_back(Values[i]);
+  }
+
+  // A few ranges are cheaper to test than to look up.  Denser switches go
+  // through a table when optimizing for speed.
+  uint64_t Range = Clusters.back().High - Clusters.front().Low + 1;
+  unsigned Density = OptLevel == CodeGenOpt::Aggressive ? 10 : 40;
+  bool Cheap = isCheapToReprint(SI.getCondition());
+  if (Clusters.size() < MinSwitchCaseValues && Cheap)
+    return TreeSwitch;
+  if (Range <= MaxSwitchTableSize && Values.size() * 100 >= Range * Density)
+    return TableSwitch;
+  return Cheap ? TreeSwitch : PlainSwitch;
+}
+
+/// printSwitchTables - Print the successor tables of the switches in F that
+/// dispatch through one.
+void JsWriter::printSwitchTables(Function &F) {
+  SwitchTables.clear();
+  unsigned NextTable = 0;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    SwitchInst *SI = dyn_cast<SwitchInst>(BB->getTerminator());
+    if (!SI)
+      continue;
+    std::vector<BasicBlock*> Succs;
+    std::vector<SwitchCluster> Clusters;
+    getSwitchSuccessors(*SI, Succs);
+    if (classifySwitch(*SI, Succs, Clusters) != TableSwitch)
+      continue;
+
+    std::string Name = "$sw" + utostr(NextTable++) + "_" + GetValueName(&F);
+    SwitchTables[SI] = Name;
+    Out << "var " << Name << " = new "
+        << (Succs.size() <= 256 ? "Uint8Array" : "Uint16Array") << "([";
+    int64_t Value = Clusters.front().Low;
+    for (unsigned i = 0, e = Clusters.size(); i != e; ++i) {
+      for (; Value < Clusters[i].Low; ++Value)
+        Out << (Value == Clusters.front().Low ? "" : ",") << '0';
+      for (; Value <= Clusters[i].High; ++Value)
+        Out << (Value == Clusters.front().Low ? "" : ",") << Clusters[i].Succ;
+    }
+    Out << "]);\n";
+  }
+}
+
+/// printSwitchTree - Print an expression for the number of the successor
+/// that Cond goes to, searching Clusters[Begin, End) by bisection.  Cond is
+/// known to lie within [Low, High], so the bounds it implies are not tested.
+void JsWriter::printSwitchTree(Value *Cond,
+                               const std::vector<SwitchCluster> &Clusters,
+                               unsigned Begin, unsigned End, int64_t Low,
+                               int64_t High) {
+  if (End - Begin == 1) {
+    const SwitchCluster &C = Clusters[Begin];
+    bool TestLow = C.Low > Low, TestHigh = C.High < High;
+    if (!TestLow && !TestHigh) {
+      Out << C.Succ;
+      return;
+    }
+    Out << '(';
+    writeOperand(Cond);
+    if (C.Low == C.High) {
+      Out << " == " << C.Low;
+    } else {
+      if (TestLow)
+        Out << " >= " << C.Low;
+      if (TestLow && TestHigh) {
+        Out << " && ";
+        writeOperand(Cond);
+      }
+      if (TestHigh)
+        Out << " <= " << C.High;
+    }
+    Out << " ? " << C.Succ << " : 0)";
+    return;
+  }
+
+  unsigned Mid = (Begin + End) / 2;
+  int64_t Pivot = Clusters[Mid].Low;
+  Out << '(';
+  writeOperand(Cond);
+  Out << " < " << Pivot << " ? ";
+  printSwitchTree(Cond, Clusters, Begin, Mid, Low, Pivot - 1);
+  Out << " : ";
+  printSwitchTree(Cond, Clusters, Mid, End, Pivot, High);
+  Out << ')';
+}
+
 void JsWriter::visitSwitchInst(SwitchInst &SI) {
-  Out << "        switch (";
-  writeOperand(SI.getOperand(0));
-  Out << ") {\n          default:\n";
-  printPHICopiesForSuccessor (SI.getParent(), SI.getDefaultDest(), 12);
-  printBranchToBlock(SI.getParent(), SI.getDefaultDest(), 12);
-  for (unsigned i = 2, e = SI.getNumOperands(); i != e; i += 2) {
-    Out << "          case ";
-    writeOperand(SI.getOperand(i));
-    Out << ":\n";
-    BasicBlock *Succ = cast<BasicBlock>(SI.getOperand(i+1));
-    printPHICopiesForSuccessor (SI.getParent(), Succ, 12);
-    printBranchToBlock(SI.getParent(), Succ, 12);
-  }
-  Out << "        }\n";
+  BasicBlock *BB = SI.getParent();
+  Value *Cond = SI.getCondition();
+
+  // Every successor is printed exactly once.  This matters when the successor
+  // is printed inline.
+  std::vector<BasicBlock*> Succs;
+  std::vector<SwitchCluster> Clusters;
+  getSwitchSuccessors(SI, Succs);
+  SwitchLowering Lowering = classifySwitch(SI, Succs, Clusters);
+
+  indent() << "switch (";
+  if (Lowering == TableSwitch) {
+    Out << SwitchTables[&SI] << '[';
+    writeOperand(Cond);
+    int64_t Base = Clusters.front().Low;
+    if (Base > 0)
+      Out << " - " << Base;
+    else if (Base < 0)
+      Out << " + " << -Base;
+    Out << ']';
+  } else if (Lowering == TreeSwitch) {
+    printSwitchTree(Cond, Clusters, 0, Clusters.size(), INT64_MIN, INT64_MAX);
+  } else {
+    writeOperand(Cond);
+  }
+  Out << ") {\n";
+
+  // Group the case values by destination.
+  std::map<BasicBlock*, std::vector<unsigned> > Cases;
+  for (unsigned i = 0, e = SI.getNumSuccessors(); i != e; ++i)
+    Cases[SI.getSuccessor(i)].push_back(i);
+
+  Context.push_back(ControlContext(SwitchCase, 0));
+  for (unsigned s = 0, se = Succs.size(); s != se; ++s) {
+    if (Lowering != PlainSwitch) {
+      Out.indent(Indent + 2);
+      if (s == 0)
+        Out << "default:\n";
+      else
+        Out << "case " << s << ":\n";
+    } else {
+      std::vector<unsigned> &C = Cases[Succs[s]];
+      for (unsigned i = 0, e = C.size(); i != e; ++i) {
+        if (C[i] == 0) {
+          Out.indent(Indent + 2) << "default:\n";
+          continue;
+        }
+        Out.indent(Indent + 2) << "case ";
+        writeOperand(SI.getCaseValue(C[i]));
+        Out << ":\n";
+      }
+    }
+    Indent += 4;
+    printEdge(BB, Succs[s]);
+    Indent -= 4;
+  }
+  Context.pop_back();
+  indent() << "}\n";
 }
 
 void JsWriter::visitIndirectBrInst(IndirectBrInst &IBI) {
@@ -1944,89 +6077,621 @@ void JsWriter::visitIndirectBrInst(IndirectBrInst &IBI) {
 }
 
 void JsWriter::visitUnreachableInst(UnreachableInst &I) {
-  Out << "        throw 'unreachable code';\n";
+  indent() << "throw 'unreachable code';\n";
 }
 
+/// visitUnwindInst - Resume the exception the function caught last.  A
+/// function that has not caught any throws a new one.
 void JsWriter::visitUnwindInst(UnwindInst &I) {
-  Out << "        throw 'unwind';\n";
+  if (!HasInvoke) {
+    indent() << "throw new $Unwind();\n";
+    return;
+  }
+  // A landing pad only runs once an exception was caught.
+  BasicBlock *BB = I.getParent();
+  bool Caught = pred_begin(BB) != pred_end(BB);
+  for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI) {
+    InvokeInst *II = dyn_cast<InvokeInst>((*PI)->getTerminator());
+    if (!II || II->getNormalDest() == BB)
+      Caught = false;
+  }
+  if (Caught)
+    indent() << "throw $exn;\n";
+  else
+    indent() << "throw $exn !== undefined ? $exn : new $Unwind();\n";
+}
+
+void JsWriter::visitInvokeInst(InvokeInst &I) {
+  BasicBlock *BB = I.getParent();
+  indent() << "$threw = true;\n";
+  if (HeapMemory && HasDynamicAllocas)
+    indent() << "$top = $STACKTOP;\n";
+  indent() << "try {\n";
+  Indent += 2;
+  indent();
+  if (!I.getType()->isVoidTy())
+    outputLValue(&I);
+  printCall(CallSite(&I), false);
+  Out << ";\n";
+  indent() << "$threw = false;\n";
+  Indent -= 2;
+  indent() << "} catch ($e) {\n";
+  Out.indent(Indent + 2) << "$exn = $e;\n";
+  if (HeapMemory && HasDynamicAllocas)
+    Out.indent(Indent + 2) << "$STACKTOP = $top;\n";
+  else if (HeapMemory && FrameSize)
+    Out.indent(Indent + 2) << "$STACKTOP = $sp + " << FrameSize << ";\n";
+  else if (HeapMemory)
+    Out.indent(Indent + 2) << "$STACKTOP = $sp;\n";
+  indent() << "}\n";
+
+  BasicBlock *Normal = I.getNormalDest(), *Unwind = I.getUnwindDest();
+  if (Normal == Unwind) {
+    printEdge(BB, Normal);
+  } else {
+    bool NeedNormal = hasPHICopiesForSuccessor(BB, Normal) ||
+                      isGotoCodeNecessary(BB, Normal);
+    bool NeedUnwind = hasPHICopiesForSuccessor(BB, Unwind) ||
+                      isGotoCodeNecessary(BB, Unwind);
+
+    Context.push_back(ControlContext(IfThenElse, 0));
+    if (NeedUnwind) {
+      indent() << "if ($threw) {\n";
+      Indent += 2;
+      printEdge(BB, Unwind);
+      Indent -= 2;
+      if (NeedNormal) {
+        indent() << "} else {\n";
+        Indent += 2;
+        printEdge(BB, Normal);
+        Indent -= 2;
+      }
+      indent() << "}\n";
+    } else if (NeedNormal) {
+      indent() << "if (!$threw) {\n";
+      Indent += 2;
+      printEdge(BB, Normal);
+      Indent -= 2;
+      indent() << "}\n";
+    }
+    Context.pop_back();
+  }
+  if (UseDispatcher)
+    Out << "\n";
 }
 
+/// isGotoCodeNecessary - Return true if control has to be transferred
+/// explicitly to get from the end of From to To.  In structured mode this is
+/// not the case when the jump lands on the statement following the current
+/// one anyway: the end of a labeled block followed by To, or the end of the
+/// body of the loop headed by To.
 bool JsWriter::isGotoCodeNecessary(BasicBlock *From, BasicBlock *To) {
-  /// FIXME: This should be reenabled, but loop reordering safe!!
+  if (UseDispatcher)
+    return true;
+
+  for (unsigned i = Context.size(); i != 0; --i) {
+    const ControlContext &C = Context[i-1];
+    // The end of an if arm is the end of the enclosing statement.
+    if (C.Kind == IfThenElse)
+      continue;
+    // The end of a switch case falls through into the next case.
+    if (C.Kind == SwitchCase)
+      return true;
+    return C.BB != To;
+  }
   return true;
+}
 
-  if (llvm::next(Function::iterator(From)) != Function::iterator(To))
-    return true;  // Not the direct successor, we need a goto.
+typedef std::pair<unsigned, unsigned> LiveRange;
 
-  //isa<SwitchInst>(From->getTerminator())
+static unsigned findLiveClass(std::vector<unsigned> &Leader, unsigned i) {
+  while (Leader[i] != i)
+    i = Leader[i] = Leader[Leader[i]];
+  return i;
+}
 
-  if (LI->getLoopFor(From) != LI->getLoopFor(To))
-    return true;
+/// liveRangesInterfere - Return true if two sorted lists of closed ranges of
+/// program points overlap.
+static bool liveRangesInterfere(const std::vector<LiveRange> &A,
+                                const std::vector<LiveRange> &B) {
+  for (unsigned i = 0, j = 0; i != A.size() && j != B.size(); ) {
+    if (A[i].first <= B[j].second && B[j].first <= A[i].second)
+      return true;
+    if (A[i].second < B[j].second)
+      ++i;
+    else
+      ++j;
+  }
   return false;
 }
 
+static void mergeLiveClasses(std::vector<unsigned> &Leader,
+                             std::vector<std::vector<LiveRange> > &Ranges,
+                             unsigned A, unsigned B) {
+  unsigned Root = std::min(A, B), Other = std::max(A, B);
+  std::vector<LiveRange> Merged;
+  std::merge(Ranges[Root].begin(), Ranges[Root].end(),
+             Ranges[Other].begin(), Ranges[Other].end(),
+             std::back_inserter(Merged));
+  Ranges[Root].swap(Merged);
+  Ranges[Other].clear();
+  Leader[Other] = Root;
+}
+
+/// findFoldedLoads - Above -O0, pick the loads of F that are printed inside
+/// the statement that uses them instead of being read into a local.  The load
+/// then happens where that statement is printed, so nothing printed between
+/// the two may write the memory it reads.
+void JsWriter::findFoldedLoads(Function &F) {
+  FoldedLoads.clear();
+  if (OptLevel == CodeGenOpt::None)
+    return;
+
+  for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB) {
+    // Go backwards, so that whether a load that uses another load is folded
+    // is known when the other one is looked at.
+    for (BasicBlock::iterator I = BB->end(); I != BB->begin(); ) {
+      LoadInst *Load = dyn_cast<LoadInst>(--I);
+      if (!Load || Load->isVolatile())
+        continue;
+      // Wider values are read in parts, possibly on both sides of a write.
+      const Type *Ty = Load->getType();
+      if (!Ty->isFloatingPointTy() && !Ty->isPointerTy() &&
+          !(Ty->isIntegerTy() && Ty->getPrimitiveSizeInBits() <= 32))
+        continue;
+
+      // Follow the expression the load is inlined into up to its statement.
+      // The load must be printed once, in this block.
+      Instruction *Stmt = Load;
+      do {
+        if (!Stmt->hasOneUse() ||
+            cast<Instruction>(Stmt->use_back())->getParent() != BB) {
+          Stmt = 0;
+          break;
+        }
+        Stmt = cast<Instruction>(Stmt->use_back());
+      } while (isInlinableInst(*Stmt) && !isDirectAlloca(Stmt));
+      if (!Stmt || isa<PHINode>(Stmt))
+        continue;
+
+      // Statements that copy their operands to memory or expand to several
+      // statements may read them late.
+      CallSite CS = CallSite::get(Stmt);
+      if (CS.getInstruction()) {
+        const FunctionType *FTy = cast<FunctionType>(
+          cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+        bool ByVal = false;
+        for (unsigned i = 0, e = CS.arg_size(); i != e && !ByVal; ++i)
+          ByVal = CS.paramHasAttr(i + 1, Attribute::ByVal);
+        if (isa<IntrinsicInst>(Stmt) || FTy->isVarArg() || ByVal)
+          continue;
+      } else if (isa<StoreInst>(Stmt)) {
+        if (isSplitHeapStore(*cast<StoreInst>(Stmt)))
+          continue;
+      } else if (!isa<ReturnInst>(Stmt) && !isa<BranchInst>(Stmt) &&
+                 !isa<SwitchInst>(Stmt) && !isa<BinaryOperator>(Stmt) &&
+                 !isa<CastInst>(Stmt) && !isa<CmpInst>(Stmt) &&
+                 !isa<GetElementPtrInst>(Stmt) && !isa<LoadInst>(Stmt)) {
+        continue;
+      }
+
+      BasicBlock::iterator Between = Load;
+      for (++Between; &*Between != Stmt; ++Between)
+        if (mayClobberLoad(*Between, *Load))
+          break;
+      if (&*Between != Stmt)
+        continue;
+
+      FoldedLoads.insert(Load);
+      if (isInlinableInst(*Load))
+        ++NumLoadsFolded;
+      else
+        FoldedLoads.erase(Load);
+    }
+  }
+}
+
+/// mayClobberLoad - Return true if I may write the memory that Load reads.
+/// Stores are told apart by their base object and constant offset, like
+/// BasicAliasAnalysis does, which needs no pass and works on worker threads.
+bool JsWriter::mayClobberLoad(const Instruction &I,
+                              const LoadInst &Load) const {
+  if (!I.mayWriteToMemory())
+    return false;
+  const StoreInst *SI = dyn_cast<StoreInst>(&I);
+  if (!SI || SI->isVolatile())
+    return true;
+
+  SmallVector<std::pair<const Value*, int64_t>, 4> StoreIndices, LoadIndices;
+  int64_t StoreOffset, LoadOffset;
+  const Value *StoreBase = DecomposeGEPExpression(SI->getPointerOperand(),
+                                                  StoreOffset, StoreIndices,
+                                                  TD);
+  const Value *LoadBase = DecomposeGEPExpression(Load.getPointerOperand(),
+                                                 LoadOffset, LoadIndices, TD);
+  if (StoreBase != LoadBase)
+    return !isIdentifiedObject(StoreBase) || !isIdentifiedObject(LoadBase);
+  if (StoreIndices != LoadIndices)
+    return true;
+  int64_t StoreSize = TD->getTypeStoreSize(SI->getOperand(0)->getType());
+  int64_t LoadSize = TD->getTypeStoreSize(Load.getType());
+  return StoreOffset < LoadOffset + LoadSize &&
+         LoadOffset < StoreOffset + StoreSize;
+}
+
+/// coalesceLocals - Partition the SSA values that need a JS local into
+/// classes of values whose live ranges do not interfere, preferring to put a
+/// PHI in the same class as its incoming values, and pick the PHIs that still
+/// need a shadow variable.  Without coalescing every value keeps its own local
+/// and every PHI is copied through its shadow.
+void JsWriter::coalesceLocals(Function &F) {
+  LocalVariable.clear();
+  ShadowedPHIs.clear();
+
+  if (!CoalesceLocals) {
+    for (inst_iterator I = inst_begin(&F), E = inst_end(&F); I != E; ++I)
+      if (PHINode *PN = dyn_cast<PHINode>(&*I))
+        ShadowedPHIs.insert(PN);
+    return;
+  }
+
+  // Number the program points.  Instruction number n reads its operands at
+  // 2n and writes its result at 2n+1, and PHIs are written right after the
+  // start of their block.
+  DenseMap<const Value*, unsigned> Position;
+  DenseMap<const Value*, unsigned> ValueIndex;
+  DenseMap<const BasicBlock*, unsigned> BlockIndex;
+  std::vector<Instruction*> Values;
+  unsigned Pos = 0, NumBlocks = 0;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    BlockIndex[BB] = NumBlocks++;
+    Position[BB] = Pos;
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      Position[I] = Pos++;
+      if (I->getType() != Type::getVoidTy(F.getContext()) &&
+          !isInlinableInst(*I) && !isDirectAlloca(I) && !isInlineAsm(*I)) {
+        ValueIndex[I] = Values.size();
+        Values.push_back(I);
+      }
+    }
+  }
+
+  // Find where each value is read.  Uses by inlined expressions are moved to
+  // the statement the expression is printed in, and uses by PHIs to the end
+  // of the incoming block.
+  unsigned NumValues = Values.size();
+  std::vector<SmallVector<std::pair<BasicBlock*, unsigned>, 4> >
+    Uses(NumValues);
+  for (unsigned i = 0; i != NumValues; ++i) {
+    SmallVector<std::pair<Instruction*, Instruction*>, 8> Worklist;
+    for (Value::use_iterator UI = Values[i]->use_begin(),
+         UE = Values[i]->use_end(); UI != UE; ++UI)
+      Worklist.push_back(std::make_pair(cast<Instruction>(*UI), Values[i]));
+    while (!Worklist.empty()) {
+      Instruction *User = Worklist.back().first;
+      Instruction *Op = Worklist.back().second;
+      Worklist.pop_back();
+      if (PHINode *PN = dyn_cast<PHINode>(User)) {
+        for (unsigned j = 0, e = PN->getNumIncomingValues(); j != e; ++j)
+          if (PN->getIncomingValue(j) == Op) {
+            BasicBlock *Pred = PN->getIncomingBlock(j);
+            Uses[i].push_back(std::make_pair(Pred,
+                              2 * Position[Pred->getTerminator()] + 1));
+          }
+      } else if (isInlinableInst(*User) && !isDirectAlloca(User)) {
+        for (Value::use_iterator UI = User->use_begin(), UE = User->use_end();
+             UI != UE; ++UI)
+          Worklist.push_back(std::make_pair(cast<Instruction>(*UI), User));
+      } else {
+        Uses[i].push_back(std::make_pair(User->getParent(),
+                                         2 * Position[User]));
+      }
+    }
+  }
+
+  // Solve block liveness.
+  std::vector<BitVector> Defs(NumBlocks, BitVector(NumValues));
+  std::vector<BitVector> LiveIn(NumBlocks, BitVector(NumValues));
+  std::vector<BitVector> LiveOut(NumBlocks, BitVector(NumValues));
+  for (unsigned i = 0; i != NumValues; ++i) {
+    Defs[BlockIndex[Values[i]->getParent()]].set(i);
+    for (unsigned j = 0, e = Uses[i].size(); j != e; ++j)
+      if (Uses[i][j].first != Values[i]->getParent())
+        LiveIn[BlockIndex[Uses[i][j].first]].set(i);
+  }
+  for (bool Changed = true; Changed; ) {
+    Changed = false;
+    for (Function::iterator BB = F.end(), E = F.begin(); BB != E; ) {
+      --BB;
+      unsigned b = BlockIndex[BB];
+      for (succ_iterator SI = succ_begin(BB), SE = succ_end(BB); SI != SE; ++SI)
+        LiveOut[b] |= LiveIn[BlockIndex[*SI]];
+      BitVector In = LiveOut[b];
+      In &= ~Defs[b];
+      In |= LiveIn[b];
+      if (In != LiveIn[b]) {
+        LiveIn[b] = In;
+        Changed = true;
+      }
+    }
+  }
+
+  // Build one live range per block for every value, sorted by position.
+  std::vector<std::vector<LiveRange> > Ranges(NumValues);
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    unsigned b = BlockIndex[BB];
+    BitVector Live = LiveIn[b];
+    Live |= Defs[b];
+    for (int i = Live.find_first(); i != -1; i = Live.find_next(i)) {
+      unsigned Start;
+      if (LiveIn[b][i])
+        Start = 2 * Position[BB];
+      else if (isa<PHINode>(Values[i]))
+        Start = 2 * Position[BB] + 1;
+      else
+        Start = 2 * Position[Values[i]] + 1;
+      unsigned End = Start;
+      if (LiveOut[b][i])
+        End = 2 * Position[BB->getTerminator()] + 1;
+      else
+        for (unsigned j = 0, e = Uses[i].size(); j != e; ++j)
+          if (Uses[i][j].first == BB)
+            End = std::max(End, Uses[i][j].second);
+      Ranges[i].push_back(LiveRange(Start, End));
+    }
+  }
+
+  // Union find over the values, keeping the merged live ranges at the root.
+  // The root is always the first value of its class.
+  std::vector<unsigned> Leader(NumValues);
+  for (unsigned i = 0; i != NumValues; ++i)
+    Leader[i] = i;
+
+  // Coalesce PHIs with their incoming values first, since every such merge
+  // removes a copy.
+  for (unsigned i = 0; i != NumValues; ++i) {
+    PHINode *PN = dyn_cast<PHINode>(Values[i]);
+    if (!PN)
+      continue;
+    for (unsigned j = 0, e = PN->getNumIncomingValues(); j != e; ++j) {
+      DenseMap<const Value*, unsigned>::iterator VI =
+        ValueIndex.find(PN->getIncomingValue(j));
+      if (VI == ValueIndex.end())
+        continue;
+      unsigned A = findLiveClass(Leader, i);
+      unsigned B = findLiveClass(Leader, VI->second);
+      if (A != B && !liveRangesInterfere(Ranges[A], Ranges[B]))
+        mergeLiveClasses(Leader, Ranges, A, B);
+    }
+  }
+
+  // Then greedily pack the classes of each type into as few locals as
+  // possible, in order of definition.
+  std::map<const Type*, std::vector<unsigned> > Slots;
+  for (unsigned i = 0; i != NumValues; ++i) {
+    if (findLiveClass(Leader, i) != i)
+      continue;
+    std::vector<unsigned> &TySlots = Slots[Values[i]->getType()];
+    bool Packed = false;
+    for (unsigned j = 0, e = TySlots.size(); j != e && !Packed; ++j) {
+      unsigned Slot = findLiveClass(Leader, TySlots[j]);
+      if (!liveRangesInterfere(Ranges[Slot], Ranges[i])) {
+        mergeLiveClasses(Leader, Ranges, Slot, i);
+        Packed = true;
+      }
+    }
+    if (!Packed)
+      TySlots.push_back(i);
+  }
+
+  for (unsigned i = 0; i != NumValues; ++i) {
+    unsigned Root = findLiveClass(Leader, i);
+    if (Root != i)
+      LocalVariable[Values[i]] = Values[Root];
+  }
+
+  // Copies that form a cycle on some edge go through the shadow of one of
+  // the PHIs involved, until every edge can be sequentialized.
+  SmallVector<PHINode*, 8> Order;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    if (!isa<PHINode>(BB->begin()))
+      continue;
+    for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI)
+      while (const PHINode *Cycle = orderPHICopies(*PI, BB, Order))
+        ShadowedPHIs.insert(Cycle);
+  }
+}
+
+/// collectReadVariables - Add to Vars the locals and arguments read when V is
+/// printed as an operand.
+void JsWriter::collectReadVariables(const Value *V,
+                                    SmallPtrSet<const Value*, 8> &Vars) {
+  if (isa<Argument>(V)) {
+    Vars.insert(V);
+    return;
+  }
+  const Instruction *I = dyn_cast<Instruction>(V);
+  if (!I)
+    return;
+  if (isInlinableInst(*I) && !isDirectAlloca(I)) {
+    for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+      collectReadVariables(I->getOperand(i), Vars);
+    return;
+  }
+  Vars.insert(getLocalVariable(I));
+}
+
+/// orderPHICopies - Compute the order of the direct PHI copies on the edge
+/// from CurBlock to Successor, so that no copy overwrites a local read by a
+/// later one.  Copies into a local that already holds the incoming value are
+/// dropped.  Returns a PHI of a copy cycle if there is no such order.
+const PHINode *JsWriter::orderPHICopies(BasicBlock *CurBlock,
+                                        BasicBlock *Successor,
+                                        SmallVectorImpl<PHINode*> &Order) {
+  Order.clear();
+  SmallVector<PHINode*, 8> Pending;
+  for (BasicBlock::iterator I = Successor->begin(); isa<PHINode>(I); ++I) {
+    PHINode *PN = cast<PHINode>(I);
+    Value *IV = PN->getIncomingValueForBlock(CurBlock);
+    if (isa<UndefValue>(IV) || ShadowedPHIs.count(PN) ||
+        getLocalVariable(IV) == getLocalVariable(PN))
+      continue;
+    Pending.push_back(PN);
+  }
+
+  while (!Pending.empty()) {
+    unsigned Next = Pending.size();
+    for (unsigned i = 0, e = Pending.size(); i != e && Next == e; ++i) {
+      const Value *Dst = getLocalVariable(Pending[i]);
+      bool Read = false;
+      for (unsigned j = 0; j != e && !Read; ++j) {
+        if (j == i)
+          continue;
+        SmallPtrSet<const Value*, 8> Vars;
+        collectReadVariables(Pending[j]->getIncomingValueForBlock(CurBlock),
+                             Vars);
+        Read = Vars.count(Dst);
+      }
+      if (!Read)
+        Next = i;
+    }
+    if (Next == Pending.size())
+      return Pending.front();
+    Order.push_back(Pending[Next]);
+    Pending.erase(Pending.begin() + Next);
+  }
+  return 0;
+}
+
+bool JsWriter::hasPHICopiesForSuccessor(BasicBlock *CurBlock,
+                                        BasicBlock *Successor) {
+  for (BasicBlock::iterator I = Successor->begin(); isa<PHINode>(I); ++I)
+    if (ShadowedPHIs.count(cast<PHINode>(I)) &&
+        !isa<UndefValue>(cast<PHINode>(I)->getIncomingValueForBlock(CurBlock)))
+      return true;
+  SmallVector<PHINode*, 8> Order;
+  orderPHICopies(CurBlock, Successor, Order);
+  return !Order.empty();
+}
+
 void JsWriter::printPHICopiesForSuccessor (BasicBlock *CurBlock,
-                                          BasicBlock *Successor,
-                                          unsigned Indent) {
+                                          BasicBlock *Successor) {
+  // Shadow copies come first, they read the old values and clobber nothing.
   for (BasicBlock::iterator I = Successor->begin(); isa<PHINode>(I); ++I) {
     PHINode *PN = cast<PHINode>(I);
+    if (!ShadowedPHIs.count(PN))
+      continue;
     // Now we have to do the printing.
     Value *IV = PN->getIncomingValueForBlock(CurBlock);
     if (!isa<UndefValue>(IV)) {
-      Out << std::string(Indent, ' ');
-      Out << "  " << GetValueName(I) << "_ = ";
+      indent();
+      Out << GetValueName(I) << "_ = ";
       writeOperand(IV);
-      Out << ";   /* for PHI node */\n";
+      Out << ";";
+      if (!Minify)
+        Out << "   /* for PHI node */";
+      Out << "\n";
     }
   }
+
+  SmallVector<PHINode*, 8> Order;
+  orderPHICopies(CurBlock, Successor, Order);
+  for (unsigned i = 0, e = Order.size(); i != e; ++i) {
+    indent();
+    Out << GetValueName(Order[i]) << " = ";
+    writeOperand(Order[i]->getIncomingValueForBlock(CurBlock));
+    Out << ";";
+    if (!Minify)
+      Out << "   /* for PHI node */";
+    Out << "\n";
+  }
 }
 
-void JsWriter::printBranchToBlock(BasicBlock *CurBB, BasicBlock *Succ,
-				  unsigned Indent) {
-  std::string Leading(Indent, ' ');
-  if (isGotoCodeNecessary(CurBB, Succ)) {
-    Out << Leading << "_ = '" << GetValueName(Succ) << "';\n";
-    Out << Leading << "continue;\n";
+void JsWriter::printBranchToBlock(BasicBlock *CurBB, BasicBlock *Succ) {
+  if (!isGotoCodeNecessary(CurBB, Succ))
+    return;
+
+  if (UseDispatcher) {
+    indent() << "_ = '" << GetValueName(Succ) << "';\n";
+    indent() << "continue;\n";
+  } else if (RPONumber[Succ] <= RPONumber[CurBB]) {
+    // Back edge to an enclosing loop header.
+    indent() << "continue " << GetValueName(Succ) << ";\n";
+  } else if (MergeBlocks.count(Succ)) {
+    // Forward edge to a merge point following an enclosing labeled block.
+    indent() << "break " << GetValueName(Succ) << ";\n";
+  } else {
+    // Succ is only reachable through this edge, print it in place.
+    printStructuredTree(Succ);
   }
 }
 
+/// printEdge - Print the PHI copies and the jump for the CFG edge from CurBB to
+/// Succ.
+void JsWriter::printEdge(BasicBlock *CurBB, BasicBlock *Succ) {
+  printPHICopiesForSuccessor(CurBB, Succ);
+  printBranchToBlock(CurBB, Succ);
+}
+
 // Branch instruction printing - Avoid printing out a branch to a basic block
 // that immediately succeeds the current one.
 //
 void JsWriter::visitBranchInst(BranchInst &I) {
-
-  if (I.isConditional()) {
-    if (isGotoCodeNecessary(I.getParent(), I.getSuccessor(0))) {
-      Out << "        if (";
+  BasicBlock *BB = I.getParent();
+
+  if (I.isConditional() && I.getSuccessor(0) != I.getSuccessor(1)) {
+    BasicBlock *Succ0 = I.getSuccessor(0), *Succ1 = I.getSuccessor(1);
+    bool Need0 = hasPHICopiesForSuccessor(BB, Succ0) ||
+                 isGotoCodeNecessary(BB, Succ0);
+    bool Need1 = hasPHICopiesForSuccessor(BB, Succ1) ||
+                 isGotoCodeNecessary(BB, Succ1);
+
+    Context.push_back(ControlContext(IfThenElse, 0));
+    if (Need0 && Need1 && getProfileCount(BB, 1) > getProfileCount(BB, 0)) {
+      // The hotter successor gets the first arm.
+      indent() << "if (!";
       writeOperand(I.getCondition());
       Out << ") {\n";
-
-      printPHICopiesForSuccessor (I.getParent(), I.getSuccessor(0), 8);
-      printBranchToBlock(I.getParent(), I.getSuccessor(0), 10);
-
-      if (isGotoCodeNecessary(I.getParent(), I.getSuccessor(1))) {
-        Out << "        } else {\n";
-        printPHICopiesForSuccessor (I.getParent(), I.getSuccessor(1), 8);
-        printBranchToBlock(I.getParent(), I.getSuccessor(1), 10);
+      Indent += 2;
+      printEdge(BB, Succ1);
+      Indent -= 2;
+      indent() << "} else {\n";
+      Indent += 2;
+      printEdge(BB, Succ0);
+      Indent -= 2;
+      indent() << "}\n";
+    } else if (Need0) {
+      indent() << "if (";
+      writeOperand(I.getCondition());
+      Out << ") {\n";
+      Indent += 2;
+      printEdge(BB, Succ0);
+      Indent -= 2;
+
+      if (Need1) {
+        indent() << "} else {\n";
+        Indent += 2;
+        printEdge(BB, Succ1);
+        Indent -= 2;
       }
-    } else {
-      // First goto not necessary, assume second one is...
-      Out << "        if (!";
+      indent() << "}\n";
+    } else if (Need1) {
+      // First goto not necessary, only branch on the second one.
+      indent() << "if (!";
       writeOperand(I.getCondition());
       Out << ") {\n";
-
-      printPHICopiesForSuccessor (I.getParent(), I.getSuccessor(1), 8);
-      printBranchToBlock(I.getParent(), I.getSuccessor(1), 10);
+      Indent += 2;
+      printEdge(BB, Succ1);
+      Indent -= 2;
+      indent() << "}\n";
     }
-
-    Out << "        }\n";
+    Context.pop_back();
   } else {
-    printPHICopiesForSuccessor (I.getParent(), I.getSuccessor(0), 6);
-    printBranchToBlock(I.getParent(), I.getSuccessor(0), 8);
+    printEdge(BB, I.getSuccessor(0));
   }
-  Out << "\n";
+  if (UseDispatcher)
+    Out << "\n";
 }
-
 // PHI nodes get copied into temporary values at the end of predecessor basic
 // blocks.  We now need to copy these temporary values into the REAL value for
 // the PHI.
@@ -2040,6 +6705,18 @@ void JsWriter::visitBinaryOperator(Instruction &I) {
   // binary instructions, shift instructions, setCond instructions.
   assert(!I.getType()->isPointerTy());
 
+  if (CheckedDivision && I.getType()->isIntegerTy(32) &&
+      (I.getOpcode() == Instruction::UDiv ||
+       I.getOpcode() == Instruction::SDiv ||
+       I.getOpcode() == Instruction::URem ||
+       I.getOpcode() == Instruction::SRem)) {
+    printCheckedDivision(I);
+    return;
+  }
+
+  if (Coercions && printCoercedBinaryOperator(I))
+    return;
+
   // If this is a negation operation, print it out as such.  For FP, we don't
   // want to print "-0.0 - X".
   if (BinaryOperator::isNeg(&I)) {
@@ -2099,6 +6776,132 @@ void JsWriter::visitBinaryOperator(Instruction &I) {
   }
 }
 
+/// printCheckedDivision - Print an i32 division or remainder as a call to the
+/// runtime.  Unsigned results come back as positive numbers, which asm.js
+/// coerces to a signed i32.
+void JsWriter::printCheckedDivision(Instruction &I) {
+  const char *Name;
+  switch (I.getOpcode()) {
+  default: llvm_unreachable("Not a division!");
+  case Instruction::UDiv: Name = "udiv"; break;
+  case Instruction::SDiv: Name = "sdiv"; break;
+  case Instruction::URem: Name = "urem"; break;
+  case Instruction::SRem: Name = "srem"; break;
+  }
+  Out << "($rt." << Name << '(';
+  writeOperand(I.getOperand(0));
+  Out << ", ";
+  writeOperand(I.getOperand(1));
+  Out << ')';
+  if (Coercions)
+    Out << " | 0";
+  Out << ')';
+}
+
+/// printCoercedBinaryOperator - Print an integer binary operator of at most
+/// 32 bits so that it wraps like its LLVM counterpart.  i32 results are kept
+/// signed with "|0" and narrower results are masked to their width.  Returns
+/// false for operators left to the generic code.
+bool JsWriter::printCoercedBinaryOperator(Instruction &I) {
+  if (!I.getType()->isIntegerTy())
+    return false;
+  unsigned NumBits = I.getType()->getPrimitiveSizeInBits();
+  if (NumBits > 32)
+    return false;
+
+  bool Narrow = NumBits < 32;
+  uint64_t Mask = (1ULL << NumBits) - 1;
+  Value *LHS = I.getOperand(0), *RHS = I.getOperand(1);
+  switch (I.getOpcode()) {
+  default: llvm_unreachable("Invalid operator type!");
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    writeOperand(LHS);
+    Out << (I.getOpcode() == Instruction::And ? " & " :
+            I.getOpcode() == Instruction::Or ? " | " : " ^ ");
+    writeOperand(RHS);
+    return true;
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Shl:
+    Out << "(";
+    writeOperand(LHS);
+    Out << (I.getOpcode() == Instruction::Add ? " + " :
+            I.getOpcode() == Instruction::Sub ? " - " : " << ");
+    writeOperand(RHS);
+    Out << ")";
+    break;
+  case Instruction::Mul:
+    Out << "Math.imul(";
+    writeOperand(LHS);
+    Out << ", ";
+    writeOperand(RHS);
+    Out << ")";
+    if (!Narrow)
+      return true;
+    break;
+  case Instruction::UDiv:
+  case Instruction::URem:
+  case Instruction::SDiv:
+  case Instruction::SRem: {
+    bool Signed = I.getOpcode() == Instruction::SDiv ||
+                  I.getOpcode() == Instruction::SRem;
+    const char *Op = (I.getOpcode() == Instruction::UDiv ||
+                      I.getOpcode() == Instruction::SDiv) ? " / " : " % ";
+    // A narrow signed result is negative, so it has to be masked once more.
+    bool MaskResult = Signed && Narrow;
+    if (MaskResult)
+      Out << "(";
+    Out << "(";
+    for (unsigned i = 0; i != 2; ++i) {
+      if (i)
+        Out << Op;
+      if (Signed && Narrow)
+        writeSignExtended(I.getOperand(i));
+      else if (!Signed && !Narrow) {
+        Out << "(";
+        writeOperand(I.getOperand(i));
+        Out << " >>> 0)";
+      } else
+        writeOperand(I.getOperand(i));
+    }
+    Out << ") | 0";
+    if (!MaskResult)
+      return true;
+    Out << ")";
+    break;
+  }
+  case Instruction::LShr:
+    Out << "(";
+    writeOperand(LHS);
+    Out << " >>> ";
+    writeOperand(RHS);
+    Out << ")";
+    if (Narrow)
+      return true;
+    break;
+  case Instruction::AShr:
+    Out << "(";
+    if (Narrow)
+      writeSignExtended(LHS);
+    else
+      writeOperand(LHS);
+    Out << " >> ";
+    writeOperand(RHS);
+    Out << ")";
+    if (!Narrow)
+      return true;
+    break;
+  }
+
+  if (Narrow)
+    Out << " & " << Mask;
+  else
+    Out << " | 0";
+  return true;
+}
+
 void JsWriter::visitICmpInst(ICmpInst &I) {
   // We must cast the results of icmp which might be promoted.
   bool needsCast = false;
@@ -2107,7 +6910,9 @@ void JsWriter::visitICmpInst(ICmpInst &I) {
   // if necessary.
   bool NeedsClosingParens = writeInstructionCast(I);
 
-  bool HasPtrOperand = I.getOperand(0)->getType()->isPointerTy() || I.getOperand(1)->getType()->isPointerTy();
+  bool HasPtrOperand = !HeapMemory &&
+    (I.getOperand(0)->getType()->isPointerTy() ||
+     I.getOperand(1)->getType()->isPointerTy());
   // Certain icmp predicate require the operand to be forced to a specific type
   // so we use writeOperandWithCast here instead of writeOperand. Similarly
   // below for operand 1
@@ -2285,38 +7090,46 @@ void JsWriter::visitFCmpInst(FCmpInst &I) {
   }
 }
 
-static const char * getFloatBitCastField(const Type *Ty) {
-  switch (Ty->getTypeID()) {
-    default: llvm_unreachable("Invalid Type");
-    case Type::FloatTyID:  return "Float";
-    case Type::DoubleTyID: return "Double";
-    case Type::IntegerTyID: {
-      unsigned NumBits = cast<IntegerType>(Ty)->getBitWidth();
-      if (NumBits <= 32)
-        return "Int32";
-      else
-        return "Int64";
-    }
-  }
+/// getRuntimeBitCast - Return the runtime function that reinterprets the bits
+/// of a value of type SrcTy as a DstTy.
+static const char *getRuntimeBitCast(const Type *SrcTy, const Type *DstTy) {
+  if (SrcTy->isFloatTy())
+    return "f32_bits";
+  if (SrcTy->isDoubleTy())
+    return "f64_bits";
+  if (DstTy->isFloatTy())
+    return "bits_f32";
+  if (DstTy->isDoubleTy())
+    return "bits_f64";
+  llvm_unreachable("Invalid floating point bitcast");
+  return 0;
 }
 
 void JsWriter::visitCastInst(CastInst &I) {
   const Type *DstTy = I.getType();
   const Type *SrcTy = I.getOperand(0)->getType();
   if (isFPIntBitCast(I)) {
+    // The runtime goes through its scratch typed arrays.
     Out << '(';
-    // These int<->float and long<->double casts need to be handled specially
-    Out << GetValueName(&I) << "__BITCAST_TEMPORARY." 
-        << getFloatBitCastField(I.getOperand(0)->getType()) << " = ";
+    if (Coercions)
+      Out << (DstTy->isIntegerTy() ? "" :
+              Float32 && DstTy->isFloatTy() ? "Math.fround(" : "+");
+    Out << "$rt." << getRuntimeBitCast(SrcTy, DstTy) << '(';
     writeOperand(I.getOperand(0));
-    Out << ", " << GetValueName(&I) << "__BITCAST_TEMPORARY."
-        << getFloatBitCastField(I.getType());
+    Out << ')';
+    if (Coercions)
+      Out << (DstTy->isIntegerTy() ? " | 0" :
+              Float32 && DstTy->isFloatTy() ? ")" : "");
     Out << ')';
     return;
   }
+  if (Coercions && printCoercedCast(I))
+    return;
+
   const Type *MaskTy;
   switch(I.getOpcode()) {
   case Instruction::BitCast:
+  case Instruction::IntToPtr:
   case Instruction::FPExt:
     writeOperand(I.getOperand(0));
     return;
@@ -2346,6 +7159,88 @@ void JsWriter::visitCastInst(CastInst &I) {
   Out << " & " << (1 << MaskTy->getPrimitiveSizeInBits()) - 1 << ')';
 }
 
+/// printCoercedCast - Print an integer or floating point conversion with asm.js
+/// coercions.  Returns false for casts that need no special treatment.
+bool JsWriter::printCoercedCast(CastInst &I) {
+  const Type *DstTy = I.getType();
+  const Type *SrcTy = I.getOperand(0)->getType();
+  Value *Src = I.getOperand(0);
+  unsigned SrcBits = SrcTy->getPrimitiveSizeInBits();
+  unsigned DstBits = DstTy->getPrimitiveSizeInBits();
+
+  switch (I.getOpcode()) {
+  default:
+    return false;
+  case Instruction::Trunc:
+    // Wide integers are held in doubles, which need ~~ to become an i32.
+    Out << "(";
+    if (SrcBits > 32)
+      Out << "~~";
+    writeOperand(Src);
+    if (DstBits < 32)
+      Out << " & " << (1ULL << DstBits) - 1;
+    Out << ")";
+    return true;
+  case Instruction::ZExt:
+    if (SrcBits == 32) {
+      Out << "(";
+      writeOperand(Src);
+      Out << " >>> 0)";
+    } else {
+      Out << "(";
+      writeOperand(Src);
+      Out << " & " << (1ULL << SrcBits) - 1 << ")";
+    }
+    return true;
+  case Instruction::SExt:
+    if (SrcBits == 32) {
+      writeOperand(Src);
+      return true;
+    }
+    if (DstBits < 32)
+      Out << "(";
+    writeSignExtended(Src);
+    if (DstBits < 32)
+      Out << " & " << (1ULL << DstBits) - 1 << ")";
+    return true;
+  case Instruction::FPToSI:
+  case Instruction::FPToUI:
+    if (DstBits > 32) {
+      Out << "(";
+      writeOperand(Src);
+      Out << " < 0 ? Math.ceil(";
+      writeOperand(Src);
+      Out << ") : Math.floor(";
+      writeOperand(Src);
+      Out << "))";
+      return true;
+    }
+    Out << "(~~";
+    writeOperand(Src);
+    if (DstBits < 32)
+      Out << " & " << (1ULL << DstBits) - 1;
+    Out << ")";
+    return true;
+  case Instruction::SIToFP:
+    Out << "+";
+    if (SrcBits < 32)
+      writeSignExtended(Src);
+    else
+      writeOperand(Src);
+    return true;
+  case Instruction::UIToFP:
+    if (SrcBits == 32) {
+      Out << "+(";
+      writeOperand(Src);
+      Out << " >>> 0)";
+    } else {
+      Out << "+";
+      writeOperand(Src);
+    }
+    return true;
+  }
+}
+
 void JsWriter::visitSelectInst(SelectInst &I) {
   Out << "((";
   writeOperand(I.getCondition());
@@ -2386,8 +7281,25 @@ void JsWriter::lowerIntrinsics(Function &F) {
           case Intrinsic::x86_sse2_cmp_sd:
           case Intrinsic::x86_sse2_cmp_pd:
           case Intrinsic::ppc_altivec_lvsl:
+          case Intrinsic::sqrt:
+          case Intrinsic::sin:
+          case Intrinsic::cos:
+          case Intrinsic::pow:
+          case Intrinsic::log:
+          case Intrinsic::log2:
+          case Intrinsic::log10:
+          case Intrinsic::exp:
+          case Intrinsic::exp2:
+          case Intrinsic::eh_exception:
               // We directly implement these intrinsics
             break;
+          case Intrinsic::memcpy:
+          case Intrinsic::memmove:
+          case Intrinsic::memset:
+            // The typed array heap copies and fills blocks natively.
+            if (HeapMemory)
+              break;
+            // FALL THROUGH
           default:
             // If this is an intrinsic that directly corresponds to a GCC
             // builtin, we handle it.
@@ -2434,6 +7346,60 @@ void JsWriter::lowerIntrinsics(Function &F) {
   }
 }
 
+/// JsMathFunctions - The libm functions that are Math builtins in JS, with
+/// their number of arguments.  The float variants end in 'f'.
+namespace {
+  struct JsMathFunction {
+    const char *Name;
+    const char *JsName;
+    unsigned NumArgs;
+  };
+}
+
+static const JsMathFunction JsMathFunctions[] = {
+  { "acos",  "Math.acos",  1 }, { "acosh", "Math.acosh", 1 },
+  { "asin",  "Math.asin",  1 }, { "asinh", "Math.asinh", 1 },
+  { "atan",  "Math.atan",  1 }, { "atan2", "Math.atan2", 2 },
+  { "atanh", "Math.atanh", 1 }, { "cbrt",  "Math.cbrt",  1 },
+  { "ceil",  "Math.ceil",  1 }, { "cos",   "Math.cos",   1 },
+  { "cosh",  "Math.cosh",  1 }, { "exp",   "Math.exp",   1 },
+  { "expm1", "Math.expm1", 1 }, { "fabs",  "Math.abs",   1 },
+  { "floor", "Math.floor", 1 }, { "hypot", "Math.hypot", 2 },
+  { "log",   "Math.log",   1 }, { "log10", "Math.log10", 1 },
+  { "log1p", "Math.log1p", 1 }, { "log2",  "Math.log2",  1 },
+  { "pow",   "Math.pow",   2 }, { "sin",   "Math.sin",   1 },
+  { "sinh",  "Math.sinh",  1 }, { "sqrt",  "Math.sqrt",  1 },
+  { "tan",   "Math.tan",   1 }, { "tanh",  "Math.tanh",  1 },
+  { "trunc", "Math.trunc", 1 }
+};
+
+/// getJsMathFunction - If V is an external libm function that has a Math
+/// builtin, return the name of the builtin.
+static const char *getJsMathFunction(const Value *V) {
+  const Function *F = dyn_cast<Function>(V);
+  if (!F || !F->isDeclaration() || !F->hasExternalLinkage())
+    return 0;
+  const FunctionType *FTy = F->getFunctionType();
+  const Type *Ty = FTy->getReturnType();
+  if ((!Ty->isFloatTy() && !Ty->isDoubleTy()) || FTy->isVarArg())
+    return 0;
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i)
+    if (FTy->getParamType(i) != Ty)
+      return 0;
+
+  StringRef Name = F->getName();
+  if (Ty->isFloatTy()) {
+    if (!Name.endswith("f"))
+      return 0;
+    Name = Name.substr(0, Name.size() - 1);
+  }
+  for (unsigned i = 0, e = array_lengthof(JsMathFunctions); i != e; ++i)
+    if (Name == JsMathFunctions[i].Name)
+      return FTy->getNumParams() == JsMathFunctions[i].NumArgs ?
+             JsMathFunctions[i].JsName : 0;
+  return 0;
+}
+
 void JsWriter::visitCallInst(CallInst &I) {
   if (isa<InlineAsm>(I.getCalledValue()))
     return visitInlineAsm(I);
@@ -2446,23 +7412,60 @@ void JsWriter::visitCallInst(CallInst &I) {
       if (visitBuiltinCall(I, ID, WroteCallee))
         return;
 
-  Value *Callee = I.getCalledValue();
+  printCall(CallSite(&I), WroteCallee);
+}
+
+/// printCall - Print the call or invoke CS.  WroteCallee is set if the callee
+/// has been printed already.
+void JsWriter::printCall(CallSite CS, bool WroteCallee) {
+  Value *Callee = CS.getCalledValue();
 
   const PointerType  *PTy   = cast<PointerType>(Callee->getType());
   const FunctionType *FTy   = cast<FunctionType>(PTy->getElementType());
 
+  // asm.js wants the type of a call result spelled out at the call site.
+  const Type *RetTy = CS.getType();
+  bool IntResult = Coercions &&
+    (RetTy->isIntegerTy() ? RetTy->getPrimitiveSizeInBits() <= 32
+                          : HeapMemory && RetTy->isPointerTy());
+  bool FPResult = Coercions && !IntResult &&
+    (RetTy->isFloatingPointTy() || RetTy->isIntegerTy());
+  if (IntResult)
+    Out << "(";
+  else if (FPResult)
+    Out << "+";
+
   // If this is a call to a struct-return function, assign to the first
   // parameter instead of passing it to the call.
-  const AttrListPtr &PAL = I.getAttributes();
-  bool hasByVal = I.hasByValArgument();
-  bool isStructRet = I.hasStructRetAttr();
+  const AttrListPtr &PAL = CS.getAttributes();
+  // In the typed array heap, byval and sret pointers are passed as is, and
+  // the callee copies its byval arguments.
+  bool hasByVal = !HeapMemory && PAL.hasAttrSomewhere(Attribute::ByVal);
+  bool isStructRet = !HeapMemory &&
+    PAL.paramHasAttr(1, Attribute::StructRet);
   if (isStructRet) {
-    writeOperandDeref(I.getOperand(1));
+    writeOperandDeref(CS.getArgument(0));
     Out << " = ";
   }
   
-  if (I.isTailCall()) Out << " /*tail*/ ";
-  
+  if (CS.isCall() && cast<CallInst>(CS.getInstruction())->isTailCall() &&
+      !Minify)
+    Out << " /*tail*/ ";
+
+  // In the typed array heap, calls to a known function name it whatever its
+  // pointer type, and other calls go through a function table.
+  if (!WroteCallee && HeapMemory) {
+    if (Function *F = dyn_cast<Function>(Callee->stripPointerCasts())) {
+      if (const char *MathName = getJsMathFunction(F))
+        Out << MathName;
+      else
+        Out << GetValueName(F);
+    } else {
+      printFunctionTableCall(Callee, FTy);
+    }
+    WroteCallee = true;
+  }
+
   if (!WroteCallee) {
     // If this is an indirect call to a struct return function, we need to cast
     // the pointer. Ditto for indirect calls with byval arguments.
@@ -2492,28 +7495,36 @@ void JsWriter::visitCallInst(CallInst &I) {
       Out << "((";
       if (isStructRet)
         printStructReturnPointerFunctionType(Out, PAL,
-                             cast<PointerType>(I.getCalledValue()->getType()));
+                             cast<PointerType>(CS.getCalledValue()->getType()));
       else if (hasByVal)
-        printType(Out, I.getCalledValue()->getType(), false, "", true, PAL);
+        printType(Out, CS.getCalledValue()->getType(), false, "", true, PAL);
       else
-        printType(Out, I.getCalledValue()->getType());
+        printType(Out, CS.getCalledValue()->getType());
       Out << ")(void*)";
     }
-    writeOperand(Callee);
+    if (const char *MathName = getJsMathFunction(Callee))
+      Out << MathName;
+    else if (isa<Function>(Callee))
+      Out << GetValueName(Callee);
+    else
+      writeOperand(Callee);
     if (NeedsCast) Out << ')';
   }
 
   Out << '(';
 
   bool PrintedArg = false;
-  if(FTy->isVarArg() && !FTy->getNumParams()) {
-    Out << "0 /*dummy arg*/";
+  bool VarArgsInBuffer = passesVarArgsInBuffer(CS);
+  if(FTy->isVarArg() && !FTy->getNumParams() && !VarArgsInBuffer) {
+    Out << (Minify ? "0" : "0 /*dummy arg*/");
     PrintedArg = true;
   }
 
   unsigned NumDeclaredParams = FTy->getNumParams();
 
-  CallSite::arg_iterator AI = I.op_begin()+1, AE = I.op_end();
+  CallSite::arg_iterator AI = CS.arg_begin(), AE = CS.arg_end();
+  if (VarArgsInBuffer)
+    AE = AI + NumDeclaredParams;
   unsigned ArgNo = 0;
   if (isStructRet) {   // Skip struct return argument.
     ++AI;
@@ -2530,14 +7541,74 @@ void JsWriter::visitCallInst(CallInst &I) {
             /*isSigned=*/PAL.paramHasAttr(ArgNo+1, Attribute::SExt));
       Out << ')';
     }
-    // Check if the argument is expected to be passed by value.
-    if (I.paramHasAttr(ArgNo+1, Attribute::ByVal))
+    // Check if the argument is expected to be passed by value.  Without the
+    // heap, profile counters are registered as the whole array.
+    GlobalVariable *Counters = HeapMemory ? 0 : getProfileCounterArray(*AI);
+    if (hasByVal && CS.paramHasAttr(ArgNo+1, Attribute::ByVal))
       writeOperandDeref(*AI);
+    else if (Counters && ProfileCounters.count(Counters))
+      writeOperand(Counters);
     else
       writeOperand(*AI);
     PrintedArg = true;
   }
+  if (VarArgsInBuffer) {
+    if (PrintedArg) Out << ", ";
+    printVarArgs(AE, CS.arg_end(), HeapMemory &&
+                 !isa<Function>(CS.getCalledValue()->stripPointerCasts()) &&
+                 tableHasExternalVarArgs(FTy));
+  }
+  Out << ')';
+  if (IntResult)
+    Out << " | 0)";
+}
+
+/// printVarArgs - Print the buffer that passes the variadic arguments
+/// [AI, AE) of a call.  Without the heap it is an array, indexed by the
+/// cursor in a va_list.  In the heap the arguments are stored into the slots
+/// of the frame, and the buffer is their address, with the cursor of a
+/// va_list pointing to the next slot.  With Spread the slots are also read
+/// back as separate arguments after the buffer, for the forwarders of the
+/// function tables.
+void JsWriter::printVarArgs(CallSite::arg_iterator AI,
+                            CallSite::arg_iterator AE, bool Spread) {
+  if (!HeapMemory) {
+    Out << '[';
+    for (CallSite::arg_iterator I = AI; I != AE; ++I) {
+      if (I != AI) Out << ", ";
+      writeOperand(*I);
+    }
+    Out << ']';
+    return;
+  }
+  if (AI == AE) {
+    Out << '0';
+    return;
+  }
+  Out << '(';
+  uint64_t Slot = VarArgsOffset;
+  for (CallSite::arg_iterator I = AI; I != AE; ++I, Slot += 8) {
+    bool Double = isDoubleVarArg((*I)->getType());
+    Out << (Double ? "$HEAPF64[($sp" : "$HEAP32[($sp");
+    if (Slot)
+      Out << " + " << Slot;
+    Out << ") >> " << (Double ? 3 : 2) << "] = ";
+    writeOperand(*I);
+    Out << ", ";
+  }
+  Out << "$sp";
+  if (VarArgsOffset)
+    Out << " + " << VarArgsOffset;
   Out << ')';
+  if (!Spread)
+    return;
+  for (Slot = VarArgsOffset; AI != AE; ++AI, Slot += 8) {
+    bool Double = isDoubleVarArg((*AI)->getType());
+    Out << (Double ? ", $HEAPF64[($sp" : ", $HEAP32[($sp");
+    if (Slot)
+      Out << " + " << Slot;
+    Out << ") >> " << (Double ? 3 : 2) << ']';
+  }
 }
 
 /// visitBuiltinCall - Handle the call to the specified builtin.  Returns true
@@ -2564,16 +7635,39 @@ bool JsWriter::visitBuiltinCall(CallInst &I, Intrinsic::ID ID,
     Out << "__sync_synchronize()";
     return true;
   case Intrinsic::vastart:
-    writeOperand(I.getOperand(1));
-    Out << "._ = 0";
+    if (HeapMemory) {
+      Out << "$HEAP32[(";
+      writeOperand(I.getOperand(1));
+      Out << ") >> 2] = $va";
+    } else {
+      writeOperand(I.getOperand(1));
+      Out << ".va = $va, ";
+      writeOperand(I.getOperand(1));
+      Out << "._ = 0";
+    }
     return true;
   case Intrinsic::vaend:
     return true;
+  case Intrinsic::eh_exception:
+    Out << (HasInvoke ? "$exn" : "0");
+    return true;
   case Intrinsic::vacopy:
-    writeOperand(I.getOperand(1));
-    Out << "._ = ";
-    writeOperand(I.getOperand(2));
-    Out << "._";
+    if (HeapMemory) {
+      Out << "$HEAP32[(";
+      writeOperand(I.getOperand(1));
+      Out << ") >> 2] = $HEAP32[(";
+      writeOperand(I.getOperand(2));
+      Out << ") >> 2]";
+    } else {
+      writeOperand(I.getOperand(1));
+      Out << ".va = ";
+      writeOperand(I.getOperand(2));
+      Out << ".va, ";
+      writeOperand(I.getOperand(1));
+      Out << "._ = ";
+      writeOperand(I.getOperand(2));
+      Out << "._";
+    }
     return true;
   case Intrinsic::returnaddress:
     Out << "__builtin_return_address(";
@@ -2585,11 +7679,41 @@ bool JsWriter::visitBuiltinCall(CallInst &I, Intrinsic::ID ID,
     writeOperand(I.getOperand(1));
     Out << ')';
     return true;
+  case Intrinsic::memcpy:
+  case Intrinsic::memmove:
+  case Intrinsic::memset:
+    printHeapMemOp(I, ID);
+    return true;
+  case Intrinsic::sqrt:
+  case Intrinsic::sin:
+  case Intrinsic::cos:
+  case Intrinsic::pow:
   case Intrinsic::powi:
-    Out << "__builtin_powi(";
+  case Intrinsic::log:
+  case Intrinsic::log2:
+  case Intrinsic::log10:
+  case Intrinsic::exp:
+  case Intrinsic::exp2:
+    if (Coercions)
+      Out << '+';
+    switch (ID) {
+    default: llvm_unreachable("Not a Math intrinsic!");
+    case Intrinsic::sqrt:  Out << "Math.sqrt(";  break;
+    case Intrinsic::sin:   Out << "Math.sin(";   break;
+    case Intrinsic::cos:   Out << "Math.cos(";   break;
+    case Intrinsic::pow:
+    case Intrinsic::powi:  Out << "Math.pow(";   break;
+    case Intrinsic::log:   Out << "Math.log(";   break;
+    case Intrinsic::log2:  Out << "Math.log2(";  break;
+    case Intrinsic::log10: Out << "Math.log10("; break;
+    case Intrinsic::exp:   Out << "Math.exp(";   break;
+    case Intrinsic::exp2:  Out << "Math.pow(2, "; break;
+    }
     writeOperand(I.getOperand(1));
-    Out << ", ";
-    writeOperand(I.getOperand(2));
+    if (ID == Intrinsic::pow || ID == Intrinsic::powi) {
+      Out << ", ";
+      writeOperand(I.getOperand(2));
+    }
     Out << ')';
     return true;
   case Intrinsic::setjmp:
@@ -2838,6 +7962,25 @@ void JsWriter::visitInlineAsm(CallInst &CI) {
 }
 
 void JsWriter::visitAllocaInst(AllocaInst &I) {
+  if (HeapMemory) {
+    if (isDirectAlloca(&I)) {
+      Out << "$sp";
+      if (uint64_t Offset = FrameOffsets.lookup(&I))
+        Out << " + " << Offset;
+      return;
+    }
+    // Dynamic allocas bump the stack pointer, keeping it aligned.
+    uint64_t Size = TD->getTypeAllocSize(I.getAllocatedType());
+    Out << "(($STACKTOP = $STACKTOP + ((";
+    writeOperand(I.getArraySize());
+    Out << ") * " << Size << " + " << HeapStackAlign-1 << " & -"
+        << HeapStackAlign << ")) - ((";
+    writeOperand(I.getArraySize());
+    Out << ") * " << Size << " + " << HeapStackAlign-1 << " & -"
+        << HeapStackAlign << "))";
+    return;
+  }
+
   const Type* ElementType = I.getType()->getElementType();
   switch (ElementType->getTypeID()) {
   case Type::IntegerTyID:
@@ -2859,6 +8002,55 @@ void JsWriter::printGEPExpression(Value *Ptr, gep_type_iterator I,
     writeOperand(Ptr);
     return;
   }
+
+  if (HeapMemory) {
+    // Pointers are byte offsets, fold all constant indices into one offset.
+    int64_t Offset = 0;
+    Out << "(";
+    writeOperand(Ptr);
+    for (; I != E; ++I) {
+      Value *Idx = I.getOperand();
+      if (const StructType *STy = dyn_cast<StructType>(*I)) {
+        unsigned Field = cast<ConstantInt>(Idx)->getZExtValue();
+        Offset += TD->getStructLayout(STy)->getElementOffset(Field);
+        continue;
+      }
+      uint64_t Size =
+        TD->getTypeAllocSize(cast<SequentialType>(*I)->getElementType());
+      if (ConstantInt *CI = dyn_cast<ConstantInt>(Idx)) {
+        Offset += CI->getSExtValue() * (int64_t)Size;
+        continue;
+      }
+      Out << " + ";
+      if (Size != 1)
+        Out << "(";
+      writeOperand(Idx, Static);
+      if (Size != 1)
+        Out << ") * " << Size;
+    }
+    if (Offset > 0)
+      Out << " + " << Offset;
+    else if (Offset < 0)
+      Out << " - " << -Offset;
+    Out << ")";
+    return;
+  }
+
+  // A profile counter is an element of a typed array.
+  GlobalVariable *GV = dyn_cast<GlobalVariable>(Ptr);
+  Constant *First = dyn_cast<Constant>(I.getOperand());
+  if (GV && ProfileCounters.count(GV) && First && First->isNullValue()) {
+    gep_type_iterator Counter = I;
+    if (++Counter != E && llvm::next(Counter) == E) {
+      Out << "(";
+      writeOperand(GV);
+      Out << "[";
+      writeOperand(Counter.getOperand(), Static);
+      Out << "])";
+      return;
+    }
+  }
+
   Out << "(";
   gep_type_iterator N = I;
   ++N;
@@ -2908,13 +8100,241 @@ void JsWriter::writeMemoryAccess(Value *Operand, const Type *OperandType,
   }
 }
 
+/// printHeapElement - Print the typed array element holding the value of type
+/// Ty stored at Ptr + Offset.  The address must be aligned for Ty.
+void JsWriter::printHeapElement(Value *Ptr, const Type *Ty, unsigned Offset) {
+  const char *View;
+  unsigned Shift;
+  switch (Ty->getTypeID()) {
+  case Type::FloatTyID:   View = "$HEAPF32"; Shift = 2; break;
+  case Type::DoubleTyID:  View = "$HEAPF64"; Shift = 3; break;
+  case Type::PointerTyID: View = "$HEAP32"; Shift = 2; break;
+  case Type::IntegerTyID: {
+    unsigned NumBits = cast<IntegerType>(Ty)->getBitWidth();
+    if (NumBits <= 8) {
+      View = "$HEAPU8"; Shift = 0;
+    } else if (NumBits <= 16) {
+      View = "$HEAPU16"; Shift = 1;
+    } else if (NumBits <= 32) {
+      View = "$HEAP32"; Shift = 2;
+    } else
+      llvm_unreachable("Wide integers are split by the caller");
+    break;
+  }
+  default:
+    report_fatal_error("The Javascript backend does not support loads and "
+                       "stores of aggregate or vector values in the heap.");
+  }
+
+  Out << View << '[';
+  if (Shift)
+    Out << '(';
+  writeOperand(Ptr);
+  if (Offset)
+    Out << " + " << Offset;
+  if (Shift)
+    Out << ") >> " << Shift;
+  Out << ']';
+}
+
+/// printHeapMemOp - Print the memcpy, memmove or memset I in the typed array
+/// heap.  Small copies and fills of a constant size are unrolled into element
+/// stores as wide as the alignment allows, one statement each.  The rest are
+/// copyWithin and fill calls on $HEAPU8, and copyWithin handles overlapping
+/// ranges like memmove.  Either way the pointers are printed more than once,
+/// so they are never inlined.
+void JsWriter::printHeapMemOp(CallInst &I, Intrinsic::ID ID) {
+  Value *Dst = I.getOperand(1), *Src = I.getOperand(2), *Len = I.getOperand(3);
+  ConstantInt *Size = dyn_cast<ConstantInt>(Len);
+  bool IsSet = ID == Intrinsic::memset;
+
+  // Unrolling prints the pointers once per element.
+  bool Unroll = ID != Intrinsic::memmove && Size &&
+                Size->getZExtValue() <= MaxUnrolledMemOpBytes &&
+                isCheapToReprint(Dst) &&
+                (IsSet ? isa<ConstantInt>(Src) : isCheapToReprint(Src));
+
+  if (!Unroll) {
+    Out << (IsSet ? "$HEAPU8.fill(" : "$HEAPU8.copyWithin(");
+    writeOperand(IsSet ? Src : Dst);
+    Out << ", ";
+    writeOperand(IsSet ? Dst : Src);
+    Out << ", ";
+    writeOperand(IsSet ? Dst : Src);
+    Out << " + ";
+    writeOperand(Len);
+    Out << ')';
+    return;
+  }
+
+  LLVMContext &Ctx = I.getContext();
+  unsigned Align = cast<ConstantInt>(I.getOperand(4))->getZExtValue();
+  unsigned Width = Align >= 4 ? 4 : Align >= 2 ? 2 : 1;
+  uint64_t Byte = IsSet ? cast<ConstantInt>(Src)->getZExtValue() & 0xFF : 0;
+  for (uint64_t Offset = 0, End = Size->getZExtValue(); Offset != End;
+       Offset += Width) {
+    while (Offset + Width > End)
+      Width /= 2;
+    const Type *Ty = IntegerType::get(Ctx, Width * 8);
+    if (Offset) {
+      Out << ";\n";
+      indent();
+    }
+    printHeapElement(Dst, Ty, Offset);
+    Out << " = ";
+    if (IsSet)
+      Out << int32_t(Byte * (Width == 4 ? 0x01010101 : Width == 2 ? 0x0101 : 1));
+    else
+      printHeapElement(Src, Ty, Offset);
+  }
+}
+
+/// printHeapLoad - Print an expression for the value of type Ty loaded from
+/// Ptr + Offset.  Unaligned values are assembled byte by byte.
+void JsWriter::printHeapLoad(Value *Ptr, const Type *Ty, unsigned Offset,
+                             unsigned Alignment) {
+  if (Ty->isIntegerTy(64)) {
+    // An i64 is kept in a double, like in the rest of the backend.
+    Out << "((";
+    printHeapLoad(Ptr, Type::getInt32Ty(Ty->getContext()), Offset, Alignment);
+    Out << ") >>> 0) + (";
+    printHeapLoad(Ptr, Type::getInt32Ty(Ty->getContext()), Offset + 4,
+                  Alignment);
+    Out << ") * 4294967296";
+    return;
+  }
+
+  unsigned Size = TD->getTypeStoreSize(Ty);
+  if (isAlignedHeapAccess(Ty, Alignment)) {
+    printHeapElement(Ptr, Ty, Offset);
+    return;
+  }
+
+  const Type *ByteTy = Type::getInt8Ty(Ty->getContext());
+  if (Ty->isIntegerTy()) {
+    Out << '(';
+    for (unsigned i = 0; i != Size; ++i) {
+      if (i)
+        Out << " | ";
+      printHeapElement(Ptr, ByteTy, Offset + i);
+      if (i)
+        Out << " << " << 8*i;
+    }
+    Out << ')';
+    return;
+  }
+
+  // Copy floating point values to the aligned scratch space first.
+  Out << '(';
+  for (unsigned i = 0; i != Size; ++i) {
+    Out << "$HEAPU8[" << HeapScratchAddr + i << "] = ";
+    printHeapElement(Ptr, ByteTy, Offset + i);
+    Out << ", ";
+  }
+  if (Ty->isFloatTy())
+    Out << "$HEAPF32[" << HeapScratchAddr/4 << "])";
+  else
+    Out << "$HEAPF64[" << HeapScratchAddr/8 << "])";
+}
+
+/// isAlignedHeapAccess - Return true if a value of type Ty at an address
+/// with the given alignment can go through the typed array view of Ty.  A
+/// view only reaches the multiples of its element size, whatever alignment
+/// the data layout gives Ty.
+bool JsWriter::isAlignedHeapAccess(const Type *Ty, unsigned Alignment) const {
+  unsigned Size = TD->getTypeStoreSize(Ty);
+  if (!Alignment)
+    Alignment = TD->getABITypeAlignment(Ty);
+  return Size == 1 || Alignment >= Size;
+}
+
+/// isSplitHeapStore - Return true if the heap store SI is printed as a store
+/// of each of its parts, which prints the operands again for every part.
+bool JsWriter::isSplitHeapStore(const StoreInst &SI) const {
+  const Type *Ty = SI.getOperand(0)->getType();
+  return HeapMemory &&
+         (Ty->isIntegerTy(64) || !isAlignedHeapAccess(Ty, SI.getAlignment()));
+}
+
+/// printHeapStore - Print the statement storing Val to Ptr.
+void JsWriter::printHeapStore(Value *Ptr, Value *Val, unsigned Alignment) {
+  const Type *Ty = Val->getType();
+  unsigned Size = TD->getTypeStoreSize(Ty);
+  const Type *ByteTy = Type::getInt8Ty(Ty->getContext());
+
+  if (Ty->isIntegerTy(64)) {
+    // Split the double holding the i64 into two words.
+    const Type *WordTy = Type::getInt32Ty(Ty->getContext());
+    bool Aligned = !Alignment || Alignment >= 4;
+    for (unsigned w = 0; w != 2; ++w) {
+      for (unsigned i = 0, e = Aligned ? 1 : 4; i != e; ++i) {
+        if (w || i)
+          Out << ", ";
+        if (Aligned)
+          printHeapElement(Ptr, WordTy, 4*w);
+        else
+          printHeapElement(Ptr, ByteTy, 4*w + i);
+        Out << " = ";
+        if (w)
+          Out << "Math.floor(";
+        writeOperand(Val);
+        if (w)
+          Out << " / 4294967296)";
+        if (!Aligned && i)
+          Out << " >> " << 8*i;
+      }
+    }
+    return;
+  }
+
+  if (isAlignedHeapAccess(Ty, Alignment)) {
+    printHeapElement(Ptr, Ty, 0);
+    Out << " = ";
+    writeOperand(Val);
+    return;
+  }
+
+  if (Ty->isIntegerTy()) {
+    for (unsigned i = 0; i != Size; ++i) {
+      if (i)
+        Out << ", ";
+      printHeapElement(Ptr, ByteTy, i);
+      Out << " = ";
+      writeOperand(Val);
+      if (i)
+        Out << " >> " << 8*i;
+    }
+    return;
+  }
+
+  // Go through the aligned scratch space for floating point values.
+  if (Ty->isFloatTy())
+    Out << "$HEAPF32[" << HeapScratchAddr/4 << "] = ";
+  else
+    Out << "$HEAPF64[" << HeapScratchAddr/8 << "] = ";
+  writeOperand(Val);
+  for (unsigned i = 0; i != Size; ++i) {
+    Out << ", ";
+    printHeapElement(Ptr, ByteTy, i);
+    Out << " = $HEAPU8[" << HeapScratchAddr + i << "]";
+  }
+}
+
 void JsWriter::visitLoadInst(LoadInst &I) {
+  if (HeapMemory) {
+    printHeapLoad(I.getOperand(0), I.getType(), 0, I.getAlignment());
+    return;
+  }
   writeMemoryAccess(I.getOperand(0), I.getType(), I.isVolatile(),
                     I.getAlignment());
 
 }
 
 void JsWriter::visitStoreInst(StoreInst &I) {
+  if (HeapMemory) {
+    printHeapStore(I.getPointerOperand(), I.getOperand(0), I.getAlignment());
+    return;
+  }
   writeMemoryAccess(I.getPointerOperand(), I.getOperand(0)->getType(),
                     I.isVolatile(), I.getAlignment());
   Out << " = ";
@@ -2924,7 +8344,7 @@ void JsWriter::visitStoreInst(StoreInst &I) {
     if (!ITy->isPowerOf2ByteWidth())
       // We have a bit width that doesn't match an even power-of-2 byte
       // size. Consequently we must & the value with the type's bit mask
-      BitMask = ConstantInt::get(ITy, ITy->getBitMask());
+      BitMask = getUniquedBitMask(ITy);
   if (BitMask)
     Out << "((";
   writeOperand(Operand);
@@ -2941,8 +8361,15 @@ void JsWriter::visitGetElementPtrInst(GetElementPtrInst &I) {
 }
 
 void JsWriter::visitVAArgInst(VAArgInst &I) {
-  
-  Out << "arguments[";
+  if (HeapMemory) {
+    bool Double = isDoubleVarArg(I.getType());
+    Out << (Double ? "$HEAPF64[$va_arg(" : "$HEAP32[$va_arg(");
+    writeOperand(I.getOperand(0));
+    Out << ") >> " << (Double ? 3 : 2) << ']';
+    return;
+  }
+  writeOperand(I.getOperand(0));
+  Out << ".va[";
   writeOperand(I.getOperand(0));
   Out << "._++]";
 }
@@ -2952,7 +8379,7 @@ void JsWriter::visitInsertElementInst(InsertElementInst &I) {
   writeOperand(I.getOperand(0));
   Out << ";\n  ";
   Out << "((";
-  printType(Out, PointerType::getUnqual(EltTy));
+  printType(Out, getUniquedPointerTo(EltTy));
   Out << ")(&" << GetValueName(&I) << "))[";
   writeOperand(I.getOperand(2));
   Out << "] = (";
@@ -2965,7 +8392,7 @@ void JsWriter::visitExtractElementInst(ExtractElementInst &I) {
   Out << "((";
   const Type *EltTy = 
     cast<VectorType>(I.getOperand(0)->getType())->getElementType();
-  printType(Out, PointerType::getUnqual(EltTy));
+  printType(Out, getUniquedPointerTo(EltTy));
   Out << ")(&" << GetValueName(I.getOperand(0)) << "))[";
   writeOperand(I.getOperand(1));
   Out << "]";
@@ -2983,13 +8410,13 @@ void JsWriter::visitShuffleVectorInst(ShuffleVectorInst &SVI) {
     if (i) Out << ", ";
     int SrcVal = SVI.getMaskValue(i);
     if ((unsigned)SrcVal >= NumElts*2) {
-      Out << " 0/*undef*/ ";
+      Out << (Minify ? "0" : " 0/*undef*/ ");
     } else {
       Value *Op = SVI.getOperand((unsigned)SrcVal >= NumElts);
       if (isa<Instruction>(Op)) {
         // Do an extractelement of this value from the appropriate input.
         Out << "((";
-        printType(Out, PointerType::getUnqual(EltTy));
+        printType(Out, getUniquedPointerTo(EltTy));
         Out << ")(&" << GetValueName(Op)
             << "))[" << (SrcVal & (NumElts-1)) << "]";
       } else if (isa<ConstantAggregateZero>(Op) || isa<UndefValue>(Op)) {
@@ -3004,36 +8431,137 @@ void JsWriter::visitShuffleVectorInst(ShuffleVectorInst &SVI) {
   Out << "}";
 }
 
-void JsWriter::visitInsertValueInst(InsertValueInst &IVI) {
-  // Start by copying the entire aggregate value into the result variable.
-  writeOperand(IVI.getOperand(0));
-  Out << ";\n  ";
+/// findAggregateElement - Find the value at the position Idx[0..NumIdx) of
+/// Agg, looking through the insertvalue chain Top and the scalarized chains,
+/// undef and zero aggregates Agg is built from.  Returns the value along with
+/// the number of trailing indices it still has to be indexed with, or null if
+/// the position is only partly set by a chain and has to be built element by
+/// element.
+Value *JsWriter::findAggregateElement(Value *Agg, const unsigned *Idx,
+                                      unsigned NumIdx, unsigned &Rest,
+                                      const InsertValueInst *Top) {
+  for (;;) {
+    InsertValueInst *IVI = dyn_cast<InsertValueInst>(Agg);
+    if (!IVI || (IVI != Top && !isScalarizedAggregate(*IVI)))
+      break;
+    if (NumIdx == 0)
+      return 0;
+    const unsigned *Ins = IVI->idx_begin();
+    unsigned NumIns = IVI->getNumIndices(), Common = 0;
+    while (Common != NumIns && Common != NumIdx && Ins[Common] == Idx[Common])
+      ++Common;
+    if (Common == NumIns) {
+      Agg = IVI->getInsertedValueOperand();
+      Idx += NumIns;
+      NumIdx -= NumIns;
+    } else if (Common == NumIdx) {
+      return 0;
+    } else {
+      Agg = IVI->getAggregateOperand();
+    }
+  }
 
-  // Then do the insert to update the field.
-  Out << GetValueName(&IVI);
-  for (const unsigned *b = IVI.idx_begin(), *i = b, *e = IVI.idx_end();
-       i != e; ++i) {
-    const Type *IndexedTy =
-      ExtractValueInst::getIndexedType(IVI.getOperand(0)->getType(), b, i+1);
-    if (IndexedTy->isArrayTy())
-      Out << ".array[" << *i << "]";
-    else
-      Out << ".field" << *i;
+  if (NumIdx && (isa<UndefValue>(Agg) || isa<ConstantAggregateZero>(Agg))) {
+    const Type *Ty =
+      ExtractValueInst::getIndexedType(Agg->getType(), Idx, Idx + NumIdx);
+    if (Ty->isStructTy() || Ty->isArrayTy())
+      return 0;
+    Agg = isa<UndefValue>(Agg) ? getUniquedUndef(Ty)
+                               : getUniquedNullValue(Ty);
+    NumIdx = 0;
+  }
+  Rest = NumIdx;
+  return Agg;
+}
+
+/// printAggregateElement - Print the element of Agg at Path, either as an
+/// operand indexed with the trailing part of Path or as an array literal
+/// built from the elements of the chain it comes from.
+void JsWriter::printAggregateElement(Value *Agg,
+                                     SmallVectorImpl<unsigned> &Path,
+                                     const InsertValueInst *Top) {
+  unsigned Rest;
+  Value *V = findAggregateElement(Agg, Path.begin(), Path.size(), Rest, Top);
+  if (!V) {
+    printAggregateElements(Agg, Path, Top);
+    return;
+  }
+  writeOperand(V);
+  for (unsigned i = Path.size() - Rest, e = Path.size(); i != e; ++i)
+    Out << '[' << Path[i] << ']';
+}
+
+/// printAggregateElements - Print an array literal of the elements of the
+/// aggregate at Path within Agg.
+void JsWriter::printAggregateElements(Value *Agg,
+                                      SmallVectorImpl<unsigned> &Path,
+                                      const InsertValueInst *Top) {
+  const Type *Ty = ExtractValueInst::getIndexedType(Agg->getType(),
+                                                    Path.begin(), Path.end());
+  unsigned NumElts = Ty->isStructTy() ? cast<StructType>(Ty)->getNumElements()
+                                      : cast<ArrayType>(Ty)->getNumElements();
+  Out << '[';
+  for (unsigned i = 0; i != NumElts; ++i) {
+    if (i)
+      Out << ", ";
+    Path.push_back(i);
+    printAggregateElement(Agg, Path, Top);
+    Path.pop_back();
+  }
+  Out << ']';
+}
+
+/// printReturnSlot - Print the array that F returns its aggregates in.  The
+/// caller reads the elements right after the call, so one array per function
+/// is enough.
+void JsWriter::printReturnSlot(Function &F) {
+  if (!hasReturnSlot(F))
+    return;
+  Out << "var " << getReturnSlotName(&F) << " = ";
+  SmallVector<unsigned, 4> Path;
+  printAggregateElements(getUniquedNullValue(F.getReturnType()), Path, 0);
+  Out << ";\n";
+}
+
+/// printReturnSlotStores - Store the scalar elements of RV below Path into
+/// the return slot Slot.
+void JsWriter::printReturnSlotStores(Value *RV, const Type *Ty,
+                                     SmallVectorImpl<unsigned> &Path,
+                                     const std::string &Slot) {
+  if (Ty->isStructTy() || Ty->isArrayTy()) {
+    const CompositeType *CTy = cast<CompositeType>(Ty);
+    unsigned NumElts = Ty->isStructTy()
+      ? cast<StructType>(Ty)->getNumElements()
+      : cast<ArrayType>(Ty)->getNumElements();
+    for (unsigned i = 0; i != NumElts; ++i) {
+      Path.push_back(i);
+      printReturnSlotStores(RV, CTy->getTypeAtIndex(i), Path, Slot);
+      Path.pop_back();
+    }
+    return;
   }
+  indent() << Slot;
+  for (unsigned i = 0, e = Path.size(); i != e; ++i)
+    Out << '[' << Path[i] << ']';
   Out << " = ";
-  writeOperand(IVI.getOperand(1));
+  printAggregateElement(RV, Path, 0);
+  Out << ";\n";
+}
+
+void JsWriter::visitInsertValueInst(InsertValueInst &IVI) {
+  // Build a fresh array instead of updating a copy of the aggregate, which
+  // would still share its nested arrays with the original.
+  SmallVector<unsigned, 4> Path;
+  printAggregateElements(&IVI, Path, &IVI);
 }
 
 void JsWriter::visitExtractValueInst(ExtractValueInst &EVI) {
   Out << "(";
-  if (isa<UndefValue>(EVI.getOperand(0))) {
+  if (isa<UndefValue>(EVI.getAggregateOperand())) {
     Out << "null";
   } else {
-    writeOperand(EVI.getOperand(0));
-    for (const unsigned *b = EVI.idx_begin(), *i = b, *e = EVI.idx_end();
-         i != e; ++i) {
-      Out << "[" << *i << "]";
-    }
+    SmallVector<unsigned, 4> Path(EVI.idx_begin(), EVI.idx_end());
+    printAggregateElement(EVI.getAggregateOperand(), Path, 0);
   }
   Out << ")";
 }
@@ -3042,23 +8570,76 @@ void JsWriter::visitExtractValueInst(ExtractValueInst &EVI) {
 //                       External Interface declaration
 //===----------------------------------------------------------------------===//
 
+JsTargetLowering::JsTargetLowering(const TargetMachine &TM)
+  : TargetLowering(TM, new TargetLoweringObjectFileELF()) {}
+
+/// isLegalAddressingMode - A heap access costs nothing beyond its address, a
+/// constant offset from one value.  Adding a second value or scaling one takes
+/// another operator.
+bool JsTargetLowering::isLegalAddressingMode(const AddrMode &AM,
+                                             const Type *Ty) const {
+  if (!isInt<32>(AM.BaseOffs))
+    return false;
+  switch (AM.Scale) {
+  case 0:
+    return true;
+  case 1:
+    return !AM.HasBaseReg;
+  default:
+    return false;
+  }
+}
+
+/// isLegalICmpImmediate - Any 32-bit integer can be compared against.
+bool JsTargetLowering::isLegalICmpImmediate(int64_t Imm) const {
+  return isInt<32>(Imm);
+}
+
+/// isTruncateFree - Truncating an i64 to its low word is free in the heap,
+/// which keeps the words of an i64 apart.  Narrower integers need a mask.
+bool JsTargetLowering::isTruncateFree(const Type *Ty1, const Type *Ty2) const {
+  return HeapMemory && Ty1->isIntegerTy(64) && Ty2->isIntegerTy(32);
+}
+
 bool JsTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
 					  formatted_raw_ostream &o,
 					  CodeGenFileType FileType,
 					  CodeGenOpt::Level OptLevel,
 					  bool DisableVerify) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
+  // Coerced code lives in a typed array heap, with i64 values split in words.
+  if (Coercions)
+    HeapMemory = true;
+  // The profile only matches the CFG it was collected on.
+  if (ProfileLayout) {
+    PM.add(createProfileLoaderPass());
+    PM.add(new JsAnnotateProfile());
+  }
+  // Pruning follows the profile, which numbers the edges of every function.
+  if (!ExportsFile.empty())
+    PM.add(new JsPruneExports(DataLayout));
   switch(OptLevel) {
   case CodeGenOpt::None:
+    if (Coercions)
+      PM.add(new JsLegalizeI64(DataLayout));
     PM.add(new JsBackendNameAllUsedStructsAndMergeFunctions());
-    PM.add(new JsWriter(o));
+    if (splitChunks())
+      PM.add(new JsSplitChunks());
+    PM.add(new JsWriter(o, OptLevel, DataLayout));
     break;
   default:
     PM.add(createGCLoweringPass());
-    PM.add(createLowerInvokePass());
-    PM.add(createCFGSimplificationPass());   // clean up after lower invoke.
+    // Heap addresses are integers that strength reduction can step through.
+    if (HeapMemory)
+      PM.add(createLoopStrengthReducePass(getTargetLowering()));
+    PM.add(createCFGSimplificationPass());
+    PM.add(new JsScalarizeAggregates());
+    if (Coercions)
+      PM.add(new JsLegalizeI64(DataLayout));
     PM.add(new JsBackendNameAllUsedStructsAndMergeFunctions());
-    PM.add(new JsWriter(o));
+    if (splitChunks())
+      PM.add(new JsSplitChunks());
+    PM.add(new JsWriter(o, OptLevel, DataLayout));
     PM.add(createGCInfoDeleter());
   }
 
@@ -16,15 +16,37 @@
 
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetLowering.h"
 
 namespace llvm {
 
 class formatted_raw_ostream;
 
+/// JsTargetLowering - Answers the questions the loop optimizations ask about
+/// the cost of addresses, immediates and truncations in the printed code.
+/// There is no instruction selection behind it.
+class JsTargetLowering : public TargetLowering {
+public:
+  explicit JsTargetLowering(const TargetMachine &TM);
+
+  virtual bool isLegalAddressingMode(const AddrMode &AM, const Type *Ty) const;
+  virtual bool isLegalICmpImmediate(int64_t Imm) const;
+  virtual bool isTruncateFree(const Type *Ty1, const Type *Ty2) const;
+
+  virtual unsigned getFunctionAlignment(const Function *F) const { return 0; }
+};
+
 struct JsTargetMachine : public TargetMachine {
+  const TargetData DataLayout;       // Calculates type size & alignment
+  JsTargetLowering TLInfo;
+
   JsTargetMachine(const Target &T, const std::string &TT,
                    const std::string &FS)
-    : TargetMachine(T) {}
+    : TargetMachine(T),
+      // Heap addresses are 32-bit, and only 32-bit integers are native.
+      DataLayout("e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:32:64-"
+                 "f32:32:32-f64:64:64-n32"),
+      TLInfo(*this) {}
 
   virtual bool addPassesToEmitFile(PassManagerBase &PM,
 				   formatted_raw_ostream &Out,
@@ -32,7 +54,10 @@ struct JsTargetMachine : public TargetMachine {
 				   CodeGenOpt::Level OptLevel,
 				   bool DisableVerify);
 
-  virtual const TargetData *getTargetData() const { return 0; }
+  virtual const TargetData *getTargetData() const { return &DataLayout; }
+  virtual const JsTargetLowering *getTargetLowering() const {
+    return &TLInfo;
+  }
 };
 
 extern Target TheJsBackendTarget;
@@ -0,0 +1,36 @@
+; RUN: llc < %s -march=js -js-local-bindings | FileCheck %s
+; RUN: llc < %s -march=js -js-local-bindings -js-heap | FileCheck %s -check-prefix=HEAP
+
+; Module members are closure locals, and only externally visible ones are
+; published on the module object.
+
+; CHECK: var g = 5, h = 6;
+; CHECK: Object.defineProperty(_, "g", {get: function() { return g; }, set: function(v) { g = v; }, enumerable: true});
+; CHECK-NOT: _.h
+; HEAP: var g = 16, h = 20;
+; HEAP: _.g = g;
+; HEAP-NOT: _.h
+; HEAP: Module Methods
+@g = global i32 5
+@h = internal global i32 6
+
+; CHECK: function bar(llvm_cbe_x) {
+; CHECK: return ((llvm_cbe_x + (g)) + (h));
+; CHECK: }
+; CHECK-NOT: _.bar
+define internal i32 @bar(i32 %x) {
+  %v = load i32* @g
+  %w = load i32* @h
+  %a = add i32 %x, %v
+  %b = add i32 %a, %w
+  ret i32 %b
+}
+
+; CHECK: function foo(llvm_cbe_x) {
+; CHECK: llvm_cbe_r = bar(llvm_cbe_x);
+; CHECK: }
+; CHECK-NEXT: _.foo = foo;
+define i32 @foo(i32 %x) {
+  %r = call i32 @bar(i32 %x)
+  ret i32 %r
+}
@@ -0,0 +1,52 @@
+; RUN: rm -rf %t.dir
+; RUN: llc < %s -march=js -o %t
+; RUN: llc < %s -march=js -js-cache-dir=%t.dir -stats -o %t1 |& grep "3 js-backend *- Number of functions printed and added to the JS cache"
+; RUN: llc < %s -march=js -js-cache-dir=%t.dir -stats -o %t2 |& grep "3 js-backend *- Number of functions reused from the JS cache"
+; RUN: diff %t %t1
+; RUN: diff %t %t2
+; RUN: llc < %s -march=js -js-cache-dir=%t.dir -js-threads=2 -o %t3
+; RUN: diff %t %t3
+; RUN: llc < %s -march=js -js-heap -o %t
+; RUN: llc < %s -march=js -js-heap -js-cache-dir=%t.dir -stats -o %t4 |& grep "3 js-backend *- Number of functions printed and added to the JS cache"
+; RUN: diff %t %t4
+
+; Functions whose IR, and whatever the backend knows about the types and
+; globals they use, are unchanged reuse the text a previous run printed.  The
+; output is the same as without the cache.  The options are part of the key.
+
+%struct.S = type { i32, double }
+
+@g = global %struct.S zeroinitializer
+@0 = internal global i32 7
+
+define i32 @first(i32 %n) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %0 = phi i32 [ 0, %entry ], [ %1, %loop ]
+  %1 = add i32 %0, 1
+  %c = icmp slt i32 %1, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %1
+}
+
+define double @second(%struct.S* %p) nounwind {
+  %q = getelementptr %struct.S* %p, i32 0, i32 1
+  %d = load double* %q
+  %i = load i32* @0
+  %f = sitofp i32 %i to double
+  %r = fadd double %d, 1.5
+  %s = fadd double %r, %f
+  ret double %s
+}
+
+define double @third() nounwind {
+  %a = call i32 @first(i32 3)
+  %b = call double @second(%struct.S* @g)
+  %c = sitofp i32 %a to double
+  %d = fadd double %b, %c
+  ret double %d
+}
@@ -0,0 +1,50 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -o %t2
+; RUN: llc < %s -march=js | FileCheck %s
+
+; Loop induction variables share a local with their increments, so the
+; back edge needs no copies and no PHI shadows are declared.
+define i32 @sum(i32 %n) nounwind readnone {
+; CHECK: function sum(
+; CHECK-NEXT: var llvm_cbe_i, llvm_cbe_s;
+; CHECK-NOT: _ =
+; CHECK: llvm_cbe_s = llvm_cbe_s + llvm_cbe_i;
+; CHECK: llvm_cbe_i = llvm_cbe_i + 1;
+; CHECK: return llvm_cbe_s;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %s.next = add i32 %s, %i
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
+
+; Swapping PHIs form a copy cycle that is broken with a single shadow.
+define i32 @fib(i32 %n) nounwind readnone {
+; CHECK: function fib(
+; CHECK-NEXT: var llvm_cbe_a, llvm_cbe_a_, llvm_cbe_b, llvm_cbe_i;
+; CHECK: llvm_cbe_a = llvm_cbe_a_;
+; CHECK: llvm_cbe_a_ = llvm_cbe_b;   /* for PHI node */
+; CHECK-NEXT: llvm_cbe_b = (llvm_cbe_a + llvm_cbe_b);   /* for PHI node */
+entry:
+  br label %loop
+
+loop:
+  %a = phi i32 [ 0, %entry ], [ %b, %loop ]
+  %b = phi i32 [ 1, %entry ], [ %ab, %loop ]
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %ab = add i32 %a, %b
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %a
+}
@@ -0,0 +1,47 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -js-coercions -O0 -o coercions.js
+; RUN: llc < %s -march=js -js-coercions -O0 | FileCheck %s
+
+define i32 @arith(i32 %a, i32 %b) {
+; CHECK: function arith(
+; CHECK-NEXT: llvm_cbe_a = llvm_cbe_a | 0;
+; CHECK-NEXT: llvm_cbe_b = llvm_cbe_b | 0;
+; CHECK: return ((((Math.imul(((llvm_cbe_a + llvm_cbe_b) | 0), llvm_cbe_b)) / llvm_cbe_b) | 0) ^ (((llvm_cbe_a >>> 0) % (llvm_cbe_b >>> 0)) | 0)) | 0;
+  %s = add i32 %a, %b
+  %m = mul i32 %s, %b
+  %d = sdiv i32 %m, %b
+  %r0 = urem i32 %a, %b
+  %r = xor i32 %d, %r0
+  ret i32 %r
+}
+
+define i8 @narrow(i8 %a, i8 %b) {
+; CHECK: function narrow(
+; CHECK: (llvm_cbe_a + llvm_cbe_b) & 255
+; CHECK: (((llvm_cbe_a << 24 >> 24) / (llvm_cbe_b << 24 >> 24)) | 0) & 255
+  %s = add i8 %a, %b
+  %d = sdiv i8 %a, %b
+  %r = xor i8 %s, %d
+  ret i8 %r
+}
+
+define i32 @unsigned_cmp(i32 %a, i32 %b) {
+; CHECK: function unsigned_cmp(
+; CHECK: (llvm_cbe_a >>> 0) < (llvm_cbe_b >>> 0)
+  %c = icmp ult i32 %a, %b
+  %r = select i1 %c, i32 %a, i32 %b
+  ret i32 %r
+}
+
+define double @convert(i32 %a, double %x) {
+; CHECK: function convert(
+; CHECK: llvm_cbe_x = +llvm_cbe_x;
+; CHECK: (arith(((~~llvm_cbe_x)), 3) | 0)
+; CHECK: return +((+(llvm_cbe_a >>> 0)) + (+llvm_cbe_c));
+  %f = uitofp i32 %a to double
+  %i = fptosi double %x to i32
+  %c = call i32 @arith(i32 %i, i32 3)
+  %g = sitofp i32 %c to double
+  %r = fadd double %f, %g
+  ret double %r
+}
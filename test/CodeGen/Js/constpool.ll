@@ -0,0 +1,59 @@
+; RUN: llc < %s -march=js -js-heap | FileCheck %s
+; RUN: llc < %s -march=js -js-heap -stats |& grep "24 js-backend *- Number of bytes of aggregate constants in the constant pool"
+; RUN: llc < %s -march=js -js-heap -stats |& grep "2 js-backend *- Number of uses of pooled constants after the first"
+; RUN: llc < %s -march=js | FileCheck %s -check-prefix=NOHEAP
+
+; In the heap, aggregate constants are printed once at module level and their
+; uses share the array.  Without the heap an array may become the memory that
+; a pointer writes through, so every use gets its own.
+
+%S = type { i32, double }
+
+declare void @use(%S)
+declare void @use2([2 x i32])
+
+; CHECK: Constant Pool
+; CHECK-NEXT: var $C0 = [7, 1.5];
+; CHECK-NEXT: var $C1 = [1, 2];
+; CHECK: Module Methods
+; NOHEAP-NOT: Constant Pool
+; NOHEAP: Module Methods
+
+; CHECK: function f(
+; CHECK: use($C0);
+; CHECK: use2($C1);
+; CHECK: use($C0);
+; NOHEAP: function f(
+; NOHEAP: use([7, 1.5]);
+define void @f(i32 %n) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %loop ]
+  call void @use(%S { i32 7, double 1.5 })
+  call void @use2([2 x i32] [i32 1, i32 2])
+  %i1 = add i32 %i, 1
+  %c = icmp eq i32 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  call void @use(%S { i32 7, double 1.5 })
+  ret void
+}
+
+; CHECK: function g(
+; CHECK: $ret_g[1] = $C0[1];
+define %S @g() nounwind {
+  ret %S { i32 7, double 1.5 }
+}
+
+; A zero aggregate that is only taken apart needs no array.
+; CHECK: function h(
+; CHECK-NOT: $C
+; CHECK: }
+define i32 @h(i32 %x) nounwind {
+  %a = insertvalue [2 x i32] zeroinitializer, i32 %x, 0
+  %b = extractvalue [2 x i32] %a, 1
+  ret i32 %b
+}
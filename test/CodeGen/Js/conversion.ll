@@ -35,12 +35,12 @@ entry:
 
 ; CHECK: = (123);
   %I = fptoui double 123.0 to i32
-; CHECK: = (1e+10 & 1);
+; CHECK: = (10000000000 & 1);
   %J = fptoui float 1.0E+10 to i1
 
 ; CHECK: = (-123);
   %K = fptosi double -123.0 to i32
-; CHECK: = (-1e+10 & 1);
+; CHECK: = (-10000000000 & 1);
   %L = fptosi float -1.0e+10 to i1
 
 ; CHECK: = (257);
@@ -0,0 +1,23 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -js-heap -js-data-segment-threshold=8 -o %t2
+; RUN: llc < %s -march=js -js-heap -js-data-segment-threshold=8 | FileCheck %s
+
+; Initializers of at least 8 bytes are decoded from one base64 data segment,
+; smaller ones stay array literals.
+
+@text = global [12 x i8] c"Hello world\00"
+@small = global [2 x i16] [i16 1, i16 2]
+@words = global [3 x i32] [i32 1, i32 2, i32 3]
+
+; CHECK: /* Static Data */
+; CHECK-NEXT: $HEAPU8.set((function(s) {
+; CHECK: })("SGVsbG8gd29ybGQAAAAAAAEAAAACAAAAAw=="), 16);
+; CHECK-NEXT: $HEAPU8.set([1,0,2], small);
+; CHECK-NOT: $HEAPU8.set(
+; CHECK: /* Module Methods */
+
+define i32 @get(i32 %i) {
+  %p = getelementptr [3 x i32]* @words, i32 0, i32 %i
+  %v = load i32* %p
+  ret i32 %v
+}
@@ -0,0 +1,82 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -js-heap | FileCheck %s -check-prefix=HEAP
+
+; invoke is a try/catch around the call followed by a branch to the landing
+; pad or the normal destination, and unwind is a throw.
+
+declare i8* @llvm.eh.exception()
+declare void @report(i8*)
+
+; CHECK: function $Unwind() {}
+
+define internal i32 @thrower(i32 %x) {
+; CHECK: function thrower(
+; CHECK-NOT: $exn
+; CHECK: throw new $Unwind();
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %bad, label %ok
+bad:
+  unwind
+ok:
+  ret i32 %x
+}
+
+define i32 @safe(i32 %x) {
+; CHECK: function safe(
+; CHECK: var $exn, $threw;
+; CHECK-NEXT: $threw = true;
+; CHECK-NEXT: try {
+; CHECK-NEXT: llvm_cbe_r = thrower(llvm_cbe_x);
+; CHECK-NEXT: $threw = false;
+; CHECK-NEXT: } catch ($e) {
+; CHECK-NEXT: $exn = $e;
+; CHECK-NEXT: }
+; CHECK-NEXT: if ($threw) {
+; CHECK-NEXT: llvm_cbe_e = $exn;
+; CHECK-NEXT: report(llvm_cbe_e);
+; CHECK-NEXT: throw $exn;
+; CHECK-NEXT: } else {
+; CHECK-NEXT: return (llvm_cbe_r + 1);
+entry:
+  %r = invoke i32 @thrower(i32 %x) to label %cont unwind label %lpad
+cont:
+  %s = add i32 %r, 1
+  ret i32 %s
+lpad:
+  %e = call i8* @llvm.eh.exception()
+  call void @report(i8* %e)
+  unwind
+}
+
+; In the heap the catch frees what the frames it unwound left on the stack,
+; and an unwind that may run before anything was caught throws a new one.
+
+define i32 @retry(i32 %x) {
+; HEAP: function retry(
+; HEAP: } catch ($e) {
+; HEAP-NEXT: $exn = $e;
+; HEAP-NEXT: $STACKTOP = $sp + 16;
+; HEAP: throw $exn !== undefined ? $exn : new $Unwind();
+entry:
+  %a = alloca i32
+  %b = alloca i32
+  store i32 %x, i32* %a
+  call void @report(i8* null)
+  br label %loop
+loop:
+  %v = load i32* %a
+  %c = icmp eq i32 %v, 0
+  br i1 %c, label %out, label %try
+try:
+  %r = invoke i32 @thrower(i32 %v) to label %next unwind label %loop
+next:
+  store i32 %r, i32* %b
+  %n = load i32* %b
+  %d = icmp eq i32 %n, 1
+  br i1 %d, label %out, label %give_up
+give_up:
+  unwind
+out:
+  ret i32 %v
+}
@@ -0,0 +1,64 @@
+; RUN: echo "api other" > %t.exports
+; RUN: llc < %s -march=js -js-local-bindings -js-exports=%t.exports -js-exports-report=%t.report | FileCheck %s
+; RUN: FileCheck %s -check-prefix=REPORT < %t.report
+; RUN: llc < %s -march=js -js-heap -js-exports=%t.exports -stats |& grep "104 js-backend *- Number of bytes of globals removed as unreachable from the exports"
+
+; Only the listed symbols and main are published.  What they, and the static
+; constructors, do not reach is removed, along with the constants only the
+; removed code used.
+
+@table = global [4 x i32] [i32 1, i32 2, i32 3, i32 4]
+@unused = global [100 x i8] zeroinitializer
+@ptr = global i32* getelementptr ([4 x i32]* @table, i32 0, i32 1)
+@deadptr = global i32 (i32)* @dead
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @init }]
+@counter = internal global i32 0
+@alias = alias i32 (i32)* @dead
+
+; REPORT: global unused 100 bytes
+; REPORT-NEXT: global deadptr 4 bytes
+; REPORT-NEXT: function dead 3 instructions
+; REPORT-NEXT: function dead2 2 instructions
+
+; CHECK-NOT: unused
+; CHECK-NOT: deadptr
+; CHECK: function init(
+; CHECK: function api(
+; CHECK: _.api = api;
+; CHECK: function helper(
+; CHECK-NOT: _.helper
+; CHECK-NOT: dead
+; CHECK: })(window);
+
+declare i32 @ext(i32)
+declare i32 @ext_dead(i32)
+
+define internal void @init() nounwind {
+  store i32 5, i32* @counter
+  ret void
+}
+
+define i32 @api(i32 %x) nounwind {
+  %p = load i32** @ptr
+  %v = load i32* %p
+  %w = call i32 @helper(i32 %v)
+  %c = load i32* @counter
+  %r = add i32 %w, %c
+  ret i32 %r
+}
+
+define i32 @helper(i32 %x) nounwind {
+  %y = call i32 @ext(i32 %x)
+  ret i32 %y
+}
+
+define i32 @dead(i32 %x) nounwind {
+  %y = call i32 @ext_dead(i32 %x)
+  %z = call i32 @dead2(i32 %y)
+  ret i32 %z
+}
+
+define i32 @dead2(i32 %x) nounwind {
+  %y = call i32 @dead(i32 %x)
+  ret i32 %y
+}
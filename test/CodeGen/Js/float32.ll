@@ -0,0 +1,57 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -js-float32 | FileCheck %s -check-prefix=F32
+; RUN: llc < %s -march=js -js-float32 -js-heap | FileCheck %s -check-prefix=HEAP
+
+; Constants print as the shortest decimal that reads back exactly.  With
+; -js-float32, float values are rounded with Math.fround where they are
+; computed, and float constants are printed rounded from their shortest
+; decimal where that is not the same double.
+
+; CHECK: _.g = 0.10000000149011612;
+; F32: _.g = Math.fround(0.1);
+@g = global float 0x3FB99999A0000000
+
+; CHECK: function pi(
+; CHECK-NEXT: return 3.141592653589793;
+; F32: function pi(
+; F32-NEXT: return 3.141592653589793;
+define double @pi() {
+entry:
+  ret double 0x400921FB54442D18
+}
+
+; CHECK: function mul(
+; CHECK-NEXT: return (((llvm_cbe_a * llvm_cbe_b) + 0.10000000149011612) + 0.5);
+; F32: function mul(
+; F32-NEXT: return (Math.fround((Math.fround((Math.fround(llvm_cbe_a * llvm_cbe_b)) + Math.fround(0.1))) + 0.5));
+define float @mul(float %a, float %b) {
+entry:
+  %m = fmul float %a, %b
+  %s = fadd float %m, 0x3FB99999A0000000
+  %h = fadd float %s, 5.000000e-01
+  ret float %h
+}
+
+; F32: function conv(
+; F32: llvm_cbe_x = Math.fround(Math.sqrt(((((Math.fround((Math.fround((llvm_cbe_d))) / (Math.fround((llvm_cbe_i))))))))));
+define float @conv(double %d, i32 %i) {
+entry:
+  %t = fptrunc double %d to float
+  %f = sitofp i32 %i to float
+  %s = fdiv float %t, %f
+  %e = fpext float %s to double
+  %r = fptrunc double %e to float
+  %x = call float @sqrtf(float %r)
+  ret float %x
+}
+
+; HEAP: function store(
+; HEAP: $HEAPF32[(llvm_cbe_p) >> 2] = (Math.fround(llvm_cbe_a + llvm_cbe_b));
+define void @store(float* %p, float %a, float %b) {
+entry:
+  %s = fadd float %a, %b
+  store float %s, float* %p
+  ret void
+}
+
+declare float @sqrtf(float)
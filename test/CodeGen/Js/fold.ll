@@ -0,0 +1,107 @@
+; RUN: llc < %s -march=js -js-heap | FileCheck %s
+; RUN: llc < %s -march=js -js-coercions | FileCheck %s -check-prefix=COERCE
+; RUN: llc < %s -march=js -js-heap -O0 | FileCheck %s -check-prefix=O0
+
+; Loads are folded into the statement that uses them when nothing printed in
+; between may write the memory they read, and pointer casts are printed at
+; each use.
+
+@g = global i32 0
+@h = global i32 0
+@d = global double 0.0
+
+declare void @ext()
+
+; CHECK: _.swap = function swap(
+; CHECK-NEXT: var llvm_cbe_x;
+; CHECK-NEXT: llvm_cbe_x = $HEAP32[(llvm_cbe_a) >> 2];
+; CHECK-NEXT: $HEAP32[(llvm_cbe_a) >> 2] = ($HEAP32[(llvm_cbe_b) >> 2]);
+; CHECK-NEXT: $HEAP32[(llvm_cbe_b) >> 2] = llvm_cbe_x;
+; O0: _.swap = function swap(
+; O0-NEXT: var llvm_cbe_x, llvm_cbe_y;
+define void @swap(i32* %a, i32* %b) nounwind {
+  %x = load i32* %a
+  %y = load i32* %b
+  store i32 %y, i32* %a
+  store i32 %x, i32* %b
+  ret void
+}
+
+; Distinct globals and distinct fields of one object do not alias.
+; CHECK: _.globals = function globals() {
+; CHECK-NEXT: $HEAP32[(h) >> 2] = 1;
+; CHECK-NEXT: return (($HEAP32[(g) >> 2]) + 1);
+; COERCE: _.globals = function globals() {
+; COERCE-NEXT: $HEAP32[(h) >> 2] = 1;
+; COERCE-NEXT: return ((($HEAP32[(g) >> 2] | 0) + 1) | 0) | 0;
+define i32 @globals() nounwind {
+  %x = load i32* @g
+  store i32 1, i32* @h
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+; CHECK: _.fields = function fields(
+; CHECK: llvm_cbe_x = $HEAP32[(llvm_cbe_p0) >> 2];
+; CHECK-NEXT: $HEAP32[(llvm_cbe_p1) >> 2] = 5;
+; CHECK-NEXT: $HEAP32[(llvm_cbe_p0) >> 2] = 6;
+; CHECK-NEXT: return (llvm_cbe_x + ($HEAP32[(llvm_cbe_p1) >> 2]));
+define i32 @fields({i32, i32}* %s) nounwind {
+  %p0 = getelementptr {i32, i32}* %s, i32 0, i32 0
+  %p1 = getelementptr {i32, i32}* %s, i32 0, i32 1
+  %x = load i32* %p0
+  store i32 5, i32* %p1
+  %y = load i32* %p1
+  store i32 6, i32* %p0
+  %z = add i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK: _.call = function call(
+; CHECK: llvm_cbe_x = $HEAP32[(llvm_cbe_p) >> 2];
+; CHECK-NEXT: ext();
+; CHECK-NEXT: return llvm_cbe_x;
+define i32 @call(i32* %p) nounwind {
+  %x = load i32* %p
+  call void @ext()
+  ret i32 %x
+}
+
+; COERCE: _.dbl = function dbl(
+; COERCE: return +((+$HEAPF64[(d) >> 3]) + llvm_cbe_n);
+define double @dbl(double %n) nounwind {
+  %x = load double* @d
+  %y = fadd double %x, %n
+  ret double %y
+}
+
+; CHECK: _.cast = function cast(
+; CHECK-NOT: var
+; CHECK: return
+define i32 @cast(i32* %p, i32 %n) nounwind {
+  %q = bitcast i32* %p to i8*
+  %c = icmp eq i32 %n, 0
+  br i1 %c, label %a, label %b
+a:
+  %x = load i8* %q
+  %xx = zext i8 %x to i32
+  ret i32 %xx
+b:
+  %r = ptrtoint i8* %q to i32
+  ret i32 %r
+}
+
+; A store split into bytes prints the value once for every byte, after the
+; bytes before it are written, so the load is read first.  unaligned returns
+; 256.
+; CHECK: _.unaligned = function unaligned(
+; CHECK: llvm_cbe_x = $HEAP32[(llvm_cbe_p) >> 2];
+; CHECK-NEXT: $HEAPU8[llvm_cbe_p] = (llvm_cbe_x + 1), $HEAPU8[llvm_cbe_p + 1] = (llvm_cbe_x + 1) >> 8,
+define i32 @unaligned(i32* %p) nounwind {
+  store i32 255, i32* %p
+  %x = load i32* %p
+  %y = add i32 %x, 1
+  store i32 %y, i32* %p, align 1
+  %r = load i32* %p
+  ret i32 %r
+}
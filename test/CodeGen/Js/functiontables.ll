@@ -0,0 +1,54 @@
+; RUN: llc < %s -march=js -js-heap -js-local-bindings | FileCheck %s
+
+; In the typed array heap, function pointers are indices into a table per
+; signature, and indirect calls mask the index into it.
+
+; CHECK: $HEAP32[(tab) >> 2] = 1;
+; CHECK-NEXT: $HEAP32[(tab + 4) >> 2] = 2;
+; CHECK-NEXT: $HEAP32[(fp) >> 2] = 1;
+@tab = global [2 x i32 (i32)*] [i32 (i32)* @inc, i32 (i32)* @dec]
+@fp = global i32 (i32)* @inc
+
+declare double @ext(double)
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define internal i32 @dec(i32 %x) {
+  %r = sub i32 %x, 1
+  ret i32 %r
+}
+
+define i32 @call(i32 %i, i32 %x) {
+; CHECK: function call(
+; CHECK: llvm_cbe_r = $FT_ii[($HEAP32[(((tab + (llvm_cbe_i) * 4))) >> 2]) & 3](llvm_cbe_x);
+  %p = getelementptr [2 x i32 (i32)*]* @tab, i32 0, i32 %i
+  %f = load i32 (i32)** %p
+  %r = call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+define i32 @store(i32 %x) {
+; CHECK: function store(
+; CHECK: $HEAP32[(fp) >> 2] = 2;
+; CHECK: return 1;
+  store i32 (i32)* @dec, i32 (i32)** @fp
+  ret i32 ptrtoint (double (double)* @ext to i32)
+}
+
+define void @cast(void ()* %p) {
+; CHECK: function cast(
+; CHECK-NEXT: inc(0);
+; CHECK-NEXT: $FT_v[llvm_cbe_p & 0]();
+  call void bitcast (i32 (i32)* @inc to void (i32)*)(i32 0)
+  call void %p()
+  ret void
+}
+
+; CHECK: /* Function Tables */
+; CHECK-NEXT: function $badcall() { throw 'bad function pointer'; }
+; CHECK-NEXT: var $FT_dd = [$badcall, function() { return ext.apply(null, arguments); }];
+; CHECK-NEXT: var $FT_ii = [$badcall, inc, dec, $badcall];
+; CHECK-NEXT: var $FT_v = [$badcall];
@@ -0,0 +1,102 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -js-heap -O0 -o heap.js
+; RUN: llc < %s -march=js -js-heap -O0 | FileCheck %s
+; RUN: llc < %s -march=js -js-heap | FileCheck %s -check-prefix=OPT
+
+%struct.pair = type { i32, double }
+
+@counter = global i32 7
+@table = global [4 x i16] [i16 1, i16 2, i16 3, i16 4]
+@ptr = global i32* @counter
+@str = internal constant [6 x i8] c"hello\00"
+@flag = global i1 true
+@seven = global i7 -1
+
+; CHECK: var $HEAP = new ArrayBuffer(
+; CHECK: $HEAP32 = new Int32Array($HEAP),
+; CHECK: var $STACKTOP =
+; CHECK: $HEAPU8.set([
+; Integers narrower than a byte are stored zero extended.
+; CHECK: $HEAPU8.set([1], flag);
+; CHECK-NEXT: $HEAPU8.set([127], seven);
+
+define i32 @load_global() {
+; CHECK: function load_global()
+; CHECK: $HEAP32[(counter) >> 2]
+  %v = load i32* @counter
+  ret i32 %v
+}
+
+define i16 @index(i32 %i) {
+; CHECK: function index(
+; CHECK: $HEAPU16[(((table + (llvm_cbe_i) * 2))) >> 1]
+  %p = getelementptr [4 x i16]* @table, i32 0, i32 %i
+  %v = load i16* %p
+  ret i16 %v
+}
+
+define double @frame(i32 %a, double %b) {
+; CHECK: function frame(
+; CHECK: var $sp = $STACKTOP;
+; CHECK: $STACKTOP = $sp + 16;
+; CHECK: llvm_cbe_f1 = (llvm_cbe_s + 8);
+; CHECK: $STACKTOP = $sp;
+  %s = alloca %struct.pair
+  %f0 = getelementptr %struct.pair* %s, i32 0, i32 0
+  store i32 %a, i32* %f0
+  %f1 = getelementptr %struct.pair* %s, i32 0, i32 1
+  store double %b, double* %f1
+  %x = load double* %f1
+  ret double %x
+}
+
+; An alloca with a single use still gets its address before the use, so
+; one_use_frames returns 1.
+define i32 @one_use_frames() {
+; CHECK: function one_use_frames(
+; CHECK: llvm_cbe_a = $sp;
+; CHECK-NEXT: llvm_cbe_b = $sp + 8;
+; CHECK: (llvm_cbe_b + 4)
+; OPT: function one_use_frames(
+; OPT: llvm_cbe_a = $sp;
+; OPT-NEXT: llvm_cbe_b = $sp + 8;
+; OPT: (llvm_cbe_b + 4)
+  %a = alloca [2 x i32]
+  %b = alloca [2 x i32]
+  %pa = getelementptr [2 x i32]* %a, i32 0, i32 1
+  %pb = getelementptr [2 x i32]* %b, i32 0, i32 1
+  store i32 1, i32* %pa
+  store i32 2, i32* %pb
+  %r = load i32* %pa
+  ret i32 %r
+}
+
+declare void @use(i32*)
+
+define void @pass_frame() {
+; CHECK: function pass_frame(
+; CHECK: llvm_cbe_b = $sp;
+; CHECK: use(llvm_cbe_b);
+  %b = alloca i32
+  call void @use(i32* %b)
+  ret void
+}
+
+; The callee works on a copy of a byval argument in its own frame.
+define void @byval(i32 %v, %struct.pair* byval %s) {
+; CHECK: function byval(
+; CHECK: $STACKTOP = $sp + 16;
+; CHECK-NEXT: $HEAPU8.copyWithin($sp, llvm_cbe_s, llvm_cbe_s + 16);
+; CHECK-NEXT: llvm_cbe_s = $sp;
+  %p = getelementptr %struct.pair* %s, i32 0, i32 0
+  store i32 %v, i32* %p
+  ret void
+}
+
+define i64 @wide(i64* %p, i64 %v) {
+; CHECK: function wide(
+; CHECK: Math.floor(
+  store i64 %v, i64* %p
+  %r = load i64* %p
+  ret i64 %r
+}
@@ -0,0 +1,50 @@
+; RUN: llc < %s -march=js -js-heap -O0 | FileCheck %s
+
+; Doubles are 4-byte aligned in the i386 layout, but the heap is laid out
+; like the target so that $HEAPF64 reaches them.  Loads and stores that the
+; module marks as 4-byte aligned still go byte by byte.
+
+target datalayout = "e-p:32:32:32-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:32:64-f32:32:32-f64:32:64-v64:64:64-v128:128:128-a0:0:64-f80:32:32-n8:16:32"
+
+%pair = type { i32, double }
+
+@pairs = global [4 x %pair] [%pair { i32 1, double 1.0 }, %pair { i32 2, double 2.0 }, %pair { i32 3, double 3.0 }, %pair { i32 4, double 4.0 }]
+
+; CHECK: $HEAPU8.set([1,0,0,0,0,0,0,0,0,0,0,0,0,0,240,63,2,0,0,0,0,0,0,0,0,0,0,0,0,0,0,64,3,0,0,0,0,0,0,0,0,0,0,0,0,0,8,64,4,0,0,0,0,0,0,0,0,0,0,0,0,0,16,64], pairs);
+
+define double @sum() nounwind {
+; CHECK: function sum(
+; CHECK: llvm_cbe_d = $HEAPF64[(((pairs + (llvm_cbe_i) * 16 + 8))) >> 3];
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  %s = phi double [ 0.0, %entry ], [ %t, %loop ]
+  %p = getelementptr [4 x %pair]* @pairs, i32 0, i32 %i, i32 1
+  %d = load double* %p
+  %t = fadd double %s, %d
+  %n = add i32 %i, 1
+  %c = icmp eq i32 %n, 4
+  br i1 %c, label %done, label %loop
+
+done:
+  ret double %t
+}
+
+define double @packed(i32 %i) nounwind {
+; CHECK: function packed(
+; CHECK: llvm_cbe_d = ($HEAPU8[8] = $HEAPU8[((pairs + (llvm_cbe_i) * 16 + 8))],
+; CHECK: $HEAPF64[1]);
+  %p = getelementptr [4 x %pair]* @pairs, i32 0, i32 %i, i32 1
+  %d = load double* %p, align 4
+  ret double %d
+}
+
+define void @set(i32 %i, double %d) nounwind {
+; CHECK: function set(
+; CHECK: $HEAPF64[1] = llvm_cbe_d, $HEAPU8[((pairs + (llvm_cbe_i) * 16 + 8))] = $HEAPU8[8],
+  %p = getelementptr [4 x %pair]* @pairs, i32 0, i32 %i, i32 1
+  store double %d, double* %p, align 4
+  ret void
+}
@@ -0,0 +1,184 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -js-coercions -O0 -o i64.js
+; RUN: llc < %s -march=js -js-coercions -O0 | FileCheck %s
+; RUN: llc < %s -march=js -js-heap -O0 | FileCheck %s -check-prefix=DOUBLE
+
+; Only -js-coercions splits i64 values into words.  Otherwise they are doubles,
+; which are only exact up to 2^53.
+
+@state = global i64 1311768467463733248
+
+; CHECK: __js_i64_hi = 
+; CHECK: function __js_i64_udivmod(alo, ahi, blo, bhi, rem) {
+; CHECK: function __js_i64_sdivmod(alo, ahi, blo, bhi, rem) {
+
+define i64 @add(i64 %a, i64 %b) {
+; CHECK: function add(llvm_cbe_a_lo, llvm_cbe_a_hi, llvm_cbe_b_lo, llvm_cbe_b_hi)
+; CHECK: $HEAP32[(__js_i64_hi) >> 2] =
+; DOUBLE: function add(llvm_cbe_a, llvm_cbe_b) {
+; DOUBLE-NEXT: return (llvm_cbe_a + llvm_cbe_b);
+  %r = add i64 %a, %b
+  ret i64 %r
+}
+
+define i64 @mul(i64 %a, i64 %b) {
+; CHECK: function mul(
+; CHECK: return (Math.imul(llvm_cbe_a_lo, llvm_cbe_b_lo)) | 0;
+; DOUBLE: function mul(llvm_cbe_a, llvm_cbe_b) {
+; DOUBLE-NEXT: return (llvm_cbe_a * llvm_cbe_b);
+  %r = mul i64 %a, %b
+  ret i64 %r
+}
+
+define i64 @shl(i64 %a, i64 %n) {
+  %r = shl i64 %a, %n
+  ret i64 %r
+}
+
+define i64 @lshr(i64 %a, i64 %n) {
+  %r = lshr i64 %a, %n
+  ret i64 %r
+}
+
+define i64 @ashr(i64 %a, i64 %n) {
+  %r = ashr i64 %a, %n
+  ret i64 %r
+}
+
+define i64 @sdiv(i64 %a, i64 %b) {
+; CHECK: function sdiv(
+; CHECK: __js_i64_sdivmod(llvm_cbe_a_lo, llvm_cbe_a_hi, llvm_cbe_b_lo, llvm_cbe_b_hi, 0)
+; CHECK-NEXT: return llvm_cbe_r_lo | 0;
+  %r = sdiv i64 %a, %b
+  ret i64 %r
+}
+
+define i64 @urem(i64 %a, i64 %b) {
+  %r = urem i64 %a, %b
+  ret i64 %r
+}
+
+define i32 @ult(i64 %a, i64 %b) {
+; CHECK: function ult(
+; CHECK: return (((((llvm_cbe_a_hi >>> 0) < (llvm_cbe_b_hi >>> 0)) | ((llvm_cbe_a_hi == llvm_cbe_b_hi) & ((llvm_cbe_a_lo >>> 0) < (llvm_cbe_b_lo >>> 0)))) & 1)) | 0;
+  %c = icmp ult i64 %a, %b
+  %r = zext i1 %c to i32
+  ret i32 %r
+}
+
+define i32 @sle(i64 %a, i64 %b) {
+  %c = icmp sle i64 %a, %b
+  %r = zext i1 %c to i32
+  ret i32 %r
+}
+
+; FNV-1a over the bytes of a word, kept in the heap.
+define i64 @fnv(i32 %x) {
+; CHECK: function fnv(
+; CHECK: llvm_cbe_h_lo = $HEAP32[(state) >> 2];
+; CHECK: llvm_cbe_h_hi = $HEAP32[(((state + 4))) >> 2];
+; CHECK: llvm_cbe_h1_lo = Math.imul(llvm_cbe_x1_lo, 435);
+entry:
+  store i64 -3750763034362895579, i64* @state
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %h = load i64* @state
+  %shift = mul i32 %i, 8
+  %byte = lshr i32 %x, %shift
+  %b = and i32 %byte, 255
+  %b64 = zext i32 %b to i64
+  %x1 = xor i64 %h, %b64
+  %h1 = mul i64 %x1, 1099511628211
+  store i64 %h1, i64* @state
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 4
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i64 %h1
+}
+
+define double @tofp(i64 %a) {
+; CHECK: function tofp(
+; CHECK: return +(((+llvm_cbe_a_hi) * 4294967296) + (+(llvm_cbe_a_lo >>> 0)));
+  %r = sitofp i64 %a to double
+  ret double %r
+}
+
+define i64 @fromfp(double %a) {
+  %r = fptosi double %a to i64
+  ret i64 %r
+}
+
+define i64 @bits(double %a) {
+  %r = bitcast double %a to i64
+  ret i64 %r
+}
+
+define i64 @sum(i32 %n) {
+; CHECK: function sum(
+; CHECK: llvm_cbe_acc_lo_ = 0;   /* for PHI node */
+; CHECK: llvm_cbe_acc_hi_ = 0;   /* for PHI node */
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %i64 = zext i32 %i to i64
+  %sq = mul i64 %i64, 4294967297
+  %acc.next = add i64 %acc, %sq
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i64 %acc.next
+}
+
+; A variadic i64 is passed as two words, which va_arg reads back in turn.
+define i64 @first(i32 %n, ...) {
+; CHECK: function first(
+; CHECK: llvm_cbe_a_lo = $HEAP32[$va_arg(llvm_cbe_ap) >> 2];
+; CHECK-NEXT: llvm_cbe_a_hi = $HEAP32[$va_arg(llvm_cbe_ap) >> 2];
+  %ap = alloca i8*
+  %ap2 = bitcast i8** %ap to i8*
+  call void @llvm.va_start(i8* %ap2)
+  %a = va_arg i8** %ap, i64
+  call void @llvm.va_end(i8* %ap2)
+  ret i64 %a
+}
+
+define i64 @callfirst(i64 %a) {
+; CHECK: function callfirst(
+; CHECK: first(1, ($HEAP32[($sp) >> 2] = llvm_cbe_a_lo, $HEAP32[($sp + 8) >> 2] = llvm_cbe_a_hi, $sp))
+  %r = call i64 (i32, ...)* @first(i32 1, i64 %a)
+  ret i64 %r
+}
+
+; Attributes move with the arguments they belong to.
+%pair = type { i32, i32 }
+
+define i32 @byval(i64 %x, %pair* byval %p) {
+; CHECK: function byval(llvm_cbe_t, llvm_cbe_x_hi, llvm_cbe_p) {
+; CHECK: $HEAPU8.copyWithin($sp, llvm_cbe_p, llvm_cbe_p + 8);
+  %f = getelementptr %pair* %p, i32 0, i32 0
+  store i32 7, i32* %f
+  %t = trunc i64 %x to i32
+  ret i32 %t
+}
+
+; Constant expressions are split like the instructions they stand for.
+@g = global i32 0
+
+define i64 @address() {
+; CHECK: function address(
+; CHECK-NEXT: $HEAP32[(__js_i64_hi) >> 2] = (((((g + 4) >>> 0) < (g >>> 0)) & 1) + 1);
+; CHECK-NEXT: return (g + 4) | 0;
+  ret i64 add (i64 ptrtoint (i32* @g to i64), i64 4294967300)
+}
+
+declare void @llvm.va_start(i8*)
+declare void @llvm.va_end(i8*)
@@ -0,0 +1,71 @@
+; RUN: llc < %s -march=js -js-heap | FileCheck %s
+
+; Block copies and fills use the typed array heap, and math intrinsics and
+; libm functions become Math builtins.
+
+declare void @llvm.memcpy.p0i8.p0i8.i32(i8*, i8*, i32, i32, i1)
+declare void @llvm.memmove.p0i8.p0i8.i32(i8*, i8*, i32, i32, i1)
+declare void @llvm.memset.p0i8.i32(i8*, i8, i32, i32, i1)
+declare double @llvm.sqrt.f64(double)
+declare double @llvm.powi.f64(double, i32)
+declare double @llvm.exp2.f64(double)
+declare double @floor(double)
+declare float @fabsf(float)
+declare double @atan2(double, double)
+
+define void @copy(i8* %d, i8* %s, i32 %n) {
+; CHECK: function copy(
+; CHECK-NEXT: $HEAPU8.copyWithin(llvm_cbe_d, llvm_cbe_s, llvm_cbe_s + llvm_cbe_n);
+; CHECK-NEXT: $HEAP32[(llvm_cbe_d) >> 2] = $HEAP32[(llvm_cbe_s) >> 2];
+; CHECK-NEXT: $HEAP32[(llvm_cbe_d + 4) >> 2] = $HEAP32[(llvm_cbe_s + 4) >> 2];
+; CHECK-NEXT: $HEAPU16[(llvm_cbe_d + 8) >> 1] = $HEAPU16[(llvm_cbe_s + 8) >> 1];
+; CHECK-NEXT: $HEAPU8.copyWithin(llvm_cbe_d, llvm_cbe_s, llvm_cbe_s + 16);
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %d, i8* %s, i32 %n, i32 1, i1 false)
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %d, i8* %s, i32 10, i32 4, i1 false)
+  call void @llvm.memmove.p0i8.p0i8.i32(i8* %d, i8* %s, i32 16, i32 4, i1 false)
+  ret void
+}
+
+define void @fill(i8* %d, i8 %v, i32 %n) {
+; CHECK: function fill(
+; CHECK-NEXT: $HEAPU8.fill(llvm_cbe_v, llvm_cbe_d, llvm_cbe_d + llvm_cbe_n);
+; CHECK-NEXT: $HEAP32[(llvm_cbe_d) >> 2] = 16843009;
+; CHECK-NEXT: $HEAPU8[llvm_cbe_d + 4] = 1;
+  call void @llvm.memset.p0i8.i32(i8* %d, i8 %v, i32 %n, i32 1, i1 false)
+  call void @llvm.memset.p0i8.i32(i8* %d, i8 1, i32 5, i32 4, i1 false)
+  ret void
+}
+
+; Pointers printed more than once are computed into their local first.
+define void @offsets(i8* %d, i8* %s, i32 %i, i32 %n) {
+; CHECK: function offsets(
+; CHECK-NEXT: var llvm_cbe_p;
+; CHECK-NEXT: llvm_cbe_p = (llvm_cbe_s + llvm_cbe_i);
+; CHECK-NEXT: $HEAPU8.copyWithin(llvm_cbe_d, llvm_cbe_p, llvm_cbe_p + llvm_cbe_n);
+; CHECK-NEXT: llvm_cbe_p = (llvm_cbe_d + llvm_cbe_i);
+; CHECK-NEXT: $HEAPU8.fill(((llvm_cbe_i & 255)), llvm_cbe_p, llvm_cbe_p + llvm_cbe_n);
+  %p = getelementptr i8* %s, i32 %i
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %d, i8* %p, i32 %n, i32 1, i1 false)
+  %q = getelementptr i8* %d, i32 %i
+  %v = trunc i32 %i to i8
+  call void @llvm.memset.p0i8.i32(i8* %q, i8 %v, i32 %n, i32 1, i1 false)
+  ret void
+}
+
+define double @math(double %x, float %y) {
+; CHECK: function math(
+; CHECK: llvm_cbe_a = Math.sqrt(llvm_cbe_x);
+; CHECK-NEXT: llvm_cbe_a = Math.pow(llvm_cbe_a, 3);
+; CHECK-NEXT: llvm_cbe_a = Math.pow(2, llvm_cbe_a);
+; CHECK-NEXT: llvm_cbe_a = Math.floor(llvm_cbe_a);
+; CHECK-NEXT: llvm_cbe_e = Math.abs(llvm_cbe_y);
+; CHECK-NEXT: llvm_cbe_a = Math.atan2(llvm_cbe_a, (llvm_cbe_e));
+  %a = call double @llvm.sqrt.f64(double %x)
+  %b = call double @llvm.powi.f64(double %a, i32 3)
+  %c = call double @llvm.exp2.f64(double %b)
+  %d = call double @floor(double %c)
+  %e = call float @fabsf(float %y)
+  %f = fpext float %e to double
+  %g = call double @atan2(double %d, double %f)
+  ret double %g
+}
@@ -0,0 +1,27 @@
+; RUN: llc < %s -march=js -js-heap | FileCheck %s
+
+; The heap is laid out like the target, which aligns i64 to 4 bytes, and not
+; like the x86-64 layout the module was compiled for.
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+
+%rec = type { i32, i64, double }
+
+@recs = global [2 x %rec] [%rec { i32 1, i64 2, double 3.0 }, %rec { i32 4, i64 5, double 6.0 }]
+
+; CHECK: $HEAPU8.set([1,0,0,0,2,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,8,64,4,0,0,0,5,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,24,64], recs);
+
+define i64* @wide(%rec* %r) nounwind {
+; CHECK: function wide(
+; CHECK: return ((llvm_cbe_r + 4));
+  %p = getelementptr %rec* %r, i32 0, i32 1
+  ret i64* %p
+}
+
+define double @weight(%rec* %r, i32 %i) nounwind {
+; CHECK: function weight(
+; CHECK: $HEAPF64[(((llvm_cbe_r + (llvm_cbe_i) * 24 + 16))) >> 3]
+  %p = getelementptr %rec* %r, i32 %i, i32 2
+  %w = load double* %p
+  ret double %w
+}
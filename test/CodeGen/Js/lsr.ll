@@ -0,0 +1,31 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -js-heap | FileCheck %s -check-prefix=HEAP
+; RUN: llc < %s -march=js -js-heap -O0 | FileCheck %s -check-prefix=O0
+
+; Heap addresses are stepped through by loop strength reduction, so that the
+; access needs no multiply.  Pointers outside the heap are left alone.
+
+; CHECK: _.sum = function sum(
+; CHECK: llvm_cbe_a[llvm_cbe_i]
+; HEAP: _.sum = function sum(
+; HEAP: $HEAP32[(llvm_cbe_lsr_2e_iv1) >> 2]
+; HEAP: llvm_cbe_lsr_2e_iv1 = ((llvm_cbe_lsr_2e_iv1 + 4));
+; O0: _.sum = function sum(
+; O0: $HEAP32[(((llvm_cbe_a + (llvm_cbe_i) * 4))) >> 2]
+define i32 @sum(i32* %a, i32 %n) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr i32* %a, i32 %i
+  %v = load i32* %p
+  %s.next = add i32 %s, %v
+  %i.next = add i32 %i, 1
+  %c = icmp eq i32 %i.next, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret i32 %s.next
+}
@@ -0,0 +1,34 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -js-minify -o %t2
+; RUN: llc < %s -march=js -js-minify | FileCheck %s
+
+; Locals and labels get short names, the most used first.  Exported members
+; keep their names, and no local shadows a global or a reserved word.
+
+@a = global i32 0
+@b = internal global i32 1
+
+; CHECK: _.a = 0;
+; CHECK-NOT: /*
+; CHECK: _.count = function count(d) {
+; CHECK-NEXT: var c;
+; CHECK-NEXT: c = 0;
+; CHECK-NEXT: c: while(1) {
+; CHECK-NEXT: c = c + 1;
+; CHECK-NEXT: if (!(c < d)) {
+; CHECK-NEXT: return (c + (b));
+define i32 @count(i32 %limit) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %counter = phi i32 [ 0, %entry ], [ %counter.next, %loop ]
+  %counter.next = add i32 %counter, 1
+  %done = icmp slt i32 %counter.next, %limit
+  br i1 %done, label %loop, label %exit
+
+exit:
+  %g = load i32* @b
+  %r = add i32 %counter.next, %g
+  ret i32 %r
+}
@@ -52,7 +52,7 @@ entry:
 
 bb0:
 ; CHECK: = false;
-; CHECK: = true;
+; CHECK: while(1) {
   %N = phi i1 [0, %entry], [1, %bb0]
   br i1 %N, label %bb1, label %bb0
 
@@ -63,5 +63,7 @@ bb1:
   %P = add i32 5, 5
 ; CHECK: test(
   %Q = tail call fastcc i32 @test(i32 %P)
+; CHECK: return;
+; CHECK: = true;
   ret void
 }
@@ -0,0 +1,104 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -js-heap | FileCheck %s -check-prefix=HEAP
+; RUN: printf "\\1\\0\\0\\0\\0\\0\\0\\0\\4\\0\\0\\0\\21\\0\\0\\0" > %t.prof
+; RUN: printf "\\12\\0\\0\\0\\1\\0\\0\\0\\11\\0\\0\\0\\1\\0\\0\\0\\11\\0\\0\\0" >> %t.prof
+; RUN: printf "\\12\\0\\0\\0\\1\\0\\0\\0\\0\\0\\0\\0\\2\\0\\0\\0\\7\\0\\0\\0" >> %t.prof
+; RUN: printf "\\1\\0\\0\\0\\1\\0\\0\\0\\0\\0\\0\\0\\5\\0\\0\\0\\1\\0\\0\\0\\5\\0\\0\\0\\1\\0\\0\\0" >> %t.prof
+; RUN: llc < %s -march=js -js-profile-layout -profile-info-file=%t.prof | FileCheck %s -check-prefix=LAYOUT
+
+; The profile above is an llvmprof.out with one edge profiling record, in the
+; order that -insert-edge-profiling numbers the edges of this module.
+
+; The counters that main registers are dumped by the profiling runtime.  Without
+; the heap they are a typed array indexed by counter.
+; CHECK: function $llvmprof() {
+; CHECK: process.on('exit'
+; CHECK: function llvm_start_edge_profiling(argc, argv, counters, n) {
+; CHECK-NEXT: $profile_start(4, counters);
+; CHECK: var EdgeProfCounters = new Uint32Array(3);
+
+; HEAP: $profile_start(4, $HEAPU32.subarray(counters >> 2, (counters >> 2) + n));
+
+@EdgeProfCounters = internal global [3 x i32] zeroinitializer
+
+declare void @g(i32)
+
+; The hotter successor gets the first arm.
+; LAYOUT: _.branch = function branch(llvm_cbe_x) {
+; LAYOUT-NEXT: if (!(llvm_cbe_x > 10)) {
+; LAYOUT-NEXT: g(2);
+; LAYOUT: } else {
+; LAYOUT-NEXT: g(1);
+define void @branch(i32 %x) nounwind {
+entry:
+  %c = icmp sgt i32 %x, 10
+  br i1 %c, label %big, label %small
+big:
+  call void @g(i32 1)
+  br label %done
+small:
+  call void @g(i32 2)
+  br label %done
+done:
+  ret void
+}
+
+; Switch cases are tested hottest first.
+; LAYOUT: _.sw = function sw(llvm_cbe_x) {
+; LAYOUT: default:
+; LAYOUT: case 3:
+; LAYOUT: case 2:
+; LAYOUT: case 1:
+define i32 @sw(i32 %x) nounwind {
+entry:
+  switch i32 %x, label %d [ i32 1, label %a
+                            i32 2, label %b
+                            i32 3, label %c ]
+a:
+  ret i32 10
+b:
+  ret i32 20
+c:
+  ret i32 30
+d:
+  ret i32 0
+}
+
+; So are the blocks of an irreducible function after its entry block.
+; CHECK: _.irr = function irr(llvm_cbe_c, llvm_cbe_n) {
+; CHECK: case 'llvm_cbe_exit':
+; CHECK: case 'llvm_cbe_a':
+; CHECK: case 'llvm_cbe_b':
+; LAYOUT: _.irr = function irr(llvm_cbe_c, llvm_cbe_n) {
+; LAYOUT: case 'llvm_cbe_entry':
+; LAYOUT: case 'llvm_cbe_a':
+; LAYOUT: case 'llvm_cbe_b':
+; LAYOUT: case 'llvm_cbe_exit':
+define i32 @irr(i1 %c, i32 %n) nounwind {
+entry:
+  br i1 %c, label %a, label %b
+exit:
+  ret i32 %i1
+a:
+  %i = phi i32 [ 0, %entry ], [ %j1, %b ]
+  %i1 = add i32 %i, 1
+  %ca = icmp slt i32 %i1, %n
+  br i1 %ca, label %b, label %exit
+b:
+  %j = phi i32 [ 0, %entry ], [ %i1, %a ]
+  %j1 = add i32 %j, 2
+  br label %a
+}
+
+; CHECK: llvm_start_edge_profiling(llvm_cbe_argc, llvm_cbe_argv, EdgeProfCounters, 3);
+; CHECK-NEXT: ((EdgeProfCounters[1])) = ((((EdgeProfCounters[1]))) + 1);
+define i32 @main(i32 %argc, i8** %argv) nounwind {
+entry:
+  %0 = call i32 @llvm_start_edge_profiling(i32 %argc, i8** %argv, i32* getelementptr ([3 x i32]* @EdgeProfCounters, i32 0, i32 0), i32 3)
+  %old = load i32* getelementptr ([3 x i32]* @EdgeProfCounters, i32 0, i32 1)
+  %new = add i32 %old, 1
+  store i32 %new, i32* getelementptr ([3 x i32]* @EdgeProfCounters, i32 0, i32 1)
+  ret i32 0
+}
+
+declare i32 @llvm_start_edge_profiling(i32, i8**, i32*, i32)
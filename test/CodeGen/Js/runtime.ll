@@ -0,0 +1,74 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -js-external-runtime | FileCheck %s -check-prefix=EXTERNAL
+; RUN: llc < %s -march=js -js-checked-div | FileCheck %s -check-prefix=CHECKED
+; RUN: llc < %s -march=js -js-coercions -js-checked-div | FileCheck %s -check-prefix=COERCE
+
+; Helpers that the printed code needs come from one runtime support library
+; per page.  The first module loaded defines it, the others reuse it.
+
+; CHECK: var $rt = $w["$llvmjs_1"] || ($w["$llvmjs_1"] = (function() {
+; CHECK: fcmp_ult: function(a, b) { return !(a >= b); },
+; CHECK: f32_bits: function(x) { f32[0] = x; return i32[0]; },
+; CHECK: sdiv: function(a, b) {
+; CHECK: udivmod64: function(alo, ahi, blo, bhi, rem) {
+; CHECK: })());
+; EXTERNAL: var $rt = $w["$llvmjs_1"];
+; EXTERNAL-NOT: function(a, b)
+; EXTERNAL: Module Methods
+
+@g = global i32 0
+
+; CHECK: function bits(
+; CHECK-NEXT: return (($rt.f32_bits(llvm_cbe_x)));
+; COERCE: function bits(
+; COERCE: return (($rt.f32_bits(llvm_cbe_x) | 0)) | 0;
+define i32 @bits(float %x) nounwind {
+  %b = bitcast float %x to i32
+  ret i32 %b
+}
+
+; CHECK: function value(
+; CHECK-NEXT: return (($rt.bits_f64(llvm_cbe_x)));
+define double @value(i64 %x) nounwind {
+  %b = bitcast i64 %x to double
+  ret double %b
+}
+
+; Constant expressions print like the instructions they stand for.
+; CHECK: function unordered(
+; CHECK-NEXT: return ($rt.fcmp_ult(((g)), 1));
+; COERCE: function unordered(
+; COERCE-NEXT: return ($rt.fcmp_ult((g), 1)) | 0;
+define i1 @unordered() nounwind {
+  ret i1 fcmp ult (double sitofp (i32 ptrtoint (i32* @g to i32) to double), double 1.0)
+}
+
+; CHECK: function third(
+; CHECK-NEXT: return Math.floor(((g) >>> 0) / 3);
+define i32 @third() nounwind {
+  ret i32 udiv (i32 ptrtoint (i32* @g to i32), i32 3)
+}
+
+; Division only goes through the runtime with -js-checked-div.
+; CHECK: function quotient(
+; CHECK-NEXT: return (Math.floor(llvm_cbe_a / llvm_cbe_b));
+; CHECKED: function quotient(
+; CHECKED-NEXT: return (($rt.sdiv(llvm_cbe_a, llvm_cbe_b)));
+; COERCE: function quotient(
+; COERCE: return (($rt.sdiv(llvm_cbe_a, llvm_cbe_b) | 0)) | 0;
+define i32 @quotient(i32 %a, i32 %b) nounwind {
+  %q = sdiv i32 %a, %b
+  ret i32 %q
+}
+
+; CHECKED: function remainder(
+; CHECKED-NEXT: return (($rt.urem(llvm_cbe_a, llvm_cbe_b)));
+define i32 @remainder(i32 %a, i32 %b) nounwind {
+  %r = urem i32 %a, %b
+  ret i32 %r
+}
+
+; i64 values are bitcast through the stack with -js-coercions.
+; COERCE: function value(
+; COERCE-NOT: $rt
+; COERCE: return +(+$HEAPF64[
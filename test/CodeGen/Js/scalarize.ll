@@ -0,0 +1,72 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -O0 | FileCheck %s -check-prefix=O0
+
+; Struct and array values are kept in scalar locals.  Aggregates are returned
+; in a slot per function whose elements the caller reads right away, and only
+; built as arrays where they escape.
+
+; CHECK: var $ret_pair = [0, 0];
+; CHECK: function pair(
+; CHECK-NEXT: $ret_pair[0] = llvm_cbe_a;
+; CHECK-NEXT: $ret_pair[1] = llvm_cbe_b;
+; CHECK-NEXT: return $ret_pair;
+; O0: function pair(
+; O0: return [llvm_cbe_a, llvm_cbe_b];
+define { i32, double } @pair(i32 %a, double %b) {
+entry:
+  %0 = insertvalue { i32, double } undef, i32 %a, 0
+  %1 = insertvalue { i32, double } %0, double %b, 1
+  ret { i32, double } %1
+}
+
+; CHECK: function twice(
+; CHECK: llvm_cbe_p = pair(llvm_cbe_a, 2);
+; CHECK-NEXT: llvm_cbe_x = (llvm_cbe_p[0]);
+; CHECK-NEXT: llvm_cbe_p = pair(3, 4);
+; CHECK-NEXT: llvm_cbe_y = (llvm_cbe_p[0]);
+define i32 @twice(i32 %a) {
+entry:
+  %p = call { i32, double } @pair(i32 %a, double 2.0)
+  %q = call { i32, double } @pair(i32 3, double 4.0)
+  %x = extractvalue { i32, double } %p, 0
+  %y = extractvalue { i32, double } %q, 0
+  %s = add i32 %x, %y
+  ret i32 %s
+}
+
+; A loop carried struct is split into one PHI per element.
+; CHECK: function loop(
+; CHECK-NOT: [
+; CHECK: return
+define double @loop(i32 %n) {
+entry:
+  br label %l
+l:
+  %i = phi i32 [ 0, %entry ], [ %i1, %l ]
+  %acc = phi { i32, double } [ zeroinitializer, %entry ], [ %acc2, %l ]
+  %v = extractvalue { i32, double } %acc, 1
+  %w = extractvalue { i32, double } %acc, 0
+  %v1 = fadd double %v, 1.5
+  %w1 = add i32 %w, %i
+  %acc1 = insertvalue { i32, double } %acc, double %v1, 1
+  %acc2 = insertvalue { i32, double } %acc1, i32 %w1, 0
+  %i1 = add i32 %i, 1
+  %d = icmp eq i32 %i1, %n
+  br i1 %d, label %e, label %l
+e:
+  %r = extractvalue { i32, double } %acc2, 1
+  ret double %r
+}
+
+declare void @use([2 x { i32, i32 }])
+
+; CHECK: function escape(
+; CHECK: = {{\[\[}}0, 0], [llvm_cbe_a, 0]];
+; O0: function escape(
+; O0: = {{\[\[}}0, 0], [llvm_cbe_a, 0]];
+define void @escape(i32 %a) {
+entry:
+  %0 = insertvalue [2 x { i32, i32 }] zeroinitializer, i32 %a, 1, 0
+  call void @use([2 x { i32, i32 }] %0)
+  ret void
+}
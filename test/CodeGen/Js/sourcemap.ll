@@ -0,0 +1,39 @@
+; RUN: llc < %s -march=js -js-source-map=%t.map | FileCheck %s
+; RUN: FileCheck %s -check-prefix=MAP < %t.map
+; RUN: llc < %s -march=js -js-threads=4 -js-source-map=%t2.map -o %t2
+; RUN: diff %t.map %t2.map
+
+; Statements map to the debug location of their instruction, or to its line
+; in the IR embedded in the map when it has none.
+
+; CHECK: llvm_cbe_a = llvm_cbe_w + llvm_cbe_x;
+; CHECK-NEXT: use(llvm_cbe_a);
+; CHECK-NEXT: use((Math.floor(llvm_cbe_a / llvm_cbe_x)));
+; CHECK-NEXT: return;
+; CHECK: })(window);
+; CHECK-NEXT: //# sourceMappingURL={{[^/]*}}.map
+
+; MAP: {"version":3,"sources":["/dir/test.c","<stdin>"],
+; MAP: "sourcesContent":[null,"; ModuleID = '<stdin>'\n
+; MAP: "mappings":";;;;;;;;EAGE;EAAA;ECMF;ADJA"}
+
+declare void @use(i32)
+
+define void @foo(i32 %w, i32 %x) {
+entry:
+  %a = add i32 %w, %x, !dbg !8
+  call void @use(i32 %a), !dbg !8
+  %b = sdiv i32 %a, %x
+  call void @use(i32 %b)
+  ret void, !dbg !9
+}
+
+!1 = metadata !{i32 524334, i32 0, metadata !2, metadata !"foo", metadata !"foo", metadata !"foo", metadata !2, i32 1, metadata !4, i1 false, i1 true, i32 0, i32 0, null, i1 false, i1 false} ; [ DW_TAG_subprogram ]
+!2 = metadata !{i32 524329, metadata !"test.c", metadata !"/dir", metadata !3} ; [ DW_TAG_file_type ]
+!3 = metadata !{i32 524305, i32 0, i32 12, metadata !"test.c", metadata !".", metadata !"producer", i1 true, i1 false, metadata !"", i32 0} ; [ DW_TAG_compile_unit ]
+!4 = metadata !{i32 524309, metadata !2, metadata !"", metadata !2, i32 0, i64 0, i64 0, i64 0, i32 0, null, metadata !5, i32 0, null} ; [ DW_TAG_subroutine_type ]
+!5 = metadata !{metadata !6}
+!6 = metadata !{i32 524324, metadata !2, metadata !"int", metadata !2, i32 0, i64 32, i64 32, i64 0, i32 0, i32 5} ; [ DW_TAG_base_type ]
+!7 = metadata !{i32 524299, metadata !1, i32 1, i32 30} ; [ DW_TAG_lexical_block ]
+!8 = metadata !{i32 4, i32 3, metadata !7, null}
+!9 = metadata !{i32 6, i32 1, metadata !7, null}
@@ -0,0 +1,120 @@
+; RUN: rm -f %t.*.js
+; RUN: llc < %s -march=js -js-local-bindings -js-heap -js-split-chunks=%t | FileCheck %s
+; RUN: FileCheck %s -check-prefix=CHUNK < %t.1.js
+; RUN: llc < %s -march=js -js-local-bindings -js-heap -js-split-chunks=%t -js-chunk-size=1 -stats |& grep "6 js-backend *- Number of functions left out of the eager code for lazily loaded chunks"
+; RUN: FileCheck %s -check-prefix=SMALL < %t.5.js
+; RUN: printf "\\1\\0\\0\\0\\0\\0\\0\\0\\4\\0\\0\\0\\13\\0\\0\\0" > %t.prof
+; RUN: printf "\\1\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0" >> %t.prof
+; RUN: printf "\\1\\0\\0\\0\\0\\0\\0\\0\\1\\0\\0\\0\\0\\0\\0\\0" >> %t.prof
+; RUN: printf "\\0\\0\\0\\0\\0\\0\\0\\0\\1\\0\\0\\0" >> %t.prof
+; RUN: llc < %s -march=js -js-local-bindings -js-split-chunks=%t.s | FileCheck %s -check-prefix=STUB
+; RUN: FileCheck %s -check-prefix=BODY < %t.s.1.js
+; RUN: llc < %s -march=js -js-local-bindings -js-profile-layout -profile-info-file=%t.prof -js-split-chunks=%t.p | FileCheck %s -check-prefix=PROF
+
+; Functions that main does not reach are printed to chunks that are loaded
+; the first time one of their stubs is called.  A chunk follows the calls of
+; its first function.  With a profile, startup keeps only what ran.  The
+; profile above is an llvmprof.out with one edge profiling record.  Outside
+; the heap a function pointer is the function, so the stub stays the function
+; and calls the body the chunk gives it.
+
+@fp = global i32 (i32)* @cold2
+
+; CHECK: /* Chunks */
+; CHECK: function $load($chunk) {
+; CHECK: var $url = "{{split.*tmp}}." + $chunk + ".js", $src;
+; CHECK: eval($src);
+; CHECK: /* Module Methods */
+
+; CHECK: function hot(
+; CHECK: function cold() { $load(1); return cold.apply(this, arguments); }
+; CHECK-NEXT: _.cold = cold;
+; CHECK: function cold_helper() { $load(1); return cold_helper.apply(this, arguments); }
+; CHECK-NOT: _.cold_helper
+; CHECK: function cold2() { $load(1); return cold2.apply(this, arguments); }
+; CHECK: function main(
+; CHECK: function callptr() { $load(1); return callptr.apply(this, arguments); }
+; CHECK: function rare(
+; CHECK: function often() { $load(1); return often.apply(this, arguments); }
+; CHECK: var $FT_ii = [$badcall, cold2];
+
+; CHUNK: cold = function cold(
+; CHUNK: cold_helper(
+; CHUNK: };
+; CHUNK-NEXT: _.cold = cold;
+; CHUNK: cold_helper = function cold_helper(
+; CHUNK: cold2 = function cold2(
+; CHUNK: callptr = function callptr(
+; CHUNK: $FT_ii[1] = cold2;
+
+; SMALL: often = function often(
+
+; STUB: var fp = cold2;
+; STUB: function cold2() { $load(1); return cold2.$body.apply(this, arguments); }
+; STUB-NEXT: _.cold2 = cold2;
+
+; BODY: cold2.$body = function $cold2(
+; BODY-NOT: _.cold2
+; BODY: same.$body = function $same(
+; BODY-NEXT: return ((fp) === cold2);
+
+; PROF: function hot(
+; PROF: function main(
+; PROF: function rare() { $load(1); return rare.$body.apply(this, arguments); }
+; PROF: function often(
+
+define i32 @hot(i32 %x) nounwind {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @cold(i32 %x) nounwind {
+  %y = call i32 @cold_helper(i32 %x)
+  %z = mul i32 %y, 3
+  ret i32 %z
+}
+
+define internal i32 @cold_helper(i32 %x) nounwind {
+  %y = sub i32 %x, 2
+  ret i32 %y
+}
+
+define i32 @cold2(i32 %x) nounwind {
+  %y = shl i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @main() nounwind {
+entry:
+  %a = call i32 @hot(i32 1)
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %rare, label %done
+rare:
+  %r = call i32 @rare(i32 %a)
+  br label %done
+done:
+  %p = phi i32 [ %a, %entry ], [ %r, %rare ]
+  ret i32 %p
+}
+
+define i32 @callptr(i32 %x) nounwind {
+  %f = load i32 (i32)** @fp
+  %r = call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+define i32 @rare(i32 %x) nounwind {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @often(i32 %x) nounwind {
+  %y = add i32 %x, 2
+  ret i32 %y
+}
+
+define i1 @same() nounwind {
+  %f = load i32 (i32)** @fp
+  %c = icmp eq i32 (i32)* %f, @cold2
+  ret i1 %c
+}
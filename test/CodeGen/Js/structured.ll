@@ -0,0 +1,75 @@
+; RUN: llvm-as < %s | llvm-dis > %t1
+; RUN: llc < %s -march=js -O0 -o structured.js
+; RUN: llc < %s -march=js -O0 | FileCheck %s
+
+; Reducible control flow is emitted as nested JS statements, without the
+; label dispatcher.
+
+; CHECK: _.sum = function sum(
+define i32 @sum(i32 %n) nounwind {
+entry:
+; CHECK-NOT: switch(_)
+; CHECK: if (
+  %c = icmp sgt i32 %n, 0
+  br i1 %c, label %loop, label %exit
+
+; CHECK: : while(1) {
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %s.next = add i32 %s, %i
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+; CHECK: if (
+; CHECK: break
+; CHECK: }
+  br i1 %done, label %exit, label %loop
+
+exit:
+; CHECK: return
+  %r = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  ret i32 %r
+}
+
+; CHECK: _.select = function select(
+define i32 @select(i32 %x) nounwind {
+entry:
+; CHECK-NOT: switch(_)
+; CHECK: : {
+; CHECK: switch (
+; CHECK: default:
+; CHECK: break
+; CHECK: case 1:
+; CHECK-NEXT: case 2:
+; CHECK: break
+; CHECK: case 3:
+; CHECK-NEXT: return 7;
+  switch i32 %x, label %merge [ i32 1, label %one
+                                i32 2, label %one
+                                i32 3, label %three ]
+one:
+  br label %merge
+three:
+  ret i32 7
+merge:
+; CHECK: return
+  %r = phi i32 [ 1, %one ], [ 0, %entry ]
+  ret i32 %r
+}
+
+; Irreducible control flow falls back to the label dispatcher.
+
+; CHECK: _.irreducible = function irreducible(
+define void @irreducible(i1 %c) nounwind {
+entry:
+; CHECK: var _ = '
+; CHECK-NEXT: while(1) {
+; CHECK-NEXT: switch(_) {
+  br i1 %c, label %a, label %b
+a:
+  br i1 %c, label %b, label %exit
+b:
+  br i1 %c, label %a, label %exit
+exit:
+  ret void
+}
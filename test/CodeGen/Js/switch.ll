@@ -0,0 +1,89 @@
+; RUN: llc < %s -march=js | FileCheck %s
+; RUN: llc < %s -march=js -O0 | FileCheck %s -check-prefix=O0
+
+; Dense switches look their successor up in a table and sparse ones find it
+; with a tree of comparisons.  Small switches and -O0 keep the case values.
+
+; CHECK: var $sw0_dense = new Uint8Array([1,1,2,0,3,1,2]);
+; CHECK: function dense(
+; CHECK-NEXT: switch ($sw0_dense[llvm_cbe_x - 1]) {
+; CHECK-NEXT: default:
+; CHECK-NEXT: return 0;
+; CHECK-NEXT: case 1:
+; CHECK-NEXT: return 10;
+; CHECK-NEXT: case 2:
+; CHECK-NEXT: return 20;
+; CHECK-NEXT: case 3:
+; CHECK-NEXT: return 30;
+; O0: function dense(
+; O0-NEXT: switch (llvm_cbe_x) {
+; O0-NEXT: default:
+; O0-NEXT: return 0;
+; O0-NEXT: case 1:
+; O0-NEXT: case 2:
+; O0-NEXT: case 6:
+; O0-NEXT: return 10;
+
+define i32 @dense(i32 %x) nounwind {
+entry:
+  switch i32 %x, label %d [ i32 1, label %a
+                            i32 2, label %a
+                            i32 3, label %b
+                            i32 5, label %c
+                            i32 6, label %a
+                            i32 7, label %b ]
+a:
+  ret i32 10
+b:
+  ret i32 20
+c:
+  ret i32 30
+d:
+  ret i32 0
+}
+
+; CHECK: function sparse(
+; CHECK-NEXT: switch ((llvm_cbe_x < 1000 ? (llvm_cbe_x < 7 ? (llvm_cbe_x == -100 ? 1 : 0) : (llvm_cbe_x <= 9 ? 2 : 0)) : (llvm_cbe_x < 50000 ? (llvm_cbe_x == 1000 ? 3 : 0) : (llvm_cbe_x == 50000 ? 1 : 0)))) {
+; CHECK-NEXT: default:
+; CHECK-NEXT: return 0;
+; CHECK-NEXT: case 1:
+; CHECK-NEXT: return 10;
+
+define i32 @sparse(i32 %x) nounwind {
+entry:
+  switch i32 %x, label %d [ i32 -100, label %a
+                            i32 7, label %b
+                            i32 8, label %b
+                            i32 9, label %b
+                            i32 1000, label %c
+                            i32 50000, label %a ]
+a:
+  ret i32 10
+b:
+  ret i32 20
+c:
+  ret i32 30
+d:
+  ret i32 0
+}
+
+; CHECK: function small(
+; CHECK-NEXT: switch (llvm_cbe_x) {
+; CHECK-NEXT: default:
+; CHECK-NEXT: return 0;
+; CHECK-NEXT: case 1:
+; CHECK-NEXT: return 10;
+; CHECK-NEXT: case 4:
+; CHECK-NEXT: return 20;
+
+define i32 @small(i32 %x) nounwind {
+entry:
+  switch i32 %x, label %d [ i32 1, label %a
+                            i32 4, label %b ]
+a:
+  ret i32 10
+b:
+  ret i32 20
+d:
+  ret i32 0
+}
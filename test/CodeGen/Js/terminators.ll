@@ -4,32 +4,28 @@
 
 define i32 @main(i32 %argc, i8** nocapture %argv) nounwind {
 entry:
-; CHECK: if (true) {
-; CHECK: _ =
-; CHECK: continue;
-; CHECK: } else {
-; CHECK: _ =
-; CHECK: continue;
-; CHECK: }
+; CHECK: [[PIT:[$_A-z0-9]+]]: {
+; CHECK-NEXT: if (true) {
   br i1 1, label %bb_1, label %pit
 
 ; CHECK-NOT: do {
 
 bb_1:
-; CHECK: case '{{[$_A-z0-9]+}}':
-; CHECK-NEXT: _ =
-; CHECK-NEXT: continue;
+; CHECK-NEXT: [[LOOP:[$_A-z0-9]+]]: while(1) {
   br label %bb_2
 bb_2:
-; CHECK: switch (2) {
-; CHECK: case 0:
-; CHECK: case 1:
-; CHECK: case 2:
+; CHECK-NEXT: switch (2) {
+; CHECK-NEXT: default:
+; CHECK-NEXT: case 0:
+; CHECK-NEXT: break [[PIT]];
+; CHECK-NEXT: case 1:
+; CHECK-NEXT: continue [[LOOP]];
+; CHECK-NEXT: case 2:
   switch i32 2, label %pit [ i32 0, label %pit
                              i32 1, label %bb_1
 			     i32 2, label %bb_3 ]
 bb_3:
-; CHECK: return 1;
+; CHECK-NEXT: return 1;
   ret i32 1
 pit:
 ; CHECK: throw
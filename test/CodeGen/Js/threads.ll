@@ -0,0 +1,45 @@
+; RUN: llc < %s -march=js -o %t1
+; RUN: llc < %s -march=js -js-threads=4 -o %t2
+; RUN: diff %t1 %t2
+; RUN: llc < %s -march=js -js-threads=4 | FileCheck %s
+
+; Function bodies printed on worker threads come out in module order, with
+; the same names for unnamed values as a serial run.
+
+%struct.S = type { i32, double }
+
+@g = global %struct.S zeroinitializer
+@0 = internal global i32 7
+
+; CHECK: _.first = function first(
+; CHECK: llvm_cbe_tmp__1 = llvm_cbe_tmp__1 + 1;
+define i32 @first(i32 %n) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %0 = phi i32 [ 0, %entry ], [ %1, %loop ]
+  %1 = add i32 %0, 1
+  %c = icmp slt i32 %1, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %1
+}
+
+; CHECK: _.second = function second(
+; CHECK: __unnamed_1
+define double @second(%struct.S* %p) nounwind {
+  %q = getelementptr %struct.S* %p, i32 0, i32 1
+  %d = load double* %q
+  %i = load i32* @0
+  %f = sitofp i32 %i to double
+  %r = fadd double %d, %f
+  ret double %r
+}
+
+; CHECK: _.third = function third(
+define double @third() nounwind {
+  %r = call double @second(%struct.S* @g)
+  ret double %r
+}
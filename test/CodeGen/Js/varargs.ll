@@ -1,25 +1,41 @@
 ; RUN: llvm-as < %s | llvm-dis > %t1
 ; RUN: llc < %s -march=js -O0 -o varargs.js
 ; RUN: llc < %s -march=js -O0 | FileCheck %s
+; RUN: llc < %s -march=js -O0 -js-heap | FileCheck %s -check-prefix=HEAP
 
+; Variadic arguments are passed in one buffer after the named arguments, an
+; array or a run of heap slots, and va_list is a cursor into it.
+
+; HEAP: function $va_arg(ap) {
+; HEAP-NEXT: var p = $HEAP32[ap >> 2];
+; HEAP-NEXT: $HEAP32[ap >> 2] = p + 8;
+; HEAP-NEXT: return p;
+
+; CHECK: function printf$va() {
+; CHECK-NEXT: var a = Array.prototype.slice.call(arguments, 0, 1);
+; CHECK-NEXT: return printf.apply(null, a.concat(arguments[1]));
+
+; CHECK: function misc($va) {
+; HEAP: function misc($va) {
 define void @misc(...) {
 entry:
   ; Initialize variable argument processing
   %ap = alloca i8*
   %ap2 = bitcast i8** %ap to i8*
-; CHECK: ._ = 0;
+; CHECK: llvm_cbe_ap2.va = $va, llvm_cbe_ap2._ = 0;
+; HEAP: $HEAP32[(llvm_cbe_ap2) >> 2] = $va;
   call void @llvm.va_start(i8* %ap2)
 
   ; Read a single integer argument
-; CHECK: = arguments[
-; CHECK: ._++];
+; CHECK-NEXT: llvm_cbe_tmp = llvm_cbe_ap.va[llvm_cbe_ap._++];
+; HEAP-NEXT: llvm_cbe_tmp = $HEAP32[$va_arg(llvm_cbe_ap) >> 2];
   %tmp = va_arg i8** %ap, i32
 
   ; Demonstrate usage of llvm.va_copy and llvm.va_end
   %aq = alloca i8*
   %aq2 = bitcast i8** %aq to i8*
-; CHECK: ._ =
-; CHECK: ._;
+; CHECK: llvm_cbe_aq2.va = llvm_cbe_ap2.va, llvm_cbe_aq2._ = llvm_cbe_ap2._;
+; HEAP: $HEAP32[(llvm_cbe_aq2) >> 2] = $HEAP32[(llvm_cbe_ap2) >> 2];
   call void @llvm.va_copy(i8* %aq2, i8* %ap2)
   call void @llvm.va_end(i8* %aq2)
 
@@ -28,6 +44,34 @@ entry:
   ret void
 }
 
+; Functions of the environment take variadic arguments as they are.
+; CHECK: function caller(
+; CHECK: misc([1, 2.5]);
+; CHECK-NEXT: printf(llvm_cbe_f, 1, 2.5);
+; HEAP: function caller(
+; HEAP: misc(($HEAP32[($sp) >> 2] = 1, $HEAPF64[($sp + 8) >> 3] = 2.5, $sp));
+; HEAP-NEXT: printf(llvm_cbe_f, 1, 2.5);
+define void @caller(i8* %f) {
+  call void (...)* @misc(i32 1, double 2.5)
+  call i32 (i8*, ...)* @printf(i8* %f, i32 1, double 2.5)
+  ret void
+}
+
 declare void @llvm.va_start(i8*)
 declare void @llvm.va_copy(i8*, i8*)
-declare void @llvm.va_end(i8*)
\ No newline at end of file
+declare void @llvm.va_end(i8*)
+declare i32 @printf(i8*, ...)
+
+; A pointer to one of them may be called with a buffer, so it is a forwarder
+; that spreads the buffer.  In the heap the call spreads the arguments after
+; the buffer, and the table entry drops the buffer.
+; CHECK: function indirect(
+; CHECK: (((llvm_cbe_c) ? (printf$va) : (null)))(llvm_cbe_f, [1, 2.5]);
+; HEAP: function indirect(
+; HEAP: $FT_iix[{{.*}}](llvm_cbe_f, ($HEAP32[($sp) >> 2] = 1, $HEAPF64[($sp + 8) >> 3] = 2.5, $sp), $HEAP32[($sp) >> 2], $HEAPF64[($sp + 8) >> 3]);
+; HEAP: var $FT_iix = [$badcall, function() { var a = Array.prototype.slice.call(arguments); a.splice(1, 1); return printf.apply(null, a); }];
+define i32 @indirect(i8* %f, i1 %c) {
+  %p = select i1 %c, i32 (i8*, ...)* @printf, i32 (i8*, ...)* null
+  %r = call i32 (i8*, ...)* %p(i8* %f, i32 1, double 2.5)
+  ret i32 %r
+}